@@ -0,0 +1,233 @@
+#include <X11/Xlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "main.h"
+#include "timer.h"
+#include "activity.h"
+
+/*
+    Activity meter over the RECORD extension.
+
+    A record context on a connection of its own delivers every key and
+    pointer event of the server to a meter thread, batched as the server
+    sends them. The thread only adds them up, allocating nothing, and
+    publishes its totals once a second of server time, so the rest of the
+    program reads a handful of atomics and never sees single events.
+
+    Work counts faster while it is intense: a sample with keystrokes or
+    pointer travel per minute over the limits counts activity_weight
+    seconds for every second it covers.
+
+    Needs libXtst, built with -DXREST_RECORD.
+*/
+
+#ifdef XREST_RECORD
+
+#include <X11/Xproto.h>
+#include <X11/extensions/record.h>
+
+
+static void publish(ActivityContext *activity)
+{
+    atomic_store_explicit(&activity->published_keys, activity->keys, memory_order_relaxed);
+    atomic_store_explicit(&activity->published_distance, (unsigned long)activity->distance, memory_order_relaxed);
+    atomic_store_explicit(&activity->published_records, activity->records, memory_order_relaxed);
+
+    struct timespec cpu;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    atomic_store_explicit(&activity->cpu_ns, cpu.tv_sec * 1000000000UL + cpu.tv_nsec, memory_order_relaxed);
+}
+
+
+static void intercept(XPointer closure, XRecordInterceptData *record)
+{
+    ActivityContext *activity = (ActivityContext *)closure;
+
+    if (record->category == XRecordFromServer && record->data_len * 4 >= sizeof(xEvent))
+    {
+        const xEvent *event = (const xEvent *)record->data;
+        switch (event->u.u.type & 0x7f)
+        {
+            case KeyPress:
+                activity->keys++;
+                break;
+
+            case MotionNotify:
+            {
+                int x = event->u.keyButtonPointer.rootX;
+                int y = event->u.keyButtonPointer.rootY;
+                if (activity->pointer_known)
+                    activity->distance += hypot(x - activity->pointer_x, y - activity->pointer_y);
+                activity->pointer_x = x;
+                activity->pointer_y = y;
+                activity->pointer_known = true;
+                break;
+            }
+        }
+        activity->records++;
+
+        // Server time comes with the record, no clock is read per event
+        if ((uint32_t)(record->server_time - activity->published_at) >= 1000)
+        {
+            activity->published_at = record->server_time;
+            publish(activity);
+        }
+    }
+
+    XRecordFreeData(record);
+}
+
+
+static void *run(void *arg)
+{
+    ActivityContext *activity = arg;
+
+    // Returns once the context is disabled
+    XRecordEnableContext(activity->data, activity->context, intercept, (XPointer)activity);
+    publish(activity);
+    return NULL;
+}
+
+
+static void close_displays(ActivityContext *activity)
+{
+    if (activity->data)
+        XCloseDisplay(activity->data);
+    if (activity->control)
+        XCloseDisplay(activity->control);
+    activity->data = NULL;
+    activity->control = NULL;
+}
+
+
+void activity_init(GlobalContext *gctx)
+{
+    ActivityContext *activity = &gctx->activity;
+    if (!gctx->config.activity_enabled)
+        return;
+
+    // Records are delivered on a connection that does nothing else
+    activity->control = XOpenDisplay(NULL);
+    activity->data = XOpenDisplay(NULL);
+
+    int major, minor;
+    if (!activity->control || !activity->data || !XRecordQueryVersion(activity->control, &major, &minor))
+    {
+        printf("No RECORD extension, activity is not metered\n");
+        close_displays(activity);
+        return;
+    }
+
+    XRecordRange *range = XRecordAllocRange();
+    range->device_events.first = KeyPress;
+    range->device_events.last = MotionNotify;
+    XRecordClientSpec clients = XRecordAllClients;
+    activity->context = XRecordCreateContext(activity->control, 0, &clients, 1, &range, 1);
+    XFree(range);
+
+    // Created before the data connection asks for it
+    XSync(activity->control, False);
+
+    if (!activity->context || pthread_create(&activity->thread, NULL, run, activity) != 0)
+    {
+        printf("Can't start the activity meter\n");
+        if (activity->context)
+            XRecordFreeContext(activity->control, activity->context);
+        close_displays(activity);
+        return;
+    }
+
+    timer_now(&activity->sampled_at);
+    activity->enabled = true;
+}
+
+
+void activity_free(GlobalContext *gctx)
+{
+    ActivityContext *activity = &gctx->activity;
+    if (!activity->enabled)
+        return;
+
+    XRecordDisableContext(activity->control, activity->context);
+    XSync(activity->control, False);
+    pthread_join(activity->thread, NULL);
+
+    XRecordFreeContext(activity->control, activity->context);
+    close_displays(activity);
+    activity->enabled = false;
+}
+
+#else
+
+void activity_init(GlobalContext *gctx)
+{
+    if (gctx->config.activity_enabled)
+        fprintf(stderr, "Activity metering is not built in, rebuild with -DXREST_RECORD\n");
+}
+
+
+void activity_free(GlobalContext *gctx)
+{
+    (void)gctx;
+}
+
+#endif /* XREST_RECORD */
+
+
+ActivityRate activity_sample(GlobalContext *gctx)
+{
+    ActivityContext *activity = &gctx->activity;
+    ActivityRate rate = {0};
+    if (!activity->enabled)
+        return rate;
+
+    Timer since = { activity->sampled_at };
+    rate.seconds = timer_elapsed(&since);
+    timer_now(&activity->sampled_at);
+
+    unsigned long keys = atomic_load_explicit(&activity->published_keys, memory_order_relaxed);
+    unsigned long distance = atomic_load_explicit(&activity->published_distance, memory_order_relaxed);
+
+    if (rate.seconds > 0.0)
+    {
+        rate.keys = (keys - activity->sampled_keys) * 60.0 / rate.seconds;
+        rate.distance = (distance - activity->sampled_distance) * 60.0 / rate.seconds;
+    }
+
+    activity->sampled_keys = keys;
+    activity->sampled_distance = distance;
+    return rate;
+}
+
+
+double activity_extra(GlobalContext *gctx, const ActivityRate *rate)
+{
+    const Config *config = &gctx->config;
+
+    bool intense = rate->keys >= config->activity_keys
+                || (config->activity_distance > 0 && rate->distance >= config->activity_distance);
+    if (!intense || config->activity_weight <= 1.0)
+        return 0.0;
+
+    double extra = rate->seconds * (config->activity_weight - 1.0);
+    gctx->activity.spent += extra;
+    return extra;
+}
+
+
+void activity_report(GlobalContext *gctx)
+{
+    ActivityContext *activity = &gctx->activity;
+    if (!activity->enabled)
+        return;
+
+    unsigned long records = atomic_load(&activity->published_records);
+    unsigned long cpu_ns = atomic_load(&activity->cpu_ns);
+    printf("Activity %lu keys, %lu px, %lu records, meter %.3f ms CPU, %.0f s of work counted extra\n",
+           atomic_load(&activity->published_keys), atomic_load(&activity->published_distance),
+           records, cpu_ns / 1e6, activity->spent);
+}
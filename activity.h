@@ -0,0 +1,20 @@
+#ifndef ACTIVITY_H
+#define ACTIVITY_H
+
+#include "main.h"
+
+/* Start metering input through RECORD if enabled and built in */
+void activity_init(GlobalContext *gctx);
+
+/* Input per minute since the last sample */
+ActivityRate activity_sample(GlobalContext *gctx);
+
+/* Seconds of work a sample counts for on top of its length, 0 unless it was intense */
+double activity_extra(GlobalContext *gctx, const ActivityRate *rate);
+
+/* Print what was metered */
+void activity_report(GlobalContext *gctx);
+
+void activity_free(GlobalContext *gctx);
+
+#endif /* ACTIVITY_H */
@@ -0,0 +1,158 @@
+#include <X11/Xlib.h>
+#include <X11/Xft/Xft.h>
+#include <X11/extensions/Xrender.h>
+#include <string.h>
+
+#include "main.h"
+#include "atlas.h"
+
+/*
+    Glyph atlas for countdown text.
+
+    Glyphs are rasterized by Xft once into a single A8 strip. A string is then
+    drawn with one XRender composite per character using the fixed advances
+    recorded at build time, with no per-frame Xft calls.
+*/
+
+
+void atlas_build(Display *display, Drawable drawable, GlyphAtlas *atlas, XftFont *font, const char *charset)
+{
+    memset(atlas, 0, sizeof(*atlas));
+    atlas->font = font;
+
+    // Measure glyphs and lay them out left to right
+
+    XGlyphInfo extents[ATLAS_MAX_GLYPHS];
+    int width = 0;
+    int bottom = 0;
+
+    for (const char *c = charset; *c; c++)
+    {
+        unsigned char g = *c;
+        if (g >= ATLAS_MAX_GLYPHS || atlas->present[g])
+            continue;
+
+        XftTextExtentsUtf8(display, font, (XftChar8 *)c, 1, &extents[g]);
+
+        atlas->present[g] = true;
+        atlas->cell_x[g] = width;
+        atlas->cell_width[g] = extents[g].width;
+        atlas->bearing[g] = extents[g].x;
+        atlas->advance[g] = extents[g].xOff;
+
+        if (extents[g].y > atlas->top)
+            atlas->top = extents[g].y;
+        if (extents[g].height - extents[g].y > bottom)
+            bottom = extents[g].height - extents[g].y;
+
+        width += extents[g].width + 1; // Keep glyphs from bleeding into neighbours
+    }
+
+    atlas->width = width;
+    atlas->height = atlas->top + bottom;
+    if (width == 0 || atlas->height <= 0)
+        return;
+
+    // Rasterize
+
+    atlas->pixmap = XCreatePixmap(display, drawable, width, atlas->height, 8);
+    atlas->mask = XRenderCreatePicture(display, atlas->pixmap, XRenderFindStandardFormat(display, PictStandardA8), 0, NULL);
+
+    XRenderColor transparent = {0};
+    XRenderFillRectangle(display, PictOpSrc, atlas->mask, &transparent, 0, 0, width, atlas->height);
+
+    XftDraw *draw = XftDrawCreateAlpha(display, atlas->pixmap, 8);
+    XftColor opaque = { .color = { 0xffff, 0xffff, 0xffff, 0xffff } };
+
+    for (int g = 0; g < ATLAS_MAX_GLYPHS; g++)
+    {
+        if (!atlas->present[g])
+            continue;
+
+        XftChar8 c = g;
+        XftDrawStringUtf8(draw, &opaque, font, atlas->cell_x[g] + atlas->bearing[g], atlas->top, &c, 1);
+    }
+    XftDrawDestroy(draw);
+}
+
+
+bool atlas_covers(const GlyphAtlas *atlas, const char *text)
+{
+    if (!atlas->pixmap)
+        return false;
+
+    for (const unsigned char *c = (const unsigned char *)text; *c; c++)
+        if (*c >= ATLAS_MAX_GLYPHS || !atlas->present[*c])
+            return false;
+
+    return true;
+}
+
+
+void atlas_extents(const GlyphAtlas *atlas, const char *text, XGlyphInfo *extents)
+{
+    int pen = 0;
+    int left = 0;
+    int right = 0;
+    bool first = true;
+
+    for (const unsigned char *c = (const unsigned char *)text; *c; c++)
+    {
+        int x0 = pen - atlas->bearing[*c];
+        int x1 = x0 + atlas->cell_width[*c];
+
+        if (first || x0 < left) left = x0;
+        if (first || x1 > right) right = x1;
+        first = false;
+
+        pen += atlas->advance[*c];
+    }
+
+    extents->x = -left;
+    extents->y = atlas->top;
+    extents->width = right - left;
+    extents->height = atlas->height;
+    extents->xOff = pen;
+    extents->yOff = 0;
+}
+
+
+void atlas_draw(Display *display, const GlyphAtlas *atlas, Picture fill, Picture target, const char *text, int x, int y)
+{
+    int pen = x;
+
+    for (const unsigned char *c = (const unsigned char *)text; *c; c++)
+    {
+        if (atlas->cell_width[*c] > 0)
+        {
+            XRenderComposite(display, PictOpOver, fill, atlas->mask, target,
+                             0, 0,
+                             atlas->cell_x[*c], 0,
+                             pen - atlas->bearing[*c], y - atlas->top,
+                             atlas->cell_width[*c], atlas->height);
+        }
+        pen += atlas->advance[*c];
+    }
+}
+
+
+XImage *atlas_image(Display *display, GlyphAtlas *atlas)
+{
+    if (!atlas->image && atlas->pixmap)
+        atlas->image = XGetImage(display, atlas->pixmap, 0, 0, atlas->width, atlas->height, AllPlanes, ZPixmap);
+
+    return atlas->image;
+}
+
+
+void atlas_free(Display *display, GlyphAtlas *atlas)
+{
+    if (atlas->image)
+        XDestroyImage(atlas->image);
+    if (atlas->mask)
+        XRenderFreePicture(display, atlas->mask);
+    if (atlas->pixmap)
+        XFreePixmap(display, atlas->pixmap);
+
+    memset(atlas, 0, sizeof(*atlas));
+}
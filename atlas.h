@@ -0,0 +1,23 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include "main.h"
+
+/* Rasterize every ASCII glyph of charset once into an A8 strip */
+void atlas_build(Display *display, Drawable drawable, GlyphAtlas *atlas, XftFont *font, const char *charset);
+
+/* True if every character of text has a glyph in the atlas */
+bool atlas_covers(const GlyphAtlas *atlas, const char *text);
+
+/* Extents of text as drawn from the atlas, same meaning as XftTextExtents */
+void atlas_extents(const GlyphAtlas *atlas, const char *text, XGlyphInfo *extents);
+
+/* Composite text at a baseline origin through a solid fill */
+void atlas_draw(Display *display, const GlyphAtlas *atlas, Picture fill, Picture target, const char *text, int x, int y);
+
+/* Client-side copy of the strip, fetched once */
+XImage *atlas_image(Display *display, GlyphAtlas *atlas);
+
+void atlas_free(Display *display, GlyphAtlas *atlas);
+
+#endif /* ATLAS_H */
@@ -0,0 +1,313 @@
+#include <ao/ao.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "main.h"
+#include "timer.h"
+#include "audio.h"
+
+/*
+    Audio thread.
+
+    libao is set up once, by a thread that lives as long as the program
+    and plays clips one after another. Clips are asked for through a
+    single-producer single-consumer ring of fixed slots and an eventfd, so
+    asking allocates nothing and never blocks the main loop.
+
+    The device stays open between clips and is reopened only for a clip
+    in another format. The time from asking for a clip to handing its
+    first samples to the device is measured.
+*/
+
+
+static void apply_volume(char *buf, size_t bytes, int bits, float volume)
+{
+    if (volume == 1.0f) return;
+
+    if (bits == 8) 
+    {
+        // 8-bit PCM is unsigned
+        for (size_t i = 0; i < bytes; i++) 
+        {
+            int s = (unsigned char)buf[i] - 128;
+            s = (int)(s * volume);
+            if (s > 127) s = 127;
+            if (s < -128) s = -128;
+            buf[i] = (char)(s + 128);
+        }
+    }
+    else if (bits == 16) 
+    {
+        // 16-bit PCM is signed little-endian
+        int16_t *p = (int16_t*)buf;
+        size_t samples = bytes / 2;
+        for (size_t i = 0; i < samples; i++) 
+        {
+            int v = (int)(p[i] * volume);
+            if (v > 32767) v = 32767;
+            if (v < -32768) v = -32768;
+            p[i] = (int16_t)v;
+        }
+    }
+}
+
+
+/* Open a PCM WAV file positioned at its samples, NULL if it is not one */
+static FILE *open_wav(const char *path, WavHeader *h, uint32_t *data_size)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        printf("Sound file is not available!\n");
+        return NULL;
+    }
+
+    if (fread(h, sizeof(*h), 1, f) != 1) 
+    {
+        fclose(f);
+        return NULL;
+    }
+
+    if (memcmp(h->riff, "RIFF", 4) ||
+        memcmp(h->wave, "WAVE", 4) ||
+        memcmp(h->fmt,  "fmt ", 4) ||
+        h->audio_format != 1 || // must be PCM
+        h->block_align == 0)
+    {
+        fclose(f);
+        return NULL;
+    }
+
+    // Skip extra fmt bytes if present
+    if (h->fmt_len > 16) 
+    {
+        fseek(f, h->fmt_len - 16, SEEK_CUR);
+    }
+
+    // Locate the "data" chunk
+    char tag[4];
+    uint32_t chunk_size = 0;
+
+    while (fread(tag, 1, 4, f) == 4) 
+    {
+        if (fread(&chunk_size, 4, 1, f) != 1)
+            break;
+
+        if (!memcmp(tag, "data", 4)) {
+            *data_size = chunk_size;
+            return f;
+        }
+        // Skip unknown chunks
+        fseek(f, chunk_size, SEEK_CUR);
+    }
+
+    fclose(f);
+    return NULL;
+}
+
+
+/* Have the device open in the format of the clip, reopening it only if the format differs */
+static bool open_device(AudioContext *audio, int driver, const WavHeader *h)
+{
+    if (audio->device && audio->bits == h->bits_per_sample &&
+        audio->channels == h->num_channels && audio->rate == (int)h->sample_rate)
+        return true;
+
+    if (audio->device)
+        ao_close(audio->device);
+
+    ao_sample_format fmt = {
+        .bits        = h->bits_per_sample,
+        .channels    = h->num_channels,
+        .rate        = h->sample_rate,
+        .byte_format = AO_FMT_LITTLE
+    };
+
+    audio->device = ao_open_live(driver, &fmt, NULL);
+    if (!audio->device)
+        return false;
+
+    audio->bits = fmt.bits;
+    audio->channels = fmt.channels;
+    audio->rate = fmt.rate;
+    atomic_fetch_add(&audio->reopened, 1);
+    return true;
+}
+
+
+static void record_latency(AudioContext *audio, const AudioJob *job)
+{
+    Timer queued = { job->queued };
+    unsigned long ns = (unsigned long)(timer_elapsed(&queued) * 1e9);
+
+    atomic_fetch_add(&audio->played, 1);
+    atomic_fetch_add(&audio->latency_total, ns);
+    if (ns > atomic_load(&audio->latency_max))
+        atomic_store(&audio->latency_max, ns);
+}
+
+
+static void play(AudioContext *audio, int driver, const AudioJob *job)
+{
+    WavHeader h;
+    uint32_t remaining = 0;
+    FILE *f = open_wav(job->path, &h, &remaining);
+    if (!f)
+        return;
+
+    if (!open_device(audio, driver, &h))
+    {
+        printf("Can't open the audio device\n");
+        fclose(f);
+        return;
+    }
+
+    bool first = true;
+    while (remaining > 0 && atomic_load(&audio->running)) 
+    {
+        size_t to_read = remaining < sizeof(audio->buffer) ? remaining : sizeof(audio->buffer);
+        size_t read = fread(audio->buffer, 1, to_read, f);
+        if (read == 0) break;
+
+        // Trim to full frames (block-aligned)
+        read -= read % h.block_align;
+        if (read == 0) break;
+
+        apply_volume(audio->buffer, read, h.bits_per_sample, job->volume);
+
+        if (first)
+            record_latency(audio, job);
+        first = false;
+
+        ao_play(audio->device, audio->buffer, read);
+        remaining -= read;
+    }
+
+    fclose(f);
+}
+
+
+static void *run(void *arg)
+{
+    AudioContext *audio = arg;
+
+    ao_initialize();
+    int driver = ao_default_driver_id();
+
+    while (atomic_load(&audio->running))
+    {
+        unsigned tail = atomic_load_explicit(&audio->tail, memory_order_relaxed);
+        unsigned head = atomic_load_explicit(&audio->head, memory_order_acquire);
+
+        if (tail != head)
+        {
+            // The slot is free for the main thread once the clip is over
+            play(audio, driver, &audio->jobs[tail % AUDIO_JOBS]);
+            atomic_store_explicit(&audio->tail, tail + 1, memory_order_release);
+            continue;
+        }
+
+        // Counts every clip queued since the last read, none is missed
+        uint64_t count;
+        if (read(audio->wake, &count, sizeof(count)) < 0 && errno != EINTR)
+        {
+            perror("audio wake");
+            break;
+        }
+    }
+
+    if (audio->device)
+        ao_close(audio->device);
+    audio->device = NULL;
+    ao_shutdown();
+    return NULL;
+}
+
+
+void audio_init(GlobalContext *gctx)
+{
+    AudioContext *audio = &gctx->audio;
+    if (!gctx->config.sound_enabled)
+        return;
+
+    // Blocking, the audio thread sleeps in read
+    audio->wake = eventfd(0, EFD_CLOEXEC);
+    if (audio->wake < 0)
+    {
+        perror("audio eventfd");
+        return;
+    }
+
+    atomic_store(&audio->running, true);
+    if (pthread_create(&audio->thread, NULL, run, audio) != 0)
+    {
+        perror("audio thread");
+        close(audio->wake);
+        return;
+    }
+
+    audio->enabled = true;
+}
+
+
+void audio_play(GlobalContext *gctx, const char *path, float volume)
+{
+    AudioContext *audio = &gctx->audio;
+    if (!audio->enabled)
+        return;
+
+    unsigned head = atomic_load_explicit(&audio->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&audio->tail, memory_order_acquire);
+    if (head - tail == AUDIO_JOBS)
+    {
+        printf("Audio queue is full, %s dropped\n", path);
+        return;
+    }
+
+    AudioJob *job = &audio->jobs[head % AUDIO_JOBS];
+    snprintf(job->path, sizeof(job->path), "%s", path);
+    job->volume = volume;
+    timer_now(&job->queued);
+    atomic_store_explicit(&audio->head, head + 1, memory_order_release);
+
+    uint64_t one = 1;
+    if (write(audio->wake, &one, sizeof(one)) < 0)
+        perror("audio wake");
+}
+
+
+void audio_report(GlobalContext *gctx)
+{
+    AudioContext *audio = &gctx->audio;
+    unsigned long played = atomic_load(&audio->played);
+    if (!audio->enabled || played == 0)
+        return;
+
+    printf("Clips %lu, device opened %lu times, first sample after average %.3f ms, max %.3f ms\n",
+           played, atomic_load(&audio->reopened),
+           atomic_load(&audio->latency_total) / 1e6 / played, atomic_load(&audio->latency_max) / 1e6);
+}
+
+
+void audio_free(GlobalContext *gctx)
+{
+    AudioContext *audio = &gctx->audio;
+    if (!audio->enabled)
+        return;
+
+    // A clip playing stops at its next buffer
+    atomic_store(&audio->running, false);
+    uint64_t one = 1;
+    if (write(audio->wake, &one, sizeof(one)) < 0)
+        perror("audio wake");
+    pthread_join(audio->thread, NULL);
+
+    close(audio->wake);
+    audio->enabled = false;
+}
@@ -0,0 +1,18 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include "main.h"
+
+/* Start the audio thread if sound is enabled */
+void audio_init(GlobalContext *gctx);
+
+/* Queue a WAV clip, played after the clips before it; dropped when the queue is full */
+void audio_play(GlobalContext *gctx, const char *path, float volume);
+
+/* Print clip start latency */
+void audio_report(GlobalContext *gctx);
+
+/* Stop the clip playing, drop the queued ones and close the device */
+void audio_free(GlobalContext *gctx);
+
+#endif /* AUDIO_H */
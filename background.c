@@ -0,0 +1,620 @@
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "main.h"
+#include "timer.h"
+#include "background.h"
+
+/*
+    Background image for the break and end screens.
+
+    The source is a binary PPM (P6) or PAM (P7) file, formats simple enough
+    to decode without a library. It is scaled to cover each output size
+    with a separable tent filter, area averaging when shrinking and
+    bilinear when enlarging. Pixels are four-float vectors, so every tap is
+    one SIMD multiply-add.
+
+    Each size is uploaded once, as pixmaps for server-side composition or
+    kept as images for the SHM path, together with a copy tinted by the
+    progress color. Scaled results are also stored as PPM files in the
+    user cache folder and keyed by the source path, size and mtime, so a
+    restart does not need to decode or scale the source again.
+*/
+
+#define BACKGROUND_MAX_SIDE 16384
+
+typedef float v4f __attribute__((vector_size(16)));
+
+
+typedef struct
+{
+    int first; // First source pixel
+    int count;
+    float *weights;
+} Taps;
+
+
+/* ---- DECODING ---- */
+
+static bool read_token(FILE *f, char *out, size_t size)
+{
+    int c = fgetc(f);
+
+    // Whitespace and comments between header fields
+    while (c != EOF && (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '#'))
+    {
+        if (c == '#')
+            while (c != EOF && c != '\n')
+                c = fgetc(f);
+        c = fgetc(f);
+    }
+
+    size_t n = 0;
+    while (c != EOF && !(c == ' ' || c == '\t' || c == '\r' || c == '\n'))
+    {
+        if (n + 1 < size)
+            out[n++] = c;
+        c = fgetc(f);
+    }
+    out[n] = '\0';
+
+    return n > 0; // The single whitespace after the last field is consumed
+}
+
+
+static bool read_ppm_header(FILE *f, uint *width, uint *height, uint *depth, uint *maxval)
+{
+    char token[32];
+
+    if (!read_token(f, token, sizeof(token))) return false;
+    *width = strtoul(token, NULL, 10);
+    if (!read_token(f, token, sizeof(token))) return false;
+    *height = strtoul(token, NULL, 10);
+    if (!read_token(f, token, sizeof(token))) return false;
+    *maxval = strtoul(token, NULL, 10);
+
+    *depth = 3;
+    return true;
+}
+
+
+static bool read_pam_header(FILE *f, uint *width, uint *height, uint *depth, uint *maxval)
+{
+    char line[256];
+    *width = *height = *depth = *maxval = 0;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        char key[32];
+        uint value;
+
+        if (line[0] == '#')
+            continue;
+        if (strncmp(line, "ENDHDR", 6) == 0)
+            return true;
+        if (sscanf(line, "%31s %u", key, &value) != 2)
+            continue; // TUPLTYPE, the depth already tells the layout
+
+        if (strcmp(key, "WIDTH") == 0) *width = value;
+        else if (strcmp(key, "HEIGHT") == 0) *height = value;
+        else if (strcmp(key, "DEPTH") == 0) *depth = value;
+        else if (strcmp(key, "MAXVAL") == 0) *maxval = value;
+    }
+
+    return false;
+}
+
+
+/* Decode to packed RGB, alpha is blended over the background color */
+static uint8_t *decode(const char *path, const XColor *matte, uint *out_width, uint *out_height)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+
+    char magic[3] = {0};
+    uint width = 0, height = 0, depth = 0, maxval = 0;
+    bool ok = fread(magic, 1, 2, f) == 2;
+
+    if (ok && strcmp(magic, "P6") == 0)
+        ok = read_ppm_header(f, &width, &height, &depth, &maxval);
+    else if (ok && strcmp(magic, "P7") == 0)
+        ok = fgetc(f) == '\n' && read_pam_header(f, &width, &height, &depth, &maxval);
+    else
+        ok = false;
+
+    if (!ok || width == 0 || height == 0 || width > BACKGROUND_MAX_SIDE || height > BACKGROUND_MAX_SIDE ||
+        depth < 1 || depth > 4 || maxval == 0 || maxval > 65535)
+    {
+        fclose(f);
+        return NULL;
+    }
+
+    uint sample_size = maxval > 255 ? 2 : 1;
+    size_t row_size = (size_t)width * depth * sample_size;
+    uint8_t *row = malloc(row_size);
+    uint8_t *pixels = malloc((size_t)width * height * 3);
+
+    uint matte_rgb[3] = { matte->red >> 8, matte->green >> 8, matte->blue >> 8 };
+    bool alpha = depth == 2 || depth == 4;
+    uint colors = alpha ? depth - 1 : depth;
+
+    for (uint y = 0; ok && y < height; y++)
+    {
+        if (fread(row, 1, row_size, f) != row_size)
+        {
+            ok = false;
+            break;
+        }
+
+        uint8_t *out = pixels + (size_t)y * width * 3;
+        for (uint x = 0; x < width; x++)
+        {
+            uint sample[4];
+            for (uint c = 0; c < depth; c++)
+            {
+                const uint8_t *s = row + ((size_t)x * depth + c) * sample_size;
+                uint v = sample_size == 2 ? (s[0] << 8) | s[1] : s[0];
+                sample[c] = (v * 255 + maxval / 2) / maxval;
+            }
+
+            uint a = alpha ? sample[depth - 1] : 255;
+            for (uint c = 0; c < 3; c++)
+            {
+                uint v = sample[colors == 1 ? 0 : c];
+                out[x * 3 + c] = (v * a + matte_rgb[c] * (255 - a) + 127) / 255;
+            }
+        }
+    }
+
+    free(row);
+    fclose(f);
+
+    if (!ok)
+    {
+        free(pixels);
+        return NULL;
+    }
+
+    *out_width = width;
+    *out_height = height;
+    return pixels;
+}
+
+
+/* ---- SCALING ---- */
+
+/* Filter taps of every destination pixel, src_step source pixels per destination pixel */
+static Taps *make_taps(int src_size, int dst_size, double src_step, double src_offset)
+{
+    double radius = src_step > 1.0 ? src_step : 1.0;
+    int max_count = 2 * (int)ceil(radius) + 1;
+
+    Taps *taps = malloc(dst_size * sizeof(Taps));
+    float *weights = malloc((size_t)dst_size * max_count * sizeof(float));
+
+    for (int i = 0; i < dst_size; i++)
+    {
+        double center = src_offset + (i + 0.5) * src_step - 0.5;
+        int first = (int)ceil(center - radius);
+        int last = (int)floor(center + radius);
+        if (first < 0) first = 0;
+        if (last > src_size - 1) last = src_size - 1;
+
+        Taps *t = &taps[i];
+        t->weights = weights + (size_t)i * max_count;
+        t->first = first;
+        t->count = 0;
+
+        float sum = 0;
+        for (int j = first; j <= last && t->count < max_count; j++)
+        {
+            float w = 1.0 - fabs(j - center) / radius;
+            if (w < 0) w = 0;
+            t->weights[t->count++] = w;
+            sum += w;
+        }
+
+        // Edges clipped the whole kernel, take the nearest pixel
+        if (sum <= 0)
+        {
+            int nearest = (int)lround(center);
+            t->first = nearest < 0 ? 0 : nearest > src_size - 1 ? src_size - 1 : nearest;
+            t->count = 1;
+            t->weights[0] = sum = 1;
+        }
+
+        for (int k = 0; k < t->count; k++)
+            t->weights[k] /= sum;
+    }
+
+    return taps;
+}
+
+
+static void free_taps(Taps *taps)
+{
+    free(taps[0].weights);
+    free(taps);
+}
+
+
+/* Scale to cover the destination, cropping the source evenly on the long side */
+static uint8_t *scale(const uint8_t *src, uint src_width, uint src_height, uint width, uint height)
+{
+    double step = fmin((double)src_width / width, (double)src_height / height);
+    double offset_x = (src_width - width * step) / 2;
+    double offset_y = (src_height - height * step) / 2;
+
+    Taps *columns = make_taps(src_width, width, step, offset_x);
+    Taps *rows = make_taps(src_height, height, step, offset_y);
+
+    // Source columns any destination pixel reads
+    int x0 = columns[0].first;
+    int x1 = columns[width - 1].first + columns[width - 1].count;
+
+    v4f *line = malloc((x1 - x0) * sizeof(v4f));
+    uint8_t *dst = malloc((size_t)width * height * 3);
+
+    for (uint y = 0; y < height; y++)
+    {
+        // Vertical pass into one line of source width
+
+        memset(line, 0, (x1 - x0) * sizeof(v4f));
+        for (int t = 0; t < rows[y].count; t++)
+        {
+            const uint8_t *s = src + ((size_t)(rows[y].first + t) * src_width + x0) * 3;
+            float w = rows[y].weights[t];
+
+            for (int x = 0; x < x1 - x0; x++, s += 3)
+            {
+                v4f p = { s[0], s[1], s[2], 0 };
+                line[x] += w * p;
+            }
+        }
+
+        // Horizontal pass
+
+        uint8_t *out = dst + (size_t)y * width * 3;
+        for (uint x = 0; x < width; x++)
+        {
+            const Taps *c = &columns[x];
+            const v4f *s = line + (c->first - x0);
+            v4f sum = {0};
+
+            for (int t = 0; t < c->count; t++)
+                sum += c->weights[t] * s[t];
+
+            for (int k = 0; k < 3; k++)
+            {
+                float v = sum[k] + 0.5f;
+                out[x * 3 + k] = v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+            }
+        }
+    }
+
+    free(line);
+    free_taps(columns);
+    free_taps(rows);
+    return dst;
+}
+
+
+/* ---- DISK CACHE ---- */
+
+static bool cache_path(GlobalContext *gctx, uint width, uint height, char *out, size_t size, bool create)
+{
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char folder[512];
+
+    if (xdg)
+        snprintf(folder, sizeof(folder), "%s", xdg);
+    else if (home)
+        snprintf(folder, sizeof(folder), "%s/.cache", home);
+    else
+        return false;
+
+    if (create && mkdir(folder, 0700) != 0 && errno != EEXIST)
+        return false;
+
+    strncat(folder, "/xrest", sizeof(folder) - strlen(folder) - 1);
+    if (create && mkdir(folder, 0700) != 0 && errno != EEXIST)
+        return false;
+
+    snprintf(out, size, "%s/background-%08x-%ux%u.ppm", folder, gctx->background.key, width, height);
+    return true;
+}
+
+
+static uint8_t *cache_load(GlobalContext *gctx, uint width, uint height)
+{
+    char path[640];
+    if (!cache_path(gctx, width, height, path, sizeof(path), false))
+        return NULL;
+
+    uint w, h;
+    uint8_t *pixels = decode(path, &gctx->background_color, &w, &h);
+    if (pixels && (w != width || h != height))
+    {
+        free(pixels);
+        return NULL;
+    }
+    return pixels;
+}
+
+
+static void cache_store(GlobalContext *gctx, const uint8_t *pixels, uint width, uint height)
+{
+    char path[640], temp[660];
+    if (!cache_path(gctx, width, height, path, sizeof(path), true))
+        return;
+
+    // Written aside and renamed, a concurrent reader never sees half a file
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    FILE *f = fopen(temp, "wb");
+    if (!f)
+        return;
+
+    fprintf(f, "P6\n%u %u\n255\n", width, height);
+    bool ok = fwrite(pixels, 3, (size_t)width * height, f) == (size_t)width * height;
+    ok &= fclose(f) == 0;
+
+    if (!ok || rename(temp, path) != 0)
+        remove(temp);
+}
+
+
+/* ---- UPLOAD ---- */
+
+static int mask_shift(unsigned long mask)
+{
+    int shift = 0;
+    while (mask && !(mask & 1))
+    {
+        mask >>= 1;
+        shift++;
+    }
+    return shift;
+}
+
+
+static unsigned long pack(unsigned long mask, uint value)
+{
+    int shift = mask_shift(mask);
+    unsigned long max = mask >> shift;
+    return ((value * max + 127) / 255) << shift;
+}
+
+
+static XImage *create_image(GlobalContext *gctx, const uint8_t *pixels, uint width, uint height, const XColor *tint)
+{
+    Visual *visual = gctx->visual;
+    XImage *image = XCreateImage(gctx->display, visual, gctx->depth, ZPixmap, 0, NULL, width, height, 32, 0);
+    if (!image)
+        return NULL;
+
+    image->data = malloc((size_t)image->bytes_per_line * height);
+
+    uint tint_rgb[3] = {0};
+    if (tint)
+    {
+        tint_rgb[0] = tint->red >> 8;
+        tint_rgb[1] = tint->green >> 8;
+        tint_rgb[2] = tint->blue >> 8;
+    }
+
+    for (uint y = 0; y < height; y++)
+    {
+        const uint8_t *s = pixels + (size_t)y * width * 3;
+        uint32_t *row = (uint32_t *)(image->data + (size_t)y * image->bytes_per_line);
+
+        for (uint x = 0; x < width; x++, s += 3)
+        {
+            uint r = s[0], g = s[1], b = s[2];
+
+            // Progress shows as the image half covered by its color
+            if (tint)
+            {
+                r = (r + tint_rgb[0] + 1) / 2;
+                g = (g + tint_rgb[1] + 1) / 2;
+                b = (b + tint_rgb[2] + 1) / 2;
+            }
+
+            unsigned long pixel = pack(visual->red_mask, r) | pack(visual->green_mask, g) | pack(visual->blue_mask, b) | gctx->alpha_mask;
+            if (image->bits_per_pixel == 32)
+                row[x] = pixel;
+            else
+                XPutPixel(image, x, y, pixel);
+        }
+    }
+
+    return image;
+}
+
+
+static Pixmap upload(GlobalContext *gctx, XImage *image)
+{
+    Pixmap pixmap = XCreatePixmap(gctx->display, gctx->root, image->width, image->height, gctx->depth);
+    GC gc = XCreateGC(gctx->display, pixmap, 0, NULL);
+    XPutImage(gctx->display, pixmap, gc, image, 0, 0, 0, 0, image->width, image->height);
+    XFreeGC(gctx->display, gc);
+    XDestroyImage(image);
+    return pixmap;
+}
+
+
+static void free_size(GlobalContext *gctx, Background *size)
+{
+    if (size->plain)
+        XFreePixmap(gctx->display, size->plain);
+    if (size->tinted)
+        XFreePixmap(gctx->display, size->tinted);
+    if (size->plain_image)
+        XDestroyImage(size->plain_image);
+    if (size->tinted_image)
+        XDestroyImage(size->tinted_image);
+
+    memset(size, 0, sizeof(*size));
+}
+
+
+static bool shown_by(const WindowContext *wctx, const Background *size)
+{
+    for (const WindowContext *view = wctx; view; view = view->next)
+        if (view->scene.background == size)
+            return true;
+    return false;
+}
+
+
+/* Whether a pooled window still composes from the size */
+static bool in_use(GlobalContext *gctx, const Background *size)
+{
+    if (shown_by(&gctx->pool.warning, size))
+        return true;
+    for (int w = 0; w < OUTPUT_MAX; w++)
+        if (shown_by(&gctx->pool.overlay[w], size))
+            return true;
+    return false;
+}
+
+
+/* ---- INTERFACE ---- */
+
+void background_init(GlobalContext *gctx)
+{
+    BackgroundImage *background = &gctx->background;
+    const char *path = gctx->config.background_image;
+
+    if (path[0] == '\0')
+        return;
+
+    struct stat st;
+    if (stat(path, &st) != 0)
+    {
+        fprintf(stderr, "Can't open background image %s\n", path);
+        return;
+    }
+
+    if (gctx->visual->class != TrueColor)
+    {
+        fprintf(stderr, "Background images need a TrueColor visual\n");
+        return;
+    }
+
+    // FNV-1a over what identifies the source, and the color transparency is blended against
+    uint32_t key = 2166136261u;
+    for (const char *c = path; *c; c++)
+        key = (key ^ (uint8_t)*c) * 16777619u;
+    uint64_t stamp[3] = {
+        (uint64_t)st.st_size,
+        (uint64_t)st.st_mtime,
+        (uint64_t)gctx->background_color.red << 32 | (uint64_t)gctx->background_color.green << 16 | gctx->background_color.blue
+    };
+    for (size_t i = 0; i < sizeof(stamp); i++)
+        key = (key ^ ((uint8_t *)stamp)[i]) * 16777619u;
+
+    background->key = key;
+    background->enabled = true;
+}
+
+
+const Background *background_get(GlobalContext *gctx, uint width, uint height)
+{
+    BackgroundImage *background = &gctx->background;
+    if (!background->enabled || width == 0 || height == 0)
+        return NULL;
+
+    for (int s = 0; s < background->size_count; s++)
+        if (background->sizes[s].width == width && background->sizes[s].height == height)
+            return &background->sizes[s];
+
+    Timer timer = {0};
+    timer_start(&timer);
+
+    uint8_t *pixels = cache_load(gctx, width, height);
+    bool cached = pixels != NULL;
+
+    if (!pixels)
+    {
+        // Decoded once, kept for sizes still to come
+        if (!background->pixels)
+        {
+            background->pixels = decode(gctx->config.background_image, &gctx->background_color, &background->width, &background->height);
+            if (!background->pixels)
+            {
+                fprintf(stderr, "Failed to decode background image %s, only binary PPM and PAM are supported\n", gctx->config.background_image);
+                background->enabled = false;
+                return NULL;
+            }
+        }
+
+        pixels = scale(background->pixels, background->width, background->height, width, height);
+        cache_store(gctx, pixels, width, height);
+    }
+
+    // Replace sizes round robin once every slot is taken, never one a window composes from
+    Background *size = NULL;
+    if (background->size_count < BACKGROUND_MAX_SIZES)
+        size = &background->sizes[background->size_count++];
+    for (int tries = 0; !size && tries < BACKGROUND_MAX_SIZES; tries++)
+    {
+        Background *slot = &background->sizes[background->next_slot++ % BACKGROUND_MAX_SIZES];
+        if (!in_use(gctx, slot))
+            size = slot;
+    }
+
+    if (!size)
+    {
+        fprintf(stderr, "Every background size is in use, %ux%u gets a flat color\n", width, height);
+        free(pixels);
+        return NULL;
+    }
+    free_size(gctx, size);
+
+    size->width = width;
+    size->height = height;
+    size->plain_image = create_image(gctx, pixels, width, height, NULL);
+    size->tinted_image = create_image(gctx, pixels, width, height, &gctx->progress_color);
+    free(pixels);
+
+    if (!size->plain_image || !size->tinted_image)
+    {
+        free_size(gctx, size); // Zero size never matches a lookup
+        return NULL;
+    }
+
+    // Server-side composition reads pixmaps, the SHM path composes from the images
+    if (!gctx->shm)
+    {
+        size->plain = upload(gctx, size->plain_image);
+        size->tinted = upload(gctx, size->tinted_image);
+        size->plain_image = NULL;
+        size->tinted_image = NULL;
+    }
+
+    if (gctx->debug)
+        printf("Background %ux%u %s in %.1f ms\n", width, height, cached ? "loaded from cache" : "scaled", timer_elapsed(&timer) * 1000.0);
+
+    return size;
+}
+
+
+void background_free(GlobalContext *gctx)
+{
+    BackgroundImage *background = &gctx->background;
+
+    for (int s = 0; s < background->size_count; s++)
+        free_size(gctx, &background->sizes[s]);
+
+    free(background->pixels);
+    memset(background, 0, sizeof(*background));
+}
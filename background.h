@@ -0,0 +1,14 @@
+#ifndef BACKGROUND_H
+#define BACKGROUND_H
+
+#include "main.h"
+
+/* Check the configured image, it is decoded only when a size is missing from the caches */
+void background_init(GlobalContext *gctx);
+
+/* Image scaled to cover width x height, NULL without a background image */
+const Background *background_get(GlobalContext *gctx, uint width, uint height);
+
+void background_free(GlobalContext *gctx);
+
+#endif /* BACKGROUND_H */
@@ -0,0 +1,123 @@
+#include <X11/Xlib.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XTest.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "timer.h"
+#include "activity.h"
+
+/*
+    Activity meter benchmark.
+
+    Types on the running server through XTEST at a steady rate while the
+    meter runs, then reports how many of the keystrokes the meter counted
+    and how much CPU time its thread spent on each. The key is Shift, so
+    whatever has the focus receives nothing it would act on.
+
+    Needs a display and a build with -DXREST_RECORD.
+*/
+
+#define BENCH_SECONDS 10.0
+#define BENCH_RATE 25.0 // Keystrokes per second, fast typing is 10
+
+
+static void print_usage(const char *prog)
+{
+    printf(
+        "Usage: %s [options]\n"
+        "\nOptions:\n"
+        "  -t SECONDS         How long to type (default %.0f)\n"
+        "  -r RATE            Keystrokes per second (default %.0f)\n"
+        "  -h, --help         Show this help and exit\n",
+        prog, BENCH_SECONDS, BENCH_RATE
+    );
+}
+
+
+int main(int argc, char **argv)
+{
+    double seconds = BENCH_SECONDS;
+    double rate = BENCH_RATE;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            seconds = atof(argv[++i]);
+            continue;
+        }
+
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+        {
+            rate = atof(argv[++i]);
+            continue;
+        }
+
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0)
+        {
+            print_usage(argv[0]);
+            return 0;
+        }
+
+        fprintf(stderr, "Unknown option: %s\n", argv[i]);
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (rate <= 0.0 || seconds <= 0.0)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    XInitThreads();
+    Display *display = XOpenDisplay(NULL);
+    int event_base, error_base, major, minor;
+    if (!display || !XTestQueryExtension(display, &event_base, &error_base, &major, &minor))
+    {
+        fprintf(stderr, "Needs a display with the XTEST extension\n");
+        return 1;
+    }
+
+    static GlobalContext gctx;
+    load_defaults(&gctx.config);
+    gctx.config.activity_enabled = true;
+
+    activity_init(&gctx);
+    if (!gctx.activity.enabled)
+        return 1;
+
+    KeyCode shift = XKeysymToKeycode(display, XK_Shift_L);
+    unsigned long sent = 0;
+
+    Timer timer = {0};
+    timer_start(&timer);
+    for (double at = 0.0; at < seconds; at += 1.0 / rate)
+    {
+        timer_sleep_until(&timer, at);
+        XTestFakeKeyEvent(display, shift, True, CurrentTime);
+        XTestFakeKeyEvent(display, shift, False, CurrentTime);
+        XFlush(display);
+        sent++;
+    }
+
+    // Records trail the requests, the meter publishes everything as it stops
+    XSync(display, False);
+    timer_sleep(0.2);
+    activity_free(&gctx);
+
+    unsigned long counted = atomic_load(&gctx.activity.published_keys);
+    unsigned long records = atomic_load(&gctx.activity.published_records);
+    unsigned long cpu_ns = atomic_load(&gctx.activity.cpu_ns);
+
+    printf("Sent %lu keys, counted %lu, %lu records\n", sent, counted, records);
+    printf("Meter CPU %.3f ms, %.0f ns per key\n", cpu_ns / 1e6, sent ? (double)cpu_ns / sent : 0.0);
+
+    XCloseDisplay(display);
+    return counted == sent ? 0 : 1;
+}
@@ -0,0 +1,163 @@
+#include <X11/Xlib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "config.h"
+#include "timer.h"
+#include "blur.h"
+#include "snapshot.h"
+
+/*
+    Headless blur benchmark.
+
+    Blurs a synthetic screen the way a desktop snapshot is blurred, with
+    the default radius, dimming and tint, and reports milliseconds per
+    blur against the snapshot budget. The image is noise over a gradient,
+    the same on every run; the time of a box blur doesn't depend on the
+    pixels anyway. No display is needed.
+*/
+
+#define BENCH_RUNS 20
+#define BENCH_DPI 96.0
+
+
+static XImage *create_image(int width, int height)
+{
+    XImage *image = calloc(1, sizeof(XImage));
+    image->width = width;
+    image->height = height;
+    image->format = ZPixmap;
+    image->depth = 24;
+    image->bits_per_pixel = 32;
+    image->bytes_per_line = width * 4;
+    image->data = malloc((size_t)image->bytes_per_line * height);
+    return image;
+}
+
+
+static void fill_image(XImage *image)
+{
+    uint32_t seed = 1;
+    for (int y = 0; y < image->height; y++)
+    {
+        uint32_t *row = (uint32_t *)(image->data + (size_t)y * image->bytes_per_line);
+        for (int x = 0; x < image->width; x++)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            uint32_t noise = seed >> 24;
+            uint32_t r = (x * 255 / image->width + noise) / 2;
+            uint32_t g = (y * 255 / image->height + noise) / 2;
+            uint32_t b = noise;
+            row[x] = r << 16 | g << 8 | b;
+        }
+    }
+}
+
+
+static void free_image(XImage *image)
+{
+    free(image->data);
+    free(image);
+}
+
+
+static void print_usage(const char *prog)
+{
+    printf(
+        "Usage: %s [options]\n"
+        "\nOptions:\n"
+        "  -s WIDTHxHEIGHT    Image size (default 3840x2160)\n"
+        "  -t THREADS         Worker threads, 0 for one per core (default 0)\n"
+        "  -n RUNS            Blurs to time (default %d)\n"
+        "  -h, --help         Show this help and exit\n",
+        prog, BENCH_RUNS
+    );
+}
+
+
+int main(int argc, char **argv)
+{
+    int width = 3840;
+    int height = 2160;
+    int threads = 0;
+    int runs = BENCH_RUNS;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+        {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width < 1 || height < 1)
+            {
+                fprintf(stderr, "Bad size: %s\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            threads = atoi(argv[++i]);
+            continue;
+        }
+
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            runs = atoi(argv[++i]);
+            continue;
+        }
+
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0)
+        {
+            print_usage(argv[0]);
+            return 0;
+        }
+
+        fprintf(stderr, "Unknown option: %s\n", argv[i]);
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (runs < 1)
+        runs = 1;
+
+    Config config = {0};
+    load_defaults(&config);
+    int radius = pt_to_px(config.desktop_blur, BENCH_DPI);
+
+    XImage *image = create_image(width, height);
+    XImage *scratch = create_image(width, height);
+
+    if (threads < 1)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    printf("Blur %dx%d, radius %d px, %d threads, %d runs\n", width, height, radius, threads, runs);
+
+    double best = 1e9;
+    double total = 0.0;
+    for (int r = 0; r < runs; r++)
+    {
+        // A blurred image is smoother than a screen, start each run from the same pixels
+        fill_image(image);
+
+        Timer timer = {0};
+        timer_start(&timer);
+        blur_image(image, scratch, radius, config.desktop_dim, 0x3a6ea5, 0, threads, NULL, NULL);
+        double elapsed = timer_elapsed(&timer);
+
+        total += elapsed;
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    printf("Best %.2f ms, average %.2f ms, budget %.0f ms%s\n",
+           best * 1000.0, total * 1000.0 / runs, SNAPSHOT_BUDGET * 1000.0,
+           best > SNAPSHOT_BUDGET ? ", over budget" : "");
+
+    free_image(image);
+    free_image(scratch);
+    return best > SNAPSHOT_BUDGET ? 1 : 0;
+}
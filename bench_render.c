@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "timer.h"
+#include "render.h"
+#include "soft.h"
+
+/*
+    Headless render benchmark.
+
+    Draws every screen at several resolutions through the software
+    renderer and reports frames per second and nanoseconds per frame. Each
+    frame is a full repaint with the progress and countdown moving on. No
+    display is needed, only fontconfig and FreeType.
+
+    The config is always the defaults, but the font behind "monospace" is
+    whatever fontconfig matches on the machine, and FreeType versions
+    antialias differently, so frames are only comparable between machines
+    with the same fonts. The matched family is printed first.
+
+    With -o the first frame of every screen and resolution is written there
+    as a PAM image. With -c it is compared against the image of the same
+    name there instead, and the exit status is 1 when one differs. The
+    reference frames in reference/ were rendered at 640x360 with DejaVu Sans
+    Mono; see the README for how to check and regenerate them.
+*/
+
+#define BENCH_FRAMES 200
+#define BENCH_DPI 96.0
+#define BENCH_TOLERANCE 8 // Channel difference still counted as the same pixel
+
+
+static const char *screen_names[SCREEN_COUNT] = {
+    [SCREEN_WARNING] = "warning",
+    [SCREEN_BREAK] = "break",
+    [SCREEN_END] = "end",
+};
+
+
+static const struct
+{
+    uint width;
+    uint height;
+} sizes[] = {
+    { 1280, 720 },
+    { 1920, 1080 },
+    { 2560, 1440 },
+    { 3840, 2160 },
+};
+
+
+static void print_usage(const char *prog)
+{
+    printf(
+        "Usage: %s [options]\n"
+        "\nOptions:\n"
+        "  -n FRAMES          Frames per screen and resolution (default %d)\n"
+        "  -s WIDTHxHEIGHT    Only this resolution\n"
+        "  -o DIR             Write the first frame of each as a PAM image into DIR\n"
+        "  -c DIR             Compare the first frame of each with the PAM image in DIR\n"
+        "  -d DIFFERENCE      Channel difference tolerated by -c (default %d)\n"
+        "  -h, --help         Show this help and exit\n",
+        prog, BENCH_FRAMES, BENCH_TOLERANCE
+    );
+}
+
+
+int main(int argc, char **argv)
+{
+    int frames = BENCH_FRAMES;
+    const char *output = NULL;
+    const char *reference = NULL;
+    int tolerance = BENCH_TOLERANCE;
+    uint only_width = 0, only_height = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            frames = atoi(argv[++i]);
+            continue;
+        }
+
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+        {
+            if (sscanf(argv[++i], "%ux%u", &only_width, &only_height) != 2 || only_width == 0 || only_height == 0)
+            {
+                fprintf(stderr, "Invalid size: %s\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            output = argv[++i];
+            continue;
+        }
+
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+        {
+            reference = argv[++i];
+            continue;
+        }
+
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+        {
+            tolerance = atoi(argv[++i]);
+            continue;
+        }
+
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0)
+        {
+            print_usage(argv[0]);
+            return 0;
+        }
+
+        fprintf(stderr, "Unknown option: %s\n", argv[i]);
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (frames < 1)
+        frames = 1;
+
+    Config config = {0};
+    load_defaults(&config);
+
+    SoftRenderer soft;
+    if (!soft_init(&soft, &config, BENCH_DPI))
+    {
+        fprintf(stderr, "Failed to load fonts for %s\n", config.font_name);
+        return 1;
+    }
+
+    RenderBackend backend;
+    soft_backend(&soft, &backend);
+
+    Renderer renderer;
+    render_init(&renderer, &backend, &config, BENCH_DPI);
+
+    printf("Backend: %s, %d frames each\n", backend.name, frames);
+    printf("Font: %s %s\n", soft.fonts[RENDER_FONT_TITLE].face->family_name, soft.fonts[RENDER_FONT_TITLE].face->style_name);
+
+    size_t size_count = sizeof(sizes) / sizeof(sizes[0]);
+    if (only_width)
+        size_count = 1;
+
+    int differing = 0;
+
+    for (size_t s = 0; s < size_count; s++)
+    {
+        uint width = only_width ? only_width : sizes[s].width;
+        uint height = only_width ? only_height : sizes[s].height;
+        soft_resize(&soft, width, height);
+
+        for (int type = 0; type < SCREEN_COUNT; type++)
+        {
+            uint duration = type == SCREEN_WARNING ? config.warning_duration : config.break_duration;
+
+            // The first frame lays the screen out, it is not timed
+            render_screen(&renderer, type, width, height, 0.0, duration);
+
+            if (output)
+            {
+                char path[512];
+                snprintf(path, sizeof(path), "%s/%s-%ux%u.pam", output, screen_names[type], width, height);
+                if (!soft_write(&soft, path))
+                    fprintf(stderr, "Failed to write %s\n", path);
+            }
+
+            if (reference)
+            {
+                char path[512];
+                snprintf(path, sizeof(path), "%s/%s-%ux%u.pam", reference, screen_names[type], width, height);
+                long pixels = soft_compare(&soft, path, tolerance);
+                if (pixels < 0)
+                    fprintf(stderr, "No reference frame %s of this size\n", path);
+                else if (pixels > 0)
+                    fprintf(stderr, "%s: %ld pixels differ\n", path, pixels);
+                if (pixels != 0)
+                    differing++;
+            }
+
+            Timer timer = {0};
+            timer_start(&timer);
+
+            for (int f = 0; f < frames; f++)
+            {
+                double progress = (double)f / frames;
+                render_screen(&renderer, type, width, height, progress, duration - (uint)(progress * duration));
+            }
+
+            double elapsed = timer_elapsed(&timer);
+            printf("%-8s %5ux%-5u %9.1f fps %12.0f ns/frame\n",
+                   screen_names[type], width, height, frames / elapsed, elapsed * 1e9 / frames);
+        }
+    }
+
+    soft_free(&soft);
+
+    if (reference)
+    {
+        printf("%d frames differ from %s\n", differing, reference);
+        return differing > 0;
+    }
+    return 0;
+}
@@ -0,0 +1,259 @@
+#include <X11/Xlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "blur.h"
+
+/*
+    Box blur of 32-bit images.
+
+    Three box passes in each direction, a close Gaussian approximation. A
+    box pass costs the same for any radius thanks to running sums. Each
+    pixel is a vector of its four bytes, so every add and multiply handles
+    all channels at once, and the vertical passes run across whole rows of
+    such vectors. Rows, then columns, are split between the workers, with
+    a barrier between passes. A caller that may have to give way is asked
+    every BLUR_CHECK_ROWS rows, and the rest is skipped once it does.
+
+    The dimming is folded into the last pass, and a copy tinted by the
+    progress color lands in the scratch image. Only the pixels of the
+    images are touched, no display is needed.
+*/
+
+#define BLUR_MAX_THREADS 16
+#define BLUR_CHECK_ROWS 64 // Rows between two questions to the caller whether to stop
+
+typedef int32_t v4si __attribute__((vector_size(16)));
+typedef uint8_t v4qu __attribute__((vector_size(4)));
+
+
+typedef struct
+{
+    XImage *image; // Blurred in place, holds the result
+    XImage *scratch;
+    int radius;
+    int32_t scale; // 16.16 reciprocal of the box size
+    int32_t last_scale; // Same with the dimming
+    uint32_t tint; // Progress pixel
+    uint32_t alpha; // Alpha bits of the window visual
+    int threads;
+    pthread_barrier_t barrier;
+    bool (*stop)(void *arg);
+    void *arg;
+    atomic_bool stopped;
+} Blur;
+
+
+typedef struct
+{
+    Blur *blur;
+    int index;
+} Worker;
+
+
+static inline v4si unpack(uint32_t p)
+{
+    v4qu v;
+    memcpy(&v, &p, sizeof(p));
+    return __builtin_convertvector(v, v4si);
+}
+
+
+static inline uint32_t pack(v4si v)
+{
+    v4qu b = __builtin_convertvector(v, v4qu);
+    uint32_t p;
+    memcpy(&p, &b, sizeof(p));
+    return p;
+}
+
+
+static inline uint32_t *row_of(XImage *image, int y)
+{
+    return (uint32_t *)(image->data + (size_t)y * image->bytes_per_line);
+}
+
+
+/* Whether to give up, once one worker is told to stop all of them do */
+static bool stopped(Blur *blur)
+{
+    if (atomic_load_explicit(&blur->stopped, memory_order_relaxed))
+        return true;
+    if (!blur->stop || !blur->stop(blur->arg))
+        return false;
+
+    atomic_store_explicit(&blur->stopped, true, memory_order_relaxed);
+    return true;
+}
+
+
+static void box_rows(Blur *blur, XImage *src, XImage *dst, int y0, int y1, int radius, int32_t scale)
+{
+    int width = src->width;
+
+    for (int y = y0; y < y1; y++)
+    {
+        if ((y - y0) % BLUR_CHECK_ROWS == 0 && stopped(blur))
+            return;
+
+        const uint32_t *s = row_of(src, y);
+        uint32_t *d = row_of(dst, y);
+
+        // Edges are extended
+        v4si sum = unpack(s[0]) * (radius + 1);
+        for (int i = 1; i <= radius; i++)
+            sum += unpack(s[i < width ? i : width - 1]);
+
+        for (int x = 0; x < width; x++)
+        {
+            d[x] = pack((sum * scale + 32768) >> 16);
+
+            int in = x + radius + 1;
+            int out = x - radius;
+            sum += unpack(s[in < width ? in : width - 1]) - unpack(s[out > 0 ? out : 0]);
+        }
+    }
+}
+
+
+static void box_columns(Blur *blur, XImage *src, XImage *dst, int x0, int x1, int radius, int32_t scale, uint32_t alpha, v4si *sums)
+{
+    int height = src->height;
+    int count = x1 - x0;
+
+    const uint32_t *first = row_of(src, 0) + x0;
+    for (int x = 0; x < count; x++)
+        sums[x] = unpack(first[x]) * (radius + 1);
+
+    for (int i = 1; i <= radius; i++)
+    {
+        const uint32_t *s = row_of(src, i < height ? i : height - 1) + x0;
+        for (int x = 0; x < count; x++)
+            sums[x] += unpack(s[x]);
+    }
+
+    for (int y = 0; y < height; y++)
+    {
+        if (y % BLUR_CHECK_ROWS == 0 && stopped(blur))
+            return;
+
+        uint32_t *d = row_of(dst, y) + x0;
+        int in = y + radius + 1;
+        int out = y - radius;
+        const uint32_t *s_in = row_of(src, in < height ? in : height - 1) + x0;
+        const uint32_t *s_out = row_of(src, out > 0 ? out : 0) + x0;
+
+        for (int x = 0; x < count; x++)
+        {
+            d[x] = pack((sums[x] * scale + 32768) >> 16) | alpha;
+            sums[x] += unpack(s_in[x]) - unpack(s_out[x]);
+        }
+    }
+}
+
+
+static void tint_rows(Blur *blur, XImage *src, XImage *dst, int y0, int y1, uint32_t tint, uint32_t alpha)
+{
+    v4si color = unpack(tint);
+
+    for (int y = y0; y < y1; y++)
+    {
+        if ((y - y0) % BLUR_CHECK_ROWS == 0 && stopped(blur))
+            return;
+
+        const uint32_t *s = row_of(src, y);
+        uint32_t *d = row_of(dst, y);
+
+        // Progress shows as the background half covered by its color
+        for (int x = 0; x < src->width; x++)
+            d[x] = pack((unpack(s[x]) + color + 1) >> 1) | alpha;
+    }
+}
+
+
+static void *blur_worker(void *arg)
+{
+    Worker *worker = arg;
+    Blur *blur = worker->blur;
+
+    int width = blur->image->width;
+    int height = blur->image->height;
+    int y0 = height * worker->index / blur->threads;
+    int y1 = height * (worker->index + 1) / blur->threads;
+    int x0 = width * worker->index / blur->threads;
+    int x1 = width * (worker->index + 1) / blur->threads;
+
+    v4si *sums = malloc((x1 - x0 + 1) * sizeof(v4si));
+
+    // Image -> scratch -> image -> scratch horizontally
+    box_rows(blur, blur->image, blur->scratch, y0, y1, blur->radius, blur->scale);
+    box_rows(blur, blur->scratch, blur->image, y0, y1, blur->radius, blur->scale);
+    box_rows(blur, blur->image, blur->scratch, y0, y1, blur->radius, blur->scale);
+    pthread_barrier_wait(&blur->barrier);
+
+    // Scratch -> image -> scratch -> image vertically, each on its own columns
+    box_columns(blur, blur->scratch, blur->image, x0, x1, blur->radius, blur->scale, 0, sums);
+    box_columns(blur, blur->image, blur->scratch, x0, x1, blur->radius, blur->scale, 0, sums);
+    box_columns(blur, blur->scratch, blur->image, x0, x1, blur->radius, blur->last_scale, blur->alpha, sums);
+    pthread_barrier_wait(&blur->barrier);
+
+    tint_rows(blur, blur->image, blur->scratch, y0, y1, blur->tint, blur->alpha);
+
+    free(sums);
+    return NULL;
+}
+
+
+bool blur_image(XImage *image, XImage *scratch, int radius, float dim, uint32_t tint, uint32_t alpha, int threads,
+                bool (*stop)(void *arg), void *arg)
+{
+    Blur blur = {
+        .image = image,
+        .scratch = scratch,
+        .radius = radius < 1 ? 1 : radius,
+        .tint = tint,
+        .alpha = alpha,
+        .stop = stop,
+        .arg = arg
+    };
+    atomic_init(&blur.stopped, false);
+
+    if (dim < 0) dim = 0;
+    if (dim > 1) dim = 1;
+
+    blur.scale = 65536 / (2 * blur.radius + 1);
+    blur.last_scale = blur.scale * (1.0f - dim);
+
+    if (threads < 1)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores < 1 ? 1 : cores;
+    }
+    blur.threads = threads > BLUR_MAX_THREADS ? BLUR_MAX_THREADS : threads;
+    if (blur.threads > image->height)
+        blur.threads = image->height;
+
+    pthread_t handles[BLUR_MAX_THREADS];
+    Worker workers[BLUR_MAX_THREADS];
+    pthread_barrier_init(&blur.barrier, NULL, blur.threads);
+
+    // The calling thread is the last worker
+    for (int t = 0; t < blur.threads; t++)
+    {
+        workers[t].blur = &blur;
+        workers[t].index = t;
+        if (t < blur.threads - 1)
+            pthread_create(&handles[t], NULL, blur_worker, &workers[t]);
+    }
+    blur_worker(&workers[blur.threads - 1]);
+
+    for (int t = 0; t < blur.threads - 1; t++)
+        pthread_join(handles[t], NULL);
+
+    pthread_barrier_destroy(&blur.barrier);
+    return !atomic_load(&blur.stopped);
+}
@@ -0,0 +1,15 @@
+#ifndef BLUR_H
+#define BLUR_H
+
+#include <X11/Xlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Blur a 32-bit image in place, dimmed by dim, and leave a copy tinted by tint in scratch.
+   alpha is or-ed into every result pixel; threads < 1 takes one per core.
+   stop, when given, is asked every few rows from any worker; once it says so the
+   rest is skipped, the images are left half done and false is returned */
+bool blur_image(XImage *image, XImage *scratch, int radius, float dim, uint32_t tint, uint32_t alpha, int threads,
+                bool (*stop)(void *arg), void *arg);
+
+#endif /* BLUR_H */
@@ -0,0 +1,246 @@
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/Xrender.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "main.h"
+#include "fence.h"
+#include "breath.h"
+
+/*
+    Guided breathing ring for the break screen.
+
+    The ring grows while breathing in, stays while holding and shrinks
+    while breathing out. Every radius it can take is rasterized once at
+    start into an antialiased A8 mask, about one per pixel of radius, so a
+    frame only composites one mask through a solid fill. Its cost is
+    bounded by the largest ring and does not depend on the current one.
+
+    A frame costs its client time, or the whole interval when the server
+    was still busy with the previous one, which a fence sent after each
+    frame tells without a round trip. The cost is averaged, and while the
+    average stays over the budget the animation rate is halved, down to a
+    floor.
+*/
+
+#define BREATH_WIDTH 2.0 // Ring thickness in pt
+#define BREATH_MIN_FPS 8
+#define BREATH_WARMUP 8 // Frames averaged before the rate may drop
+#define BREATH_SMOOTHING 0.1
+
+
+static double ease(double t)
+{
+    return t * t * (3.0 - 2.0 * t);
+}
+
+
+/* From 0 breathed out to 1 breathed in */
+static double depth(const Config *config, double elapsed)
+{
+    double cycle = config->breathing_inhale + config->breathing_hold + config->breathing_exhale;
+    double t = fmod(elapsed, cycle);
+
+    if (t < config->breathing_inhale)
+        return ease(t / config->breathing_inhale);
+    t -= config->breathing_inhale;
+
+    if (t < config->breathing_hold)
+        return 1.0;
+    t -= config->breathing_hold;
+
+    return 1.0 - ease(t / config->breathing_exhale);
+}
+
+
+/* Coverage of a ring centered in a size x size square, edges filtered over a pixel */
+static void rasterize(uint8_t *coverage, uint size, double radius, double width)
+{
+    double center = size / 2.0;
+
+    for (uint y = 0; y < size; y++)
+    {
+        double dy = y + 0.5 - center;
+        for (uint x = 0; x < size; x++)
+        {
+            double dx = x + 0.5 - center;
+            double c = width / 2.0 + 0.5 - fabs(sqrt(dx * dx + dy * dy) - radius);
+            coverage[(size_t)y * size + x] = c <= 0.0 ? 0 : c >= 1.0 ? 255 : (uint8_t)(c * 255.0 + 0.5);
+        }
+    }
+}
+
+
+void breath_init(GlobalContext *gctx)
+{
+    Config *config = &gctx->config;
+    Breath *breath = &gctx->breath;
+
+    if (!config->breathing_enabled)
+        return;
+
+    if (config->breathing_inhale <= 0 || config->breathing_exhale <= 0 || config->breathing_hold < 0)
+    {
+        fprintf(stderr, "Breathing needs positive inhale and exhale times\n");
+        return;
+    }
+
+    double width = pt_to_px(BREATH_WIDTH, gctx->dpi);
+    double largest = pt_to_px(config->breathing_radius, gctx->dpi);
+    double smallest = largest / 3.0;
+
+    // Moves by about a pixel of radius per level
+    int count = largest - smallest + 1;
+    if (count > BREATH_LEVELS) count = BREATH_LEVELS;
+    if (count < 2) count = 2;
+
+    XRenderPictFormat *a8 = XRenderFindStandardFormat(gctx->display, PictStandardA8);
+    GC gc = None;
+
+    for (int l = 0; l < count; l++)
+    {
+        BreathRing *ring = &breath->rings[l];
+        double radius = smallest + (largest - smallest) * l / (count - 1);
+        uint size = 2 * (uint)ceil(radius + width / 2.0 + 1.0);
+
+        uint8_t *coverage = malloc((size_t)size * size);
+        rasterize(coverage, size, radius, width);
+
+        XImage *image = XCreateImage(gctx->display, gctx->visual, 8, ZPixmap, 0, (char *)coverage, size, size, 8, size);
+        ring->size = size;
+
+        // Composed client-side, the coverage stays in memory
+        if (gctx->shm)
+        {
+            ring->image = image;
+            continue;
+        }
+
+        ring->pixmap = XCreatePixmap(gctx->display, gctx->root, size, size, 8);
+        if (!gc)
+            gc = XCreateGC(gctx->display, ring->pixmap, 0, NULL);
+        XPutImage(gctx->display, ring->pixmap, gc, image, 0, 0, 0, 0, size, size);
+        ring->mask = XRenderCreatePicture(gctx->display, ring->pixmap, a8, 0, NULL);
+        XDestroyImage(image);
+    }
+
+    if (gc)
+        XFreeGC(gctx->display, gc);
+
+    breath->ring_count = count;
+    breath->enabled = true;
+    breath_start(gctx);
+}
+
+
+void breath_start(GlobalContext *gctx)
+{
+    Breath *breath = &gctx->breath;
+
+    breath->interval = 1.0 / gctx->config.fps;
+    breath->cost = 0.0;
+    breath->samples = 0;
+    breath->max_cost = 0.0;
+    breath->total_cost = 0.0;
+    breath->frames = 0;
+    breath->late = 0;
+    fence_drop(gctx, &breath->fence);
+}
+
+
+int breath_level(GlobalContext *gctx, double elapsed)
+{
+    return depth(&gctx->config, elapsed) * (gctx->breath.ring_count - 1) + 0.5;
+}
+
+
+double breath_next(GlobalContext *gctx, double elapsed)
+{
+    Config *config = &gctx->config;
+
+    double cycle = config->breathing_inhale + config->breathing_hold + config->breathing_exhale;
+    double start = elapsed - fmod(elapsed, cycle);
+    double hold = start + config->breathing_inhale;
+
+    // Nothing moves while holding
+    if (elapsed >= hold && elapsed < hold + config->breathing_hold)
+        return hold + config->breathing_hold;
+
+    return elapsed + gctx->breath.interval;
+}
+
+
+void breath_frame(GlobalContext *gctx, double cost)
+{
+    Breath *breath = &gctx->breath;
+
+    // The server had the whole interval for the previous frame
+    if (!fence_passed(gctx, &breath->fence))
+    {
+        breath->late++;
+        if (cost < breath->interval)
+            cost = breath->interval;
+    }
+    fence_send(gctx, &breath->fence);
+
+    breath->frames++;
+    breath->total_cost += cost;
+    if (cost > breath->max_cost)
+        breath->max_cost = cost;
+
+    // Plain mean while warming up, then a moving average
+    breath->samples++;
+    if (breath->samples <= BREATH_WARMUP)
+        breath->cost += (cost - breath->cost) / breath->samples;
+    else
+        breath->cost += (cost - breath->cost) * BREATH_SMOOTHING;
+
+    double budget = gctx->config.breathing_budget / 1000.0;
+    if (budget <= 0 || breath->samples < BREATH_WARMUP || breath->cost <= budget)
+        return;
+    if (breath->interval * 2.0 > 1.0 / BREATH_MIN_FPS)
+        return;
+
+    breath->interval *= 2.0;
+    printf("Breathing frames take %.2f ms, over the %.2f ms budget, animating at %.0f fps\n",
+           breath->cost * 1000.0, gctx->config.breathing_budget, 1.0 / breath->interval);
+
+    breath->samples = 0;
+    breath->cost = 0.0;
+}
+
+
+void breath_report(GlobalContext *gctx)
+{
+    Breath *breath = &gctx->breath;
+    if (!breath->enabled || breath->frames == 0)
+        return;
+
+    printf("Breathing %lu frames, %lu late, average %.2f ms, max %.2f ms, %.0f fps\n",
+           breath->frames, breath->late, breath->total_cost * 1000.0 / breath->frames,
+           breath->max_cost * 1000.0, 1.0 / breath->interval);
+}
+
+
+void breath_free(GlobalContext *gctx)
+{
+    Breath *breath = &gctx->breath;
+
+    fence_drop(gctx, &breath->fence);
+    for (int l = 0; l < breath->ring_count; l++)
+    {
+        BreathRing *ring = &breath->rings[l];
+        if (ring->image)
+            XDestroyImage(ring->image);
+        if (ring->mask)
+            XRenderFreePicture(gctx->display, ring->mask);
+        if (ring->pixmap)
+            XFreePixmap(gctx->display, ring->pixmap);
+    }
+
+    breath->ring_count = 0;
+    breath->enabled = false;
+}
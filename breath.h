@@ -0,0 +1,26 @@
+#ifndef BREATH_H
+#define BREATH_H
+
+#include "main.h"
+
+/* Rasterize the ring masks once for the configured radius */
+void breath_init(GlobalContext *gctx);
+
+/* Reset the animation rate and statistics for a new break */
+void breath_start(GlobalContext *gctx);
+
+/* Ring shown at elapsed seconds into the break */
+int breath_level(GlobalContext *gctx, double elapsed);
+
+/* Elapsed time of the next animation frame */
+double breath_next(GlobalContext *gctx, double elapsed);
+
+/* Account the client cost of an animation frame just sent, the rate drops while it is over budget */
+void breath_frame(GlobalContext *gctx, double cost);
+
+/* Print frame cost statistics */
+void breath_report(GlobalContext *gctx);
+
+void breath_free(GlobalContext *gctx);
+
+#endif /* BREATH_H */
@@ -0,0 +1,467 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <ctype.h>
+
+#include "main.h"
+#include "config.h"
+
+/*
+    Configuration file and defaults.
+
+    The file is an INI-like list of key = value lines in
+    $XDG_CONFIG_HOME/xrest/config.ini, every key optional over the
+    defaults. It holds no X state, so headless tools load it the same way.
+*/
+
+void load_defaults(Config *config)
+{
+    strcpy(config->break_title_text, "Break time!");
+    strcpy(config->break_message_text, "Rest your eyes. Stretch your legs. Breathe. Relax.");
+    strcpy(config->break_hint_text, "s - stop, q - quit");
+
+    strcpy(config->warning_message_text, "Please, take a break!");
+    strcpy(config->warning_hint_text, "space - start, w - snooze, s - skip, q - quit");
+
+    strcpy(config->end_title_text, "Break has ended!");
+    strcpy(config->end_message_text, "Work fruitfully. Concentrate on important. Don't get distracted.");
+    strcpy(config->end_hint_text, "press any key to continue...");
+
+    config->warning_enabled = true;
+    config->skip_enabled = true;
+    config->snooze_enabled = true;
+    config->stop_enabled = true;
+    config->end_enabled = true;
+    config->hints_enabled = true;
+    config->time_enabled = true;
+    config->sound_enabled = true;
+    config->block_input = false;
+    config->shm_enabled = true;
+    config->present_enabled = false;
+    config->low_memory = false;
+    config->primary_only = false;
+
+    config->timer_duration = 28 * 60;
+    config->break_duration = 5 * 60;
+    config->warning_duration = 60;
+    config->snooze_duration = 60;
+
+    config->repeat = true;
+
+    config->detect_idle = true;
+    config->idle_limit = 5 * 60;
+
+    config->activity_enabled = false;
+    config->activity_keys = 200;
+    config->activity_distance = 0;
+    config->activity_weight = 1.5;
+
+    strcpy(config->font_color, "#ffffff");
+    strcpy(config->hint_font_color, "#aaaaaa");
+    strcpy(config->background_font_color, "#222222");
+    strcpy(config->background_color, "#000000");
+    strcpy(config->progress_color, "#161616");
+    strcpy(config->border_color, "#333333");
+    config->background_image[0] = '\0';
+    config->desktop_background = false;
+    config->desktop_blur = 12;
+    config->desktop_dim = 0.4;
+    config->breathing_enabled = false;
+    config->breathing_inhale = 4;
+    config->breathing_hold = 2;
+    config->breathing_exhale = 6;
+    config->breathing_radius = 96;
+    config->breathing_budget = 4;
+
+    strcpy(config->font_name, "monospace");
+
+    config->title_font_size = 14;
+    config->title_font_weight = 300;
+    config->title_font_slant = 0;
+    strcpy(config->title_font_style, "regular");
+
+    config->message_font_size = 12;
+    config->message_font_weight = 200;
+    config->message_font_slant = 0;
+    strcpy(config->message_font_style, "regular");
+
+    config->hint_font_size = 10;
+    config->hint_font_weight = 100;
+    config->hint_font_slant = 100;
+    strcpy(config->hint_font_style, "regular");
+
+    config->time_font_size = 128;
+    config->time_font_weight = 300;
+    config->time_font_slant = 0;
+    strcpy(config->time_font_style, "regular");
+
+    config->warning_width = 320; // pt
+    config->warning_height = 96; // pt
+    config->border_width = 0; // px
+    config->progress_weight = 16;
+    config->margin = 12;
+
+    config->fps = 60;
+    config->fade_duration = 0;
+    config->warning_opacity = 1.0;
+
+    strcpy(config->start_sound_path, "sounds/start.wav");
+    strcpy(config->end_sound_path, "sounds/end.wav");
+    config->volume = 0.8;
+}
+
+
+void load_dev(Config *config)
+{
+    config->timer_duration = 1;
+    // config->break_duration = 3;
+    // config->warning_duration = 3;
+    config->snooze_duration = 3;
+    // config->warning_enabled = false;
+    // config->end_enabled = false;
+    // config->repeat = false;
+
+    // Schedules from [name] sections were copied before this ran
+    for (int s = 0; s < config->schedule_count; s++)
+        config->schedules[s].timer_duration = config->timer_duration;
+}
+
+
+static void get_config_folder(char *buffer, size_t length)
+{
+    const char *xdg = getenv("XDG_CONFIG_HOME");
+    const char *home = getenv("HOME");
+
+    if (xdg)
+        snprintf(buffer, length, "%s/xrest/", xdg);
+    else if (home)
+        snprintf(buffer, length, "%s/.config/xrest/", home);
+    else
+        snprintf(buffer, length, "./");
+}
+
+
+static void get_config_file(char *buffer, size_t length)
+{
+    get_config_folder(buffer, length);
+    strcat(buffer, "config.ini");
+}
+
+
+static void trim(char* str) 
+{
+    char* start = str;
+    while (isspace((unsigned char)*start)) start++;
+    memmove(str, start, strlen(start) + 1);
+
+    char* end = str + strlen(str) - 1;
+    while (end > str && isspace((unsigned char)*end)) *end-- = '\0';
+}
+
+
+static int parse_duration(const char *str) 
+{
+    int total = 0;
+    int value = 0;
+
+    while (*str) {
+        if (isdigit((unsigned char)*str)) 
+        {
+            value = value * 10 + (*str - '0');
+        } 
+        else 
+        {
+            if (*str == 'h') 
+            {
+                total += value * 3600;
+                value = 0;
+            } else if (*str == 'm') 
+            {
+                total += value * 60;
+                value = 0;
+            } else if (*str == 's') 
+            {
+                total += value;
+                value = 0;
+            }
+        }
+        str++;
+    }
+
+    return total;
+}
+
+
+unsigned int parse_color(const char *str) 
+{
+    if (*str == '#')
+        str++;  // skip '#'
+
+    return (unsigned int)strtoul(str, NULL, 16);
+}
+
+
+static void parse_string(char *dst, size_t dst_size, const char *src)
+{
+    // Skip leading whitespace
+    while (isspace((unsigned char)*src))
+        src++;
+
+    size_t i = 0;
+
+    if (*src == '"') {
+        // Quoted string
+        src++; // skip opening quote
+        while (*src && *src != '"' && i + 1 < dst_size) {
+            // Escapes: \n for a line break, \" and \\ literally
+            if (*src == '\\' && src[1]) {
+                src++;
+                dst[i++] = *src == 'n' ? '\n' : *src;
+                src++;
+                continue;
+            }
+            dst[i++] = *src++;
+        }
+    } else {
+        // Single-word string
+        while (*src && !isspace((unsigned char)*src) && i + 1 < dst_size) {
+            dst[i++] = *src++;
+        }
+    }
+
+    dst[i] = '\0';
+}
+
+
+void load_schedule(Schedule *schedule, const Config *config, const char *name)
+{
+    snprintf(schedule->name, sizeof(schedule->name), "%s", name);
+    schedule->timer_duration = config->timer_duration;
+    schedule->break_duration = config->break_duration;
+    schedule->warning_duration = config->warning_duration;
+    strcpy(schedule->break_title_text, config->break_title_text);
+    strcpy(schedule->break_message_text, config->break_message_text);
+    strcpy(schedule->break_hint_text, config->break_hint_text);
+    strcpy(schedule->start_sound_path, config->start_sound_path);
+    strcpy(schedule->end_sound_path, config->end_sound_path);
+}
+
+
+void load_config(Config *config)
+{
+    char path[512];
+    get_config_file(path, sizeof(path));
+    load_config_file(config, path);
+}
+
+
+void load_config_file(Config *config, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return;
+
+    // Keys under a [name] header belong to that schedule, it starts from the top level
+    Schedule *section = NULL;
+
+    char line[2048];
+    while (fgets(line, sizeof(line), f)) 
+    {
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\0')
+            continue;
+
+        if (line[0] == '[')
+        {
+            char *close = strchr(line, ']');
+            if (!close)
+                continue;
+            *close = '\0';
+            trim(line + 1);
+
+            section = NULL;
+            if (config->schedule_count < SCHEDULE_MAX)
+            {
+                section = &config->schedules[config->schedule_count++];
+                load_schedule(section, config, line + 1);
+            }
+            else
+                fprintf(stderr, "Too many schedules, [%s] ignored\n", line + 1);
+            continue;
+        }
+
+        char* delimeter = strchr(line, '=');
+        if (!delimeter) continue;
+
+        *delimeter = '\0';
+        char* key = line;
+        char* value = delimeter + 1;
+        trim(key); trim(value);
+
+        #define SET_INT(field) \
+            if (strcmp(key, #field) == 0) \
+                config->field = atoi(value);
+        
+        #define SET_FLOAT(field) \
+            if (strcmp(key, #field) == 0) \
+                config->field = atof(value);
+
+        #define SET_STRING(field) \
+            if (strcmp(key, #field) == 0) \
+                parse_string(config->field, sizeof(config->field), value);
+        
+        #define SET_BOOL(field) \
+            if (strcmp(key, #field) == 0) \
+                config->field = strcmp(value, "true") == 0;
+        
+        #define SET_DURATION(field) \
+            if (strcmp(key, #field) == 0) \
+                config->field = parse_duration(value);
+        
+        #define SET_COLOR(field) \
+            if (strcmp(key, #field) == 0) \
+                config->field = parse_color(value);
+
+        #define SCHEDULE_STRING(field) \
+            if (strcmp(key, #field) == 0) \
+            { \
+                parse_string(section->field, sizeof(section->field), value); \
+                continue; \
+            }
+
+        #define SCHEDULE_DURATION(field) \
+            if (strcmp(key, #field) == 0) \
+            { \
+                section->field = parse_duration(value); \
+                continue; \
+            }
+
+        if (section)
+        {
+            SCHEDULE_DURATION(timer_duration);
+            SCHEDULE_DURATION(break_duration);
+            SCHEDULE_DURATION(warning_duration);
+            SCHEDULE_STRING(break_title_text);
+            SCHEDULE_STRING(break_message_text);
+            SCHEDULE_STRING(break_hint_text);
+            SCHEDULE_STRING(start_sound_path);
+            SCHEDULE_STRING(end_sound_path);
+
+            // Would change every schedule, not only this one
+            fprintf(stderr, "%s: %s is not a schedule setting, ignored in [%s]\n", path, key, section->name);
+            continue;
+        }
+
+        SET_STRING(break_title_text);
+        SET_STRING(break_message_text);
+        SET_STRING(break_hint_text);
+
+        SET_STRING(warning_message_text);
+        SET_STRING(warning_hint_text);
+
+        SET_STRING(end_title_text);
+        SET_STRING(end_message_text);
+        SET_STRING(end_hint_text);
+
+        SET_BOOL(warning_enabled);
+        SET_BOOL(skip_enabled);
+        SET_BOOL(snooze_enabled);
+        SET_BOOL(stop_enabled);
+        SET_BOOL(end_enabled);
+        SET_BOOL(hints_enabled);
+        SET_BOOL(time_enabled);
+        SET_BOOL(sound_enabled);
+        SET_BOOL(block_input);
+        SET_BOOL(shm_enabled);
+        SET_BOOL(present_enabled);
+        SET_BOOL(low_memory);
+        SET_BOOL(primary_only);
+        SET_BOOL(desktop_background);
+        SET_INT(desktop_blur);
+        SET_FLOAT(desktop_dim);
+        SET_BOOL(breathing_enabled);
+        SET_FLOAT(breathing_inhale);
+        SET_FLOAT(breathing_hold);
+        SET_FLOAT(breathing_exhale);
+        SET_INT(breathing_radius);
+        SET_FLOAT(breathing_budget);
+
+
+        SET_DURATION(timer_duration);
+        SET_DURATION(break_duration);
+        SET_DURATION(warning_duration);
+        SET_DURATION(snooze_duration);
+
+        SET_BOOL(repeat);
+
+        SET_BOOL(detect_idle);
+        SET_DURATION(idle_limit);
+
+        SET_BOOL(activity_enabled);
+        SET_INT(activity_keys);
+        SET_INT(activity_distance);
+        SET_FLOAT(activity_weight);
+
+        SET_STRING(font_color);
+        SET_STRING(hint_font_color);
+        SET_STRING(background_font_color);
+        SET_STRING(background_color);
+        SET_STRING(progress_color);
+        SET_STRING(border_color);
+        SET_STRING(background_image);
+
+        SET_STRING(font_name);
+
+        SET_INT(title_font_size);
+        SET_INT(title_font_weight);
+        SET_INT(title_font_slant);
+        SET_STRING(title_font_style);
+
+        SET_INT(message_font_size);
+        SET_INT(message_font_weight);
+        SET_INT(message_font_slant);
+        SET_STRING(message_font_style);
+
+        SET_INT(hint_font_size);
+        SET_INT(hint_font_weight);
+        SET_INT(hint_font_slant);
+        SET_STRING(hint_font_style);
+
+        SET_INT(time_font_size);
+        SET_INT(time_font_weight);
+        SET_INT(time_font_slant);
+        SET_STRING(time_font_style);
+
+        SET_INT(warning_width);
+        SET_INT(warning_height);
+        SET_INT(border_width);
+        SET_INT(progress_weight);
+        SET_INT(margin);
+
+        SET_INT(fps);
+        SET_FLOAT(fade_duration);
+        SET_FLOAT(warning_opacity);
+
+        SET_STRING(start_sound_path);
+        SET_STRING(end_sound_path);
+        SET_FLOAT(volume);
+    }
+    fclose(f);
+}
+
+
+char *get_font_string(const char *font_name, uint font_size, const char *font_style, uint font_weight, uint font_slant)
+{
+    char *fstring = "%s:style=%s:size=%u:weight=%d:slant=%d";
+    int size = snprintf(NULL, 0, fstring, font_name, font_style, font_size, font_weight, font_slant);
+    char *string = malloc(size + 1);
+    assert(string);
+    snprintf(string, size + 1, fstring, font_name, font_style, font_size, font_weight, font_slant);
+    return string;
+}
+
+
+double pt_to_px(double pt, double dpi)
+{
+    return pt * dpi / 72.0;
+}
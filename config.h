@@ -0,0 +1,26 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "main.h"
+
+void load_defaults(Config *config);
+
+/* Short timings for trying the screens out in debug mode */
+void load_dev(Config *config);
+
+/* Override the defaults with the user's config file, if there is one */
+void load_config(Config *config);
+
+/* Same from a given file */
+void load_config_file(Config *config, const char *path);
+
+/* Fill a schedule with the break settings of the config */
+void load_schedule(Schedule *schedule, const Config *config, const char *name);
+
+/* #rrggbb as 0xrrggbb */
+unsigned int parse_color(const char *str);
+
+/* Fontconfig pattern of a font, allocated */
+char *get_font_string(const char *font_name, uint font_size, const char *font_style, uint font_weight, uint font_slant);
+
+#endif /* CONFIG_H */
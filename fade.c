@@ -0,0 +1,457 @@
+#include <X11/Xlib.h>
+#include <X11/Xlib-xcb.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/Xrender.h>
+#include <X11/extensions/XShm.h>
+#include <xcb/xcb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "timer.h"
+#include "fence.h"
+#include "input.h"
+#include "fade.h"
+
+/*
+    Fade transitions and window opacity through XRender.
+
+    A fade never recomposes the screen. The composed frame of each view is
+    wrapped in a picture once, an SHM back buffer being copied to a server
+    pixmap first, and every step is a single XRenderComposite of it onto
+    the window through a solid alpha mask.
+
+    With a compositing manager the windows use a 32-bit ARGB visual and
+    the mask alpha becomes the window alpha, which the manager blends with
+    the desktop. This also makes the warning translucent: its publishes go
+    through the same mask.
+
+    Without one, alpha on the window means nothing. The window is created
+    without a background, so once mapped it still shows the screen it
+    covers, and each step composites the frame over the previous one with
+    the alpha that brings its accumulated share to the target. Fading out
+    does the same with a copy of the screen taken before the window
+    appeared.
+*/
+
+
+static unsigned long premultiply(GlobalContext *gctx, const XColor *color, double alpha)
+{
+    const XRenderDirectFormat *f = &XRenderFindVisualFormat(gctx->display, gctx->visual)->direct;
+
+    return (unsigned long)(alpha * f->alphaMask + 0.5) << f->alpha |
+           (unsigned long)(alpha * color->red / 65535.0 * f->redMask + 0.5) << f->red |
+           (unsigned long)(alpha * color->green / 65535.0 * f->greenMask + 0.5) << f->green |
+           (unsigned long)(alpha * color->blue / 65535.0 * f->blueMask + 0.5) << f->blue;
+}
+
+
+static Picture solid_alpha(GlobalContext *gctx, double alpha)
+{
+    XRenderColor color = { 0, 0, 0, alpha * 0xffff + 0.5 };
+    return XRenderCreateSolidFill(gctx->display, &color);
+}
+
+
+/* The border is drawn by the server, only a compositing manager can blend it */
+static void set_border(GlobalContext *gctx, WindowContext *wctx, double alpha)
+{
+    if (gctx->composited && wctx->border > 0)
+        XSetWindowBorder(gctx->display, wctx->window, premultiply(gctx, &gctx->border_color, alpha));
+}
+
+
+/* Window area covered by the views */
+static void window_size(WindowContext *wctx, uint *width, uint *height)
+{
+    *width = 0;
+    *height = 0;
+
+    for (WindowContext *view = wctx; view; view = view->next)
+    {
+        for (int o = 0; o < view->output_count; o++)
+        {
+            XRectangle r = view->outputs[o];
+            if (r.x + r.width > *width)
+                *width = r.x + r.width;
+            if (r.y + r.height > *height)
+                *height = r.y + r.height;
+        }
+    }
+}
+
+
+static Picture view_source(GlobalContext *gctx, WindowContext *view)
+{
+    Fade *fade = &view->fade;
+    if (fade->source)
+        return fade->source;
+
+    Drawable drawable = view->draw_buffer;
+    if (view->image)
+    {
+        fade->pixmap = XCreatePixmap(gctx->display, view->window, view->width, view->height, gctx->depth);
+        drawable = fade->pixmap;
+    }
+
+    fade->source = XRenderCreatePicture(gctx->display, drawable, XRenderFindVisualFormat(gctx->display, gctx->visual), 0, NULL);
+    return fade->source;
+}
+
+
+/* Bring region r of the server copy up to date with the SHM back buffer */
+static void upload(GlobalContext *gctx, WindowContext *view, XRectangle r)
+{
+    if (!view->image)
+        return;
+
+    XShmPutImage(gctx->display, view->fade.pixmap, view->graphics_context, view->image, r.x, r.y, r.x, r.y, r.width, r.height, True);
+    view->shm_pending++;
+}
+
+
+static void upload_all(GlobalContext *gctx, WindowContext *wctx)
+{
+    for (WindowContext *view = wctx; view; view = view->next)
+    {
+        XRectangle r = { 0, 0, view->width, view->height };
+        view_source(gctx, view);
+        upload(gctx, view, r);
+    }
+}
+
+
+/* One composite per output of every view */
+static void composite_frame(GlobalContext *gctx, WindowContext *wctx, int op, double alpha)
+{
+    Picture mask = solid_alpha(gctx, alpha);
+
+    for (WindowContext *view = wctx; view; view = view->next)
+        for (int o = 0; o < view->output_count; o++)
+            XRenderComposite(gctx->display, op, view->fade.source, mask, wctx->fade.window,
+                             0, 0, 0, 0, view->outputs[o].x, view->outputs[o].y, view->width, view->height);
+
+    XRenderFreePicture(gctx->display, mask);
+}
+
+
+static void composite_under(GlobalContext *gctx, WindowContext *wctx, double alpha)
+{
+    Fade *fade = &wctx->fade;
+    Picture mask = solid_alpha(gctx, alpha);
+
+    // The window picture leaves the border out
+    XRenderComposite(gctx->display, PictOpOver, fade->under_picture, mask, fade->window,
+                     wctx->border, wctx->border, 0, 0, 0, 0,
+                     fade->under_width - 2 * wctx->border, fade->under_height - 2 * wctx->border);
+
+    XRenderFreePicture(gctx->display, mask);
+}
+
+
+/* Show a share of the frame over what the window covers */
+static void step_in(GlobalContext *gctx, WindowContext *wctx, double coverage, double covered)
+{
+    if (gctx->composited)
+    {
+        double alpha = coverage * wctx->fade.opacity;
+        composite_frame(gctx, wctx, PictOpSrc, alpha);
+        set_border(gctx, wctx, alpha);
+        return;
+    }
+
+    if (coverage > covered)
+        composite_frame(gctx, wctx, PictOpOver, (coverage - covered) / (1.0 - covered));
+}
+
+
+/* Show a share of what the window covers over the frame */
+static void step_out(GlobalContext *gctx, WindowContext *wctx, double coverage, double covered)
+{
+    if (gctx->composited)
+    {
+        double alpha = (1.0 - coverage) * wctx->fade.opacity;
+        composite_frame(gctx, wctx, PictOpSrc, alpha);
+        set_border(gctx, wctx, alpha);
+        return;
+    }
+
+    if (coverage > covered)
+        composite_under(gctx, wctx, (coverage - covered) / (1.0 - covered));
+}
+
+
+typedef void (*FadeStep)(GlobalContext *gctx, WindowContext *wctx, double coverage, double covered);
+
+
+/*
+    Steps are paced by the frame rate and by the server: one is only sent
+    once the previous is done, so a slow server shows fewer steps instead
+    of falling behind the clock. Being done is checked with a fence, a
+    remote display costs no round trip per step. A key for the state
+    being shown skips to the last step, the transition doesn't wait for
+    the fade.
+*/
+static void run(GlobalContext *gctx, WindowContext *wctx, FadeStep step, const char *name)
+{
+    double duration = gctx->config.fade_duration;
+    Timer timer = {0};
+    timer_start(&timer);
+
+    Fence fence = {0};
+    double covered = 0.0;
+    double next = 0.0; // Step deadline, on a grid of frames
+    int steps = 0;
+
+    while (true)
+    {
+        double start = timer_elapsed(&timer);
+        double t = start < duration && !input_pending(gctx) ? start / duration : 1.0;
+
+        // The last step is always sent, the frame must end up fully shown or hidden
+        if (t >= 1.0 || fence_passed(gctx, &fence))
+        {
+            // Eased in and out
+            double coverage = t * t * (3.0 - 2.0 * t);
+            step(gctx, wctx, coverage, covered);
+            covered = coverage;
+            steps++;
+
+            fence_send(gctx, &fence);
+        }
+
+        if (t >= 1.0)
+            break;
+
+        next = timer_pace(gctx->frame_time, next, timer_elapsed(&timer));
+        timer_sleep_until(&timer, next);
+    }
+
+    fence_drop(gctx, &fence);
+
+    if (gctx->debug)
+        printf("Fade %s: %d steps in %.1f ms\n", name, steps, timer_elapsed(&timer) * 1000.0);
+}
+
+
+static void free_under(GlobalContext *gctx, WindowContext *wctx)
+{
+    Fade *fade = &wctx->fade;
+    if (!fade->under)
+        return;
+
+    XRenderFreePicture(gctx->display, fade->under_picture);
+    XFreePixmap(gctx->display, fade->under);
+    fade->under = None;
+    fade->under_picture = None;
+    fade->under_width = 0;
+    fade->under_height = 0;
+}
+
+
+/* Copy the screen the window is about to cover, our other windows give back what they covered */
+static void grab_under(GlobalContext *gctx, WindowContext *wctx)
+{
+    Fade *fade = &wctx->fade;
+    uint width, height;
+    window_size(wctx, &width, &height);
+
+    free_under(gctx, wctx);
+    fade->under_width = width + 2 * wctx->border;
+    fade->under_height = height + 2 * wctx->border;
+    fade->under = XCreatePixmap(gctx->display, gctx->root, fade->under_width, fade->under_height, gctx->depth);
+    fade->under_picture = XRenderCreatePicture(gctx->display, fade->under, XRenderFindVisualFormat(gctx->display, gctx->visual), 0, NULL);
+
+    XGCValues values = { .subwindow_mode = IncludeInferiors };
+    GC gc = XCreateGC(gctx->display, gctx->root, GCSubwindowMode, &values);
+
+    int x = fade->under_x = wctx->root_x - wctx->border;
+    int y = fade->under_y = wctx->root_y - wctx->border;
+    XCopyArea(gctx->display, gctx->root, fade->under, gc, x, y, fade->under_width, fade->under_height, 0, 0);
+
+    WindowContext *warning = &gctx->pool.warning;
+    if (warning != wctx && warning->mapped && warning->fade.under)
+    {
+        XCopyArea(gctx->display, warning->fade.under, fade->under, gc, 0, 0, warning->fade.under_width, warning->fade.under_height,
+                  warning->fade.under_x - x, warning->fade.under_y - y);
+    }
+
+    XFreeGC(gctx->display, gc);
+}
+
+
+static bool wanted(const Config *config)
+{
+    // Both fading and opacity work from the composed frame in a back buffer
+    if (config->low_memory)
+        return false;
+
+    return config->fade_duration > 0 || config->warning_opacity < 1.0;
+}
+
+
+void fade_query(GlobalContext *gctx)
+{
+    if (!wanted(&gctx->config))
+        return;
+
+    char name[32];
+    snprintf(name, sizeof(name), "_NET_WM_CM_S%d", gctx->screen);
+    gctx->cm_atom = xcb_intern_atom(gctx->xcb, False, strlen(name), name);
+}
+
+
+void fade_init(GlobalContext *gctx)
+{
+    Config *config = &gctx->config;
+
+    if (!wanted(config))
+        return;
+
+    gctx->fade = config->fade_duration > 0;
+
+    xcb_intern_atom_reply_t *atom = xcb_intern_atom_reply(gctx->xcb, gctx->cm_atom, NULL);
+    if (!atom)
+        return;
+
+    xcb_get_selection_owner_reply_t *owner = xcb_get_selection_owner_reply(gctx->xcb, xcb_get_selection_owner(gctx->xcb, atom->atom), NULL);
+    free(atom);
+
+    bool managed = owner && owner->owner != XCB_NONE;
+    free(owner);
+    if (!managed)
+        return;
+
+    if (!XMatchVisualInfo(gctx->display, gctx->screen, 32, TrueColor, &gctx->vinfo))
+        return;
+
+    XRenderPictFormat *format = XRenderFindVisualFormat(gctx->display, gctx->vinfo.visual);
+    if (!format || format->type != PictTypeDirect || !format->direct.alphaMask)
+        return;
+
+    gctx->depth = 32;
+    gctx->visual = gctx->vinfo.visual;
+    gctx->colormap = XCreateColormap(gctx->display, gctx->root, gctx->visual, AllocNone);
+    gctx->alpha_mask = (unsigned long)format->direct.alphaMask << format->direct.alpha;
+    gctx->composited = true;
+}
+
+
+void fade_begin(GlobalContext *gctx, WindowContext *wctx, double opacity)
+{
+    Fade *fade = &wctx->fade;
+
+    if (!gctx->composited || opacity > 1.0)
+        opacity = 1.0;
+    if (opacity < 0.0)
+        opacity = 0.0;
+
+    if (!gctx->fade && opacity >= 1.0)
+        return;
+
+    if (!fade->window)
+        fade->window = XRenderCreatePicture(gctx->display, wctx->window, XRenderFindVisualFormat(gctx->display, gctx->visual), 0, NULL);
+
+    for (WindowContext *view = wctx; view; view = view->next)
+    {
+        view->fade.window = fade->window;
+        view->fade.opacity = opacity;
+        if (opacity < 1.0 && !view->fade.mask)
+            view->fade.mask = solid_alpha(gctx, opacity);
+    }
+
+    set_border(gctx, wctx, gctx->fade ? 0.0 : opacity);
+
+    if (gctx->fade && !gctx->composited)
+        grab_under(gctx, wctx);
+}
+
+
+void fade_in(GlobalContext *gctx, WindowContext *wctx)
+{
+    if (!gctx->fade || !wctx->fade.window)
+        return;
+
+    upload_all(gctx, wctx);
+    run(gctx, wctx, step_in, "in");
+}
+
+
+void fade_out(GlobalContext *gctx, WindowContext *wctx)
+{
+    Fade *fade = &wctx->fade;
+    if (!gctx->fade || !wctx->mapped || !fade->window)
+        return;
+
+    if (gctx->composited)
+    {
+        upload_all(gctx, wctx);
+        run(gctx, wctx, step_out, "out");
+        return;
+    }
+
+    // The window moved or changed size, what it covered is gone
+    uint width, height;
+    window_size(wctx, &width, &height);
+    if (!fade->under || fade->under_x != wctx->root_x - wctx->border || fade->under_y != wctx->root_y - wctx->border ||
+        fade->under_width != width + 2 * wctx->border || fade->under_height != height + 2 * wctx->border)
+        return;
+
+    run(gctx, wctx, step_out, "out");
+}
+
+
+bool fade_publish(GlobalContext *gctx, WindowContext *wctx, XRectangle r, XRectangle output)
+{
+    Fade *fade = &wctx->fade;
+    if (!fade->mask)
+        return false;
+
+    Picture source = view_source(gctx, wctx);
+    upload(gctx, wctx, r);
+    XRenderComposite(gctx->display, PictOpSrc, source, fade->mask, fade->window,
+                     r.x, r.y, 0, 0, output.x + r.x, output.y + r.y, r.width, r.height);
+    return true;
+}
+
+
+void fade_drop(GlobalContext *gctx, WindowContext *wctx)
+{
+    Fade *fade = &wctx->fade;
+
+    if (fade->source)
+        XRenderFreePicture(gctx->display, fade->source);
+    if (fade->pixmap)
+        XFreePixmap(gctx->display, fade->pixmap);
+
+    fade->source = None;
+    fade->pixmap = None;
+}
+
+
+void fade_release(GlobalContext *gctx, WindowContext *wctx)
+{
+    for (WindowContext *view = wctx; view; view = view->next)
+    {
+        fade_drop(gctx, view);
+        if (view->fade.mask)
+            XRenderFreePicture(gctx->display, view->fade.mask);
+        view->fade.mask = None;
+        view->fade.opacity = 1.0;
+    }
+
+    free_under(gctx, wctx);
+}
+
+
+void fade_free(GlobalContext *gctx, WindowContext *wctx)
+{
+    fade_release(gctx, wctx);
+
+    if (wctx->fade.window)
+        XRenderFreePicture(gctx->display, wctx->fade.window);
+
+    for (WindowContext *view = wctx; view; view = view->next)
+        view->fade.window = None;
+}
@@ -0,0 +1,32 @@
+#ifndef FADE_H
+#define FADE_H
+
+#include "main.h"
+
+/* Ask early for what fade_init needs from the server, its reply is collected there */
+void fade_query(GlobalContext *gctx);
+
+/* Check for a compositing manager and pick an ARGB visual if it can blend the windows */
+void fade_init(GlobalContext *gctx);
+
+/* Get an unmapped window ready to appear at the given opacity */
+void fade_begin(GlobalContext *gctx, WindowContext *wctx, double opacity);
+
+/* Fade a just mapped window in to its prepared frame, scene_show publishes it after */
+void fade_in(GlobalContext *gctx, WindowContext *wctx);
+
+/* Fade the current frame of a window out before it is unmapped */
+void fade_out(GlobalContext *gctx, WindowContext *wctx);
+
+/* Publish buffer region r to an output through the window opacity, false if the window is opaque */
+bool fade_publish(GlobalContext *gctx, WindowContext *wctx, XRectangle r, XRectangle output);
+
+/* Drop the picture of a view's back buffer before the buffer is freed */
+void fade_drop(GlobalContext *gctx, WindowContext *wctx);
+
+/* Release what a shown window needed, the window picture stays */
+void fade_release(GlobalContext *gctx, WindowContext *wctx);
+
+void fade_free(GlobalContext *gctx, WindowContext *wctx);
+
+#endif /* FADE_H */
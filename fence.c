@@ -0,0 +1,55 @@
+#include <X11/Xlib.h>
+#include <X11/Xlib-xcb.h>
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "fence.h"
+
+/*
+    Non-blocking server fences.
+
+    XSync tells when the server is done with what was sent, but waits a
+    whole round trip for it, tens of milliseconds on a remote display. A
+    fence is a cheap request sent through the XCB connection under Xlib:
+    its reply comes back only after everything before it was processed,
+    and whether it has come is checked without waiting.
+*/
+
+
+void fence_send(GlobalContext *gctx, Fence *fence)
+{
+    fence_drop(gctx, fence);
+
+    fence->sequence = xcb_get_input_focus(gctx->xcb).sequence;
+    fence->pending = true;
+    xcb_flush(gctx->xcb);
+}
+
+
+bool fence_passed(GlobalContext *gctx, Fence *fence)
+{
+    if (!fence->pending)
+        return true;
+
+    // Replies are only seen once read off the connection, reading never waits here
+    XEventsQueued(gctx->display, QueuedAfterReading);
+
+    void *reply = NULL;
+    if (!xcb_poll_for_reply(gctx->xcb, fence->sequence, &reply, NULL))
+        return false;
+
+    free(reply);
+    fence->pending = false;
+    return true;
+}
+
+
+void fence_drop(GlobalContext *gctx, Fence *fence)
+{
+    if (fence->pending)
+        xcb_discard_reply(gctx->xcb, fence->sequence);
+
+    fence->pending = false;
+}
@@ -0,0 +1,15 @@
+#ifndef FENCE_H
+#define FENCE_H
+
+#include "main.h"
+
+/* Mark everything sent so far, the mark passes once the server has processed it */
+void fence_send(GlobalContext *gctx, Fence *fence);
+
+/* True if the server is past the mark or none is out, never blocks */
+bool fence_passed(GlobalContext *gctx, Fence *fence);
+
+/* Forget an outstanding mark, its reply is thrown away when it comes */
+void fence_drop(GlobalContext *gctx, Fence *fence);
+
+#endif /* FENCE_H */
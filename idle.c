@@ -0,0 +1,122 @@
+#include <X11/Xlib.h>
+#include <X11/extensions/scrnsaver.h>
+#include <X11/extensions/sync.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "main.h"
+#include "idle.h"
+
+/*
+    Idle detection.
+
+    The SYNC extension keeps an IDLETIME system counter of the milliseconds
+    since the last input. One alarm on it fires when the counter crosses
+    idle_limit: first upwards, when the user leaves, then it is turned
+    around to fire downwards, when the user is back. In between nothing
+    polls and nothing wakes up.
+
+    Servers without the counter are asked through the screen saver
+    extension instead, each query a round trip. The wait loop schedules
+    those itself, no sooner than the idle time could reach the limit.
+*/
+
+
+static void set_alarm(GlobalContext *gctx, bool idle)
+{
+    IdleContext *ctx = &gctx->idle;
+
+    // Comparison triggers with no delta fire once, then go inactive until changed
+    XSyncAlarmAttributes attributes;
+    attributes.trigger.counter = ctx->counter;
+    attributes.trigger.value_type = XSyncAbsolute;
+    XSyncIntToValue(&attributes.trigger.wait_value, (int)(gctx->config.idle_limit * 1000));
+    attributes.trigger.test_type = idle ? XSyncNegativeComparison : XSyncPositiveComparison;
+    XSyncIntToValue(&attributes.delta, 0);
+    attributes.events = True;
+
+    unsigned long mask = XSyncCACounter | XSyncCAValueType | XSyncCAValue | XSyncCATestType | XSyncCADelta | XSyncCAEvents;
+    if (ctx->alarm == None)
+        ctx->alarm = XSyncCreateAlarm(gctx->display, mask, &attributes);
+    else
+        XSyncChangeAlarm(gctx->display, ctx->alarm, mask, &attributes);
+}
+
+
+void idle_init(GlobalContext *gctx)
+{
+    IdleContext *ctx = &gctx->idle;
+    memset(ctx, 0, sizeof(*ctx));
+
+    if (!gctx->config.detect_idle)
+        return;
+
+    int error_base, major, minor;
+    if (!XSyncQueryExtension(gctx->display, &ctx->event_base, &error_base) || !XSyncInitialize(gctx->display, &major, &minor))
+    {
+        printf("No SYNC extension, polling for idleness\n");
+        return;
+    }
+
+    int count;
+    XSyncSystemCounter *counters = XSyncListSystemCounters(gctx->display, &count);
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(counters[i].name, "IDLETIME") == 0)
+        {
+            ctx->counter = counters[i].counter;
+            ctx->alarms = true;
+        }
+    }
+    if (counters)
+        XSyncFreeSystemCounterList(counters);
+
+    if (!ctx->alarms)
+    {
+        printf("No IDLETIME counter, polling for idleness\n");
+        return;
+    }
+
+    set_alarm(gctx, false);
+}
+
+
+bool idle_event(GlobalContext *gctx, XEvent *event)
+{
+    IdleContext *ctx = &gctx->idle;
+    if (!ctx->alarms || event->type != ctx->event_base + XSyncAlarmNotify)
+        return false;
+
+    XSyncAlarmNotifyEvent *notify = (XSyncAlarmNotifyEvent *)event;
+    if (notify->alarm != ctx->alarm || notify->state == XSyncAlarmDestroyed)
+        return true;
+
+    // The counter value tells the direction, whatever the alarm was last set to
+    XSyncValue limit;
+    XSyncIntToValue(&limit, (int)(gctx->config.idle_limit * 1000));
+    ctx->idle = XSyncValueGreaterOrEqual(notify->counter_value, limit);
+    ctx->alarms_fired++;
+
+    set_alarm(gctx, ctx->idle);
+    return true;
+}
+
+
+double idle_query(GlobalContext *gctx)
+{
+    XScreenSaverInfo *info = XScreenSaverAllocInfo();
+    XScreenSaverQueryInfo(gctx->display, gctx->root, info);
+    double idle = info->idle / 1000.0;
+    XFree(info);
+    return idle;
+}
+
+
+void idle_free(GlobalContext *gctx)
+{
+    IdleContext *ctx = &gctx->idle;
+
+    if (ctx->alarm != None)
+        XSyncDestroyAlarm(gctx->display, ctx->alarm);
+    ctx->alarm = None;
+}
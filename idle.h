@@ -0,0 +1,17 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+#include "main.h"
+
+/* Set an IDLETIME alarm at idle_limit if the server has one, polling is left otherwise */
+void idle_init(GlobalContext *gctx);
+
+/* Take an idle alarm event, false if the event is something else */
+bool idle_event(GlobalContext *gctx, XEvent *event);
+
+/* Seconds since the last input, a round trip */
+double idle_query(GlobalContext *gctx);
+
+void idle_free(GlobalContext *gctx);
+
+#endif /* IDLE_H */
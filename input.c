@@ -0,0 +1,287 @@
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+
+#include "main.h"
+#include "timer.h"
+#include "state.h"
+#include "loop.h"
+#include "input.h"
+
+/*
+    Input thread.
+
+    Keys are read on an X connection of their own by a thread that does
+    nothing else. Each key is translated into a state transition as soon
+    as it is read, posted to a single-producer single-consumer ring and
+    the main loop is woken through an eventfd. The main loop takes keys
+    before every frame and every wait, so a key waits for the frame being
+    drawn at most, never for other events or frames queued behind it.
+
+    Drawing stays on the main connection: the compositor waits there for
+    SHM completions and fences among the other events, and splitting it
+    over threads would race for them. Instead the work that used to hold
+    the main thread for longer than a frame gives way: fade steps, the
+    passes of the desktop blur and frames whose buffer the server still
+    reads all check input_pending and stop or are put off, so the loop
+    takes the key at once.
+
+    A key posted for a state the loop has already left is dropped. The
+    time from reading a key to its transition is measured.
+*/
+
+
+static void post(GlobalContext *gctx, KeySym key, const struct timespec *stamp)
+{
+    InputContext *input = &gctx->input;
+
+    GlobalState from = atomic_load(&input->state);
+    if (from == STATE_NONE)
+        return;
+
+    GlobalState to = state_key(&gctx->config, from, key);
+    if (to == STATE_NONE)
+        return;
+
+    unsigned head = atomic_load_explicit(&input->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&input->tail, memory_order_acquire);
+
+    // Full, the first key already ends the state
+    if (head - tail == INPUT_KEYS)
+        return;
+
+    InputKey *slot = &input->keys[head % INPUT_KEYS];
+    slot->state = to;
+    slot->from = from;
+    slot->stamp = *stamp;
+    atomic_store_explicit(&input->head, head + 1, memory_order_release);
+
+    uint64_t one = 1;
+    if (write(input->wake, &one, sizeof(one)) < 0)
+        perror("input wake");
+}
+
+
+static void *run(void *arg)
+{
+    GlobalContext *gctx = arg;
+    InputContext *input = &gctx->input;
+
+    struct pollfd fds[2] = {
+        { .fd = ConnectionNumber(input->display), .events = POLLIN },
+        { .fd = input->nudge, .events = POLLIN },
+    };
+
+    while (atomic_load(&input->running))
+    {
+        // Replies of the main thread's requests may have read keys in along
+        while (XPending(input->display))
+        {
+            XEvent event;
+            XNextEvent(input->display, &event);
+
+            if (event.type != KeyPress)
+                continue;
+
+            struct timespec stamp;
+            timer_now(&stamp);
+            post(gctx, XLookupKeysym(&event.xkey, 0), &stamp);
+        }
+
+        if (poll(fds, 2, -1) < 0 && errno != EINTR)
+        {
+            perror("input poll");
+            break;
+        }
+
+        uint64_t count;
+        if (fds[1].revents & POLLIN && read(input->nudge, &count, sizeof(count)) < 0)
+            perror("input nudge");
+    }
+
+    return NULL;
+}
+
+
+/* Wake the input thread to look at its queue or at running */
+static void nudge(InputContext *input)
+{
+    uint64_t one = 1;
+    if (write(input->nudge, &one, sizeof(one)) < 0)
+        perror("input nudge");
+}
+
+
+void input_init(GlobalContext *gctx)
+{
+    InputContext *input = &gctx->input;
+    atomic_store(&input->state, STATE_NONE);
+
+    input->display = XOpenDisplay(NULL);
+    if (!input->display)
+    {
+        printf("No second X connection, keys are read with the other events\n");
+        return;
+    }
+
+    input->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    input->nudge = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (input->wake < 0 || input->nudge < 0)
+    {
+        perror("input eventfd");
+        XCloseDisplay(input->display);
+        input->display = NULL;
+        return;
+    }
+
+    atomic_store(&input->running, true);
+    if (pthread_create(&input->thread, NULL, run, gctx) != 0)
+    {
+        perror("input thread");
+        close(input->wake);
+        close(input->nudge);
+        XCloseDisplay(input->display);
+        input->display = NULL;
+        return;
+    }
+
+    loop_watch_input(gctx, input->wake);
+    input->enabled = true;
+}
+
+
+void input_watch(GlobalContext *gctx, Window window)
+{
+    InputContext *input = &gctx->input;
+    if (!input->enabled)
+        return;
+
+    // Connections are not ordered with each other, the window must exist first
+    XSync(gctx->display, False);
+    XSelectInput(input->display, window, KeyPressMask);
+    XFlush(input->display);
+}
+
+
+long input_key_mask(GlobalContext *gctx)
+{
+    return gctx->input.enabled ? NoEventMask : KeyPressMask;
+}
+
+
+void input_expect(GlobalContext *gctx, GlobalState state)
+{
+    atomic_store(&gctx->input.state, state);
+}
+
+
+GlobalState input_take(GlobalContext *gctx, GlobalState state)
+{
+    InputContext *input = &gctx->input;
+    if (!input->enabled)
+        return STATE_NONE;
+
+    // Cleared before looking, a key posted after wakes the loop again
+    uint64_t count;
+    if (read(input->wake, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        perror("input wake");
+
+    unsigned tail = atomic_load_explicit(&input->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&input->head, memory_order_acquire);
+
+    while (tail != head)
+    {
+        InputKey key = input->keys[tail % INPUT_KEYS];
+        atomic_store_explicit(&input->tail, ++tail, memory_order_release);
+
+        if (key.from != state)
+            continue;
+
+        Timer read_at = { key.stamp };
+        double latency = timer_elapsed(&read_at);
+        input->taken++;
+        input->latency_total += latency;
+        if (latency > input->latency_max)
+            input->latency_max = latency;
+        return key.state;
+    }
+
+    return STATE_NONE;
+}
+
+
+bool input_pending(GlobalContext *gctx)
+{
+    InputContext *input = &gctx->input;
+    if (!input->enabled)
+        return false;
+
+    // Slots between tail and head are not written again until taken
+    GlobalState state = atomic_load(&input->state);
+    unsigned tail = atomic_load_explicit(&input->tail, memory_order_acquire);
+    unsigned head = atomic_load_explicit(&input->head, memory_order_acquire);
+
+    for (; tail != head; tail++)
+        if (input->keys[tail % INPUT_KEYS].from == state)
+            return true;
+    return false;
+}
+
+
+void input_grab(GlobalContext *gctx, Window window)
+{
+    InputContext *input = &gctx->input;
+    Display *display = input->enabled ? input->display : gctx->display;
+
+    XSync(gctx->display, False);
+    XGrabKeyboard(display, window, True, GrabModeAsync, GrabModeAsync, CurrentTime);
+
+    // The reply may have read keys into the queue the thread sleeps on
+    if (input->enabled)
+        nudge(input);
+}
+
+
+void input_ungrab(GlobalContext *gctx)
+{
+    InputContext *input = &gctx->input;
+    Display *display = input->enabled ? input->display : gctx->display;
+
+    XUngrabKeyboard(display, CurrentTime);
+    XFlush(display);
+}
+
+
+void input_report(GlobalContext *gctx)
+{
+    InputContext *input = &gctx->input;
+    if (!input->enabled || input->taken == 0)
+        return;
+
+    printf("Keys %lu, key to transition average %.3f ms, max %.3f ms\n",
+           input->taken, input->latency_total * 1000.0 / input->taken, input->latency_max * 1000.0);
+}
+
+
+void input_free(GlobalContext *gctx)
+{
+    InputContext *input = &gctx->input;
+    if (!input->enabled)
+        return;
+
+    atomic_store(&input->running, false);
+    nudge(input);
+    pthread_join(input->thread, NULL);
+
+    XCloseDisplay(input->display);
+    close(input->wake);
+    close(input->nudge);
+    input->enabled = false;
+}
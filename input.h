@@ -0,0 +1,35 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "main.h"
+
+/* Start the input thread on a connection of its own, keys stay on the main one if it can't open */
+void input_init(GlobalContext *gctx);
+
+/* Have keys pressed in a window of ours read by the input thread */
+void input_watch(GlobalContext *gctx, Window window);
+
+/* Event mask for keys on the main connection, none while the input thread reads them */
+long input_key_mask(GlobalContext *gctx);
+
+/* Translate keys for a state from now on, STATE_NONE to ignore them */
+void input_expect(GlobalContext *gctx, GlobalState state);
+
+/* Transition of the first key posted for state, STATE_NONE if there is none */
+GlobalState input_take(GlobalContext *gctx, GlobalState state);
+
+/* Whether a key is posted for the expected state and not yet taken, false without the input thread.
+   Safe from any thread, long work polls it to give way to the transition */
+bool input_pending(GlobalContext *gctx);
+
+/* Grab the keyboard for a window, on the connection that reads the keys */
+void input_grab(GlobalContext *gctx, Window window);
+
+void input_ungrab(GlobalContext *gctx);
+
+/* Print the key latency */
+void input_report(GlobalContext *gctx);
+
+void input_free(GlobalContext *gctx);
+
+#endif /* INPUT_H */
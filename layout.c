@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "main.h"
+#include "layout.h"
+
+/*
+    Text layout engine.
+
+    Text is split into paragraphs on newlines and greedily word wrapped
+    using word advances measured once. Each line gets its ink extents and
+    baseline, so drawing only replays positioned runs. Layouts keep their
+    own copy of the text and are recomputed only when the key changes.
+
+    Fonts are measured through the renderer that draws them, Xft on the
+    display or FreeType in the headless renderer, so both wrap alike.
+*/
+
+
+static int utf8_length(const char *s)
+{
+    unsigned char c = *s;
+    if ((c & 0xe0) == 0xc0) return 2;
+    if ((c & 0xf0) == 0xe0) return 3;
+    if ((c & 0xf8) == 0xf0) return 4;
+    return 1;
+}
+
+
+static int text_advance(const LayoutFont *font, const char *text, int length)
+{
+    XGlyphInfo extents;
+    font->extents(font->context, font->handle, text, length, &extents);
+    return extents.xOff;
+}
+
+
+static void push_line(const LayoutFont *font, TextLayout *layout, int offset, int length)
+{
+    if (layout->line_count >= LAYOUT_MAX_LINES)
+        return;
+
+    XGlyphInfo extents = {0};
+    if (length > 0)
+        font->extents(font->context, font->handle, layout->text + offset, length, &extents);
+
+    LayoutLine *line = &layout->lines[layout->line_count];
+    line->offset = offset;
+    line->length = length;
+
+    // Center the ink, not the pen advance
+    line->x = (layout->max_width - extents.width) / 2 + extents.x;
+    line->y = layout->line_count * font->height + font->ascent;
+
+    line->rect.x = line->x - extents.x;
+    line->rect.y = line->y - extents.y;
+    line->rect.width = extents.width;
+    line->rect.height = extents.height;
+
+    layout->line_count++;
+}
+
+
+static void layout_paragraph(const LayoutFont *font, TextLayout *layout, int start, int end)
+{
+    const char *s = layout->text;
+    int space = text_advance(font, " ", 1);
+
+    int line_start = -1;
+    int line_end = 0;
+    int line_width = 0;
+
+    for (int i = start; i < end; )
+    {
+        if (s[i] == ' ')
+        {
+            i++;
+            continue;
+        }
+
+        int word_end = i;
+        while (word_end < end && s[word_end] != ' ')
+            word_end++;
+
+        int word_width = text_advance(font, s + i, word_end - i);
+
+        if (line_start >= 0 && line_width + space + word_width <= layout->max_width)
+        {
+            line_width += space + word_width;
+            line_end = word_end;
+            i = word_end;
+            continue;
+        }
+
+        if (line_start >= 0)
+            push_line(font, layout, line_start, line_end - line_start);
+
+        // Break words wider than a whole line between characters
+        while (word_width > layout->max_width)
+        {
+            int cut = i;
+            int cut_width = 0;
+            while (cut < word_end)
+            {
+                int n = utf8_length(s + cut);
+                int w = text_advance(font, s + cut, n);
+                if (cut > i && cut_width + w > layout->max_width)
+                    break;
+                cut_width += w;
+                cut += n;
+            }
+
+            push_line(font, layout, i, cut - i);
+            i = cut;
+            word_width = text_advance(font, s + i, word_end - i);
+        }
+
+        line_start = i < word_end ? i : -1;
+        line_end = word_end;
+        line_width = word_width;
+        i = word_end;
+    }
+
+    if (line_start >= 0)
+        push_line(font, layout, line_start, line_end - line_start);
+    else
+        push_line(font, layout, start, 0); // Keep empty paragraphs as spacing
+}
+
+
+void layout_text(TextLayout *layout, const LayoutFont *font, const char *text, int max_width)
+{
+    // Windows narrower than their margins still get a line per character
+    if (max_width < 1)
+        max_width = 1;
+
+    if (layout->valid && layout->font == font->handle && layout->max_width == max_width && strcmp(layout->text, text) == 0)
+        return;
+
+    snprintf(layout->text, sizeof(layout->text), "%s", text);
+    layout->font = font->handle;
+    layout->max_width = max_width;
+    layout->line_count = 0;
+
+    int start = 0;
+    while (true)
+    {
+        int end = start + strcspn(layout->text + start, "\n");
+        layout_paragraph(font, layout, start, end);
+
+        if (layout->text[end] == '\0')
+            break;
+        start = end + 1;
+    }
+
+    layout->height = layout->line_count * font->height;
+    layout->valid = true;
+}
+
+
+void format_time(uint32_t seconds, char *out, size_t out_size)
+{
+    uint32_t h = seconds / 3600;
+    uint32_t m = (seconds % 3600) / 60;
+    uint32_t s = seconds % 60;
+
+    if (h > 0) {
+        // hh:mm:ss
+        snprintf(out, out_size, "%02u:%02u:%02u", h, m, s);
+    } else {
+        // mm:ss
+        snprintf(out, out_size, "%02u:%02u", m, s);
+    }
+}
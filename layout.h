@@ -0,0 +1,12 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include "main.h"
+
+/*
+    Wrap text into centered lines no wider than max_width.
+    Does nothing if the layout already holds the same text, font and width.
+*/
+void layout_text(TextLayout *layout, const LayoutFont *font, const char *text, int max_width);
+
+#endif /* LAYOUT_H */
@@ -0,0 +1,312 @@
+#include <X11/Xlib.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+
+#include "main.h"
+#include "timer.h"
+#include "loop.h"
+
+/*
+    Event loop of every state.
+
+    One epoll set watches the X connection, a timerfd and a signalfd. The
+    timer is armed at an absolute point of the monotonic clock, the one
+    Timer reads, so a wait ends exactly at its deadline however often X
+    events interrupt it. Quit signals are blocked and read from the
+    signalfd, so they are handled in the loop like any other event
+    instead of interrupting whatever runs. Keys read by the input thread
+    wake it through an eventfd.
+
+    Queued X events are taken in batches. Runs of pointer motion and of
+    exposures are coalesced within a batch, a later motion replacing the
+    one right before it and back to back exposures of a window merging
+    into one rectangle; any other event in between keeps them apart. The deadline is
+    checked before every batch, so a flood of input can delay a frame by
+    one batch at most, never starve it.
+
+    Events a state leaves unhandled when it ends stay in the batch for the
+    next one, and waits for a single event look there before the queue.
+    Generic event data is claimed as events are read, since reading the
+    next event frees whatever was left unclaimed.
+*/
+
+
+static void watch(EventLoop *loop, int fd)
+{
+    struct epoll_event event = { .events = EPOLLIN, .data.fd = fd };
+    if (epoll_ctl(loop->epoll, EPOLL_CTL_ADD, fd, &event) != 0)
+    {
+        perror("epoll_ctl");
+        exit(1);
+    }
+}
+
+
+static void arm(EventLoop *loop, const Timer *timer, double at)
+{
+    struct itimerspec spec = {0};
+
+    // A zero value disarms
+    if (isfinite(at))
+    {
+        double whole = floor(at);
+        spec.it_value.tv_sec = timer->start.tv_sec + (time_t)whole;
+        spec.it_value.tv_nsec = timer->start.tv_nsec + (long)((at - whole) * 1e9);
+        if (spec.it_value.tv_nsec >= 1000000000L)
+        {
+            spec.it_value.tv_sec++;
+            spec.it_value.tv_nsec -= 1000000000L;
+        }
+    }
+
+    timerfd_settime(loop->timer, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+
+/* Fold an event into the last one of the batch if it only updates it, anything else in between keeps the order */
+static bool coalesce(EventLoop *loop, const XEvent *event)
+{
+    if (loop->batch_count == 0)
+        return false;
+
+    XEvent *queued = &loop->batch[loop->batch_count - 1];
+    if (queued->type != event->type || queued->xany.window != event->xany.window)
+        return false;
+
+    if (event->type == MotionNotify)
+    {
+        *queued = *event;
+        return true;
+    }
+
+    XExposeEvent *into = &queued->xexpose;
+    const XExposeEvent *from = &event->xexpose;
+
+    int x1 = into->x < from->x ? into->x : from->x;
+    int y1 = into->y < from->y ? into->y : from->y;
+    int x2 = into->x + into->width > from->x + from->width ? into->x + into->width : from->x + from->width;
+    int y2 = into->y + into->height > from->y + from->height ? into->y + into->height : from->y + from->height;
+
+    into->x = x1;
+    into->y = y1;
+    into->width = x2 - x1;
+    into->height = y2 - y1;
+    into->count = 0;
+    return true;
+}
+
+
+static void release(GlobalContext *gctx, XEvent *event)
+{
+    if (event->type == GenericEvent && event->xcookie.data)
+    {
+        XFreeEventData(gctx->display, &event->xcookie);
+        event->xcookie.data = NULL;
+    }
+}
+
+
+/* Take what is queued, up to one batch, once the last one is handled */
+static void drain(GlobalContext *gctx)
+{
+    EventLoop *loop = &gctx->loop;
+
+    for (int i = 0; i < loop->batch_count; i++)
+        release(gctx, &loop->batch[i]);
+
+    int depth = XEventsQueued(gctx->display, QueuedAlready);
+    if (depth > loop->max_depth)
+        loop->max_depth = depth;
+
+    loop->batch_count = 0;
+    loop->batch_next = 0;
+    loop->batches++;
+
+    for (int i = 0; i < depth && loop->batch_count < LOOP_BATCH; i++)
+    {
+        XEvent event;
+        XNextEvent(gctx->display, &event);
+        loop->events++;
+
+        if (event.type == GenericEvent)
+            XGetEventData(gctx->display, &event.xcookie);
+
+        if ((event.type == MotionNotify || event.type == Expose) && coalesce(loop, &event))
+        {
+            loop->coalesced++;
+            continue;
+        }
+
+        loop->batch[loop->batch_count++] = event;
+    }
+}
+
+
+void loop_init(GlobalContext *gctx)
+{
+    EventLoop *loop = &gctx->loop;
+
+    // Blocked before any thread starts, so every thread inherits the mask
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+
+    loop->epoll = epoll_create1(EPOLL_CLOEXEC);
+    loop->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    loop->signals = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (loop->epoll < 0 || loop->timer < 0 || loop->signals < 0)
+    {
+        perror("event loop");
+        exit(1);
+    }
+
+    watch(loop, ConnectionNumber(gctx->display));
+    watch(loop, loop->timer);
+    watch(loop, loop->signals);
+    loop->input = -1;
+}
+
+
+void loop_watch_input(GlobalContext *gctx, int fd)
+{
+    watch(&gctx->loop, fd);
+    gctx->loop.input = fd;
+}
+
+
+LoopWake loop_wait(GlobalContext *gctx, const Timer *timer, double at)
+{
+    EventLoop *loop = &gctx->loop;
+
+    // A passed deadline goes before any input
+    double elapsed = timer_elapsed(timer);
+    if (elapsed >= at)
+    {
+        timer_record(elapsed - at);
+        return LOOP_TIMEOUT;
+    }
+
+    // Left over by a state that ended in the middle of the batch
+    if (loop->batch_next < loop->batch_count)
+        return LOOP_EVENT;
+
+    arm(loop, timer, at);
+
+    while (true)
+    {
+        // Events read off the connection along with replies wake nothing, check the queue first
+        if (XPending(gctx->display))
+        {
+            drain(gctx);
+            return LOOP_EVENT;
+        }
+
+        struct epoll_event ready[4];
+        int count = epoll_wait(loop->epoll, ready, 4, -1);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            return LOOP_ERROR;
+        }
+
+        bool expired = false;
+        for (int i = 0; i < count; i++)
+        {
+            int fd = ready[i].data.fd;
+
+            if (fd == loop->signals)
+            {
+                struct signalfd_siginfo info;
+                if (read(fd, &info, sizeof(info)) == sizeof(info))
+                {
+                    loop->signal = info.ssi_signo;
+                    return LOOP_SIGNAL;
+                }
+            }
+            else if (fd == loop->input)
+            {
+                // Read by whoever takes the keys
+                return LOOP_INPUT;
+            }
+            else if (fd == loop->timer)
+            {
+                uint64_t expirations;
+                expired |= read(fd, &expirations, sizeof(expirations)) == sizeof(expirations);
+            }
+        }
+
+        // The X connection needs nothing here, XPending reads it
+        if (expired)
+        {
+            timer_record(timer_elapsed(timer) - at);
+            return LOOP_TIMEOUT;
+        }
+    }
+}
+
+
+XEvent *loop_event(GlobalContext *gctx)
+{
+    EventLoop *loop = &gctx->loop;
+    if (loop->batch_next == loop->batch_count)
+        return NULL;
+    return &loop->batch[loop->batch_next++];
+}
+
+
+bool loop_claim(GlobalContext *gctx, Bool (*predicate)(Display *, XEvent *, XPointer), XPointer arg, XEvent *event)
+{
+    EventLoop *loop = &gctx->loop;
+
+    for (int i = loop->batch_next; i < loop->batch_count; i++)
+    {
+        if (!predicate(gctx->display, &loop->batch[i], arg))
+            continue;
+
+        *event = loop->batch[i];
+        loop->batch_count--;
+        memmove(&loop->batch[i], &loop->batch[i + 1], (loop->batch_count - i) * sizeof(XEvent));
+        return true;
+    }
+
+    // Not read yet
+    XIfEvent(gctx->display, event, predicate, arg);
+    return false;
+}
+
+
+void loop_report(GlobalContext *gctx)
+{
+    EventLoop *loop = &gctx->loop;
+    if (loop->batches == 0)
+        return;
+
+    printf("Events %lu in %lu batches, %lu coalesced, queue depth max %d\n",
+           loop->events, loop->batches, loop->coalesced, loop->max_depth);
+}
+
+
+void loop_free(GlobalContext *gctx)
+{
+    EventLoop *loop = &gctx->loop;
+
+    for (int i = 0; i < loop->batch_count; i++)
+        release(gctx, &loop->batch[i]);
+
+    close(loop->signals);
+    close(loop->timer);
+    close(loop->epoll);
+}
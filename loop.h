@@ -0,0 +1,29 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include "main.h"
+#include "timer.h"
+
+/* Watch the X connection, a deadline timer and the quit signals, which are blocked from now on */
+void loop_init(GlobalContext *gctx);
+
+/* Wake the loop when fd, the eventfd of the input thread, becomes readable */
+void loop_watch_input(GlobalContext *gctx, int fd);
+
+/* Wait for X events, a signal, or the deadline at seconds after the timer start, INFINITY for none.
+   Events come as one coalesced batch, taken with loop_event */
+LoopWake loop_wait(GlobalContext *gctx, const Timer *timer, double at);
+
+/* Next event of the batch, NULL once all are handled; the rest stays for the next state */
+XEvent *loop_event(GlobalContext *gctx);
+
+/* Take the first event matching predicate out of the batch, or block for it on the queue like XIfEvent.
+   True if it was in the batch */
+bool loop_claim(GlobalContext *gctx, Bool (*predicate)(Display *, XEvent *, XPointer), XPointer arg, XEvent *event);
+
+/* Print the event counters */
+void loop_report(GlobalContext *gctx);
+
+void loop_free(GlobalContext *gctx);
+
+#endif /* LOOP_H */
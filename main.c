@@ -1,24 +1,42 @@
 #include <X11/Xlib.h>
+#include <X11/Xlib-xcb.h>
 #include <X11/Xutil.h>
 #include <X11/Xft/Xft.h>
 #include <X11/keysym.h>
-#include <X11/extensions/scrnsaver.h>
+#include <X11/extensions/XShm.h>
+#include <xcb/xcbext.h>
 #include <pthread.h>
-#include <ao/ao.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
-#include <assert.h>
-#include <ctype.h>
 #include <math.h>
 #include <time.h>
-#include <poll.h>
 #include <stdbool.h>
 
 #include "main.h"
+#include "config.h"
 #include "timer.h"
+#include "scene.h"
+#include "atlas.h"
+#include "shm.h"
+#include "present.h"
+#include "output.h"
+#include "background.h"
+#include "snapshot.h"
+#include "fade.h"
+#include "breath.h"
+#include "loop.h"
+#include "idle.h"
+#include "schedule.h"
+#include "state.h"
+#include "input.h"
+#include "activity.h"
+#include "audio.h"
+#include "wait.h"
+
+#define PREPARE_TIME 2 // Seconds before a break to prepare its overlay
 
 /*
     To Do:
@@ -45,577 +63,170 @@
     - Feature: System notification instead of warning?
     - Feature: Tray icon
     - Feature: Quit from end screen
-    - Refactor: Separate audio.c, audio.h
+    X Refactor: Separate audio.c, audio.h
     - Refactor: Function names, 
     - Refactor: Classes?
     - Managed / unmanaged?
 */
 
-static void load_defaults(Config *config)
-{
-    strcpy(config->break_title_text, "Break time!");
-    strcpy(config->break_message_text, "Rest your eyes. Stretch your legs. Breathe. Relax.");
-    strcpy(config->break_hint_text, "s - stop, q - quit");
-
-    strcpy(config->warning_message_text, "Please, take a break!");
-    strcpy(config->warning_hint_text, "space - start, w - snooze, s - skip, q - quit");
-
-    strcpy(config->end_title_text, "Break has ended!");
-    strcpy(config->end_message_text, "Work fruitfully. Concentrate on important. Don't get distracted.");
-    strcpy(config->end_hint_text, "press any key to continue...");
-
-    config->warning_enabled = true;
-    config->skip_enabled = true;
-    config->snooze_enabled = true;
-    config->stop_enabled = true;
-    config->end_enabled = true;
-    config->hints_enabled = true;
-    config->time_enabled = true;
-    config->sound_enabled = true;
-    config->block_input = false;
-
-    config->timer_duration = 28 * 60;
-    config->break_duration = 5 * 60;
-    config->warning_duration = 60;
-    config->snooze_duration = 60;
-
-    config->repeat = true;
-
-    config->detect_idle = true;
-    config->idle_limit = 5 * 60;
-
-    strcpy(config->font_color, "#ffffff");
-    strcpy(config->hint_font_color, "#aaaaaa");
-    strcpy(config->background_font_color, "#222222");
-    strcpy(config->background_color, "#000000");
-    strcpy(config->progress_color, "#161616");
-    strcpy(config->border_color, "#333333");
-
-    strcpy(config->font_name, "monospace");
-
-    config->title_font_size = 14;
-    config->title_font_weight = 300;
-    config->title_font_slant = 0;
-    strcpy(config->title_font_style, "regular");
-
-    config->message_font_size = 12;
-    config->message_font_weight = 200;
-    config->message_font_slant = 0;
-    strcpy(config->message_font_style, "regular");
-
-    config->hint_font_size = 10;
-    config->hint_font_weight = 100;
-    config->hint_font_slant = 100;
-    strcpy(config->hint_font_style, "regular");
-
-    config->time_font_size = 128;
-    config->time_font_weight = 300;
-    config->time_font_slant = 0;
-    strcpy(config->time_font_style, "regular");
-
-    config->warning_width = 320; // pt
-    config->warning_height = 96; // pt
-    config->border_width = 0; // px
-    config->progress_weight = 16;
-    config->margin = 12;
-
-    config->fps = 60;
-
-    strcpy(config->start_sound_path, "sounds/start.wav");
-    strcpy(config->end_sound_path, "sounds/end.wav");
-    config->volume = 0.8;
-}
-
-
-static void load_dev(Config *config)
-{
-    config->timer_duration = 1;
-    // config->break_duration = 3;
-    // config->warning_duration = 3;
-    config->snooze_duration = 3;
-    // config->warning_enabled = false;
-    // config->end_enabled = false;
-    // config->repeat = false;
-}
-
-
-static void get_config_folder(char *buffer, size_t length)
+static void die(const char *msg)
 {
-    const char *xdg = getenv("XDG_CONFIG_HOME");
-    const char *home = getenv("HOME");
-
-    if (xdg)
-        snprintf(buffer, length, "%s/xrest/", xdg);
-    else if (home)
-        snprintf(buffer, length, "%s/.config/xrest/", home);
-    else
-        snprintf(buffer, length, "./");
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
 }
 
 
-static void get_config_file(char *buffer, size_t length)
+typedef struct
 {
-    get_config_folder(buffer, length);
-    strcat(buffer, "config.ini");
-}
+    const char *name;
+    XColor *out;
+} ColorRequest;
 
 
-void trim(char* str) 
+/* Every allocation is sent before the first reply is read, one round trip for all */
+static void load_colors(GlobalContext *gctx, const ColorRequest *colors, int count)
 {
-    char* start = str;
-    while (isspace((unsigned char)*start)) start++;
-    memmove(str, start, strlen(start) + 1);
+    xcb_alloc_color_cookie_t rgb[count];
+    xcb_alloc_named_color_cookie_t named[count];
 
-    char* end = str + strlen(str) - 1;
-    while (end > str && isspace((unsigned char)*end)) *end-- = '\0';
-}
-
-
-int parse_duration(const char *str) 
-{
-    int total = 0;
-    int value = 0;
+    for (int i = 0; i < count; i++)
+    {
+        const char *name = colors[i].name;
+        XColor *out = colors[i].out;
 
-    while (*str) {
-        if (isdigit((unsigned char)*str)) 
+        // #rrggbb is parsed locally, names are looked up by the server
+        if (name[0] == '#')
         {
-            value = value * 10 + (*str - '0');
-        } 
-        else 
+            if (!XParseColor(gctx->display, gctx->colormap, name, out))
+                die("Failed to load color!\n");
+            rgb[i] = xcb_alloc_color(gctx->xcb, gctx->colormap, out->red, out->green, out->blue);
+        }
+        else
         {
-            if (*str == 'h') 
-            {
-                total += value * 3600;
-                value = 0;
-            } else if (*str == 'm') 
-            {
-                total += value * 60;
-                value = 0;
-            } else if (*str == 's') 
-            {
-                total += value;
-                value = 0;
-            }
+            named[i] = xcb_alloc_named_color(gctx->xcb, gctx->colormap, strlen(name), name);
         }
-        str++;
     }
 
-    return total;
-}
-
-
-unsigned int parse_color(const char *str) 
-{
-    if (*str == '#')
-        str++;  // skip '#'
-
-    return (unsigned int)strtoul(str, NULL, 16);
-}
-
-
-static void parse_string(char *dst, size_t dst_size, const char *src)
-{
-    // Skip leading whitespace
-    while (isspace((unsigned char)*src))
-        src++;
-
-    size_t i = 0;
+    for (int i = 0; i < count; i++)
+    {
+        XColor *out = colors[i].out;
+        xcb_generic_error_t *error = NULL;
 
-    if (*src == '"') {
-        // Quoted string
-        src++; // skip opening quote
-        while (*src && *src != '"' && i + 1 < dst_size) {
-            dst[i++] = *src++;
+        if (colors[i].name[0] == '#')
+        {
+            xcb_alloc_color_reply_t *reply = xcb_alloc_color_reply(gctx->xcb, rgb[i], &error);
+            if (!reply)
+                die("Failed to load color!\n");
+            out->pixel = reply->pixel;
+            out->red = reply->red;
+            out->green = reply->green;
+            out->blue = reply->blue;
+            free(reply);
         }
-    } else {
-        // Single-word string
-        while (*src && !isspace((unsigned char)*src) && i + 1 < dst_size) {
-            dst[i++] = *src++;
+        else
+        {
+            xcb_alloc_named_color_reply_t *reply = xcb_alloc_named_color_reply(gctx->xcb, named[i], &error);
+            if (!reply)
+                die("Failed to load color!\n");
+            out->pixel = reply->pixel;
+            out->red = reply->visual_red;
+            out->green = reply->visual_green;
+            out->blue = reply->visual_blue;
+            free(reply);
         }
-    }
 
-    dst[i] = '\0';
+        out->flags = DoRed | DoGreen | DoBlue;
+
+        // Opaque in an ARGB visual
+        out->pixel |= gctx->alpha_mask;
+    }
 }
 
 
-static void load_config(Config *config)
+static void load_xft_color(GlobalContext *gctx, const char *name, XftColor *out)
 {
-    char path[512];
-    get_config_file(path, sizeof(path));
-
-    FILE *f = fopen(path, "r");
-    if (!f)
-        return;
-
-    char line[512];
-    while (fgets(line, sizeof(line), f)) 
+    if (!XftColorAllocName(gctx->display, gctx->visual, gctx->colormap, name, out))
     {
-        if (line[0] == '#' || line[0] == '\n' || line[0] == '\0')
-            continue;
-
-        char* delimeter = strchr(line, '=');
-        if (!delimeter) continue;
-
-        *delimeter = '\0';
-        char* key = line;
-        char* value = delimeter + 1;
-        trim(key); trim(value);
-
-        #define SET_INT(field) \
-            if (strcmp(key, #field) == 0) \
-                config->field = atoi(value);
-        
-        #define SET_FLOAT(field) \
-            if (strcmp(key, #field) == 0) \
-                config->field = atof(value);
-
-        #define SET_STRING(field) \
-            if (strcmp(key, #field) == 0) \
-                parse_string(config->field, sizeof(config->field), value);
-        
-        #define SET_BOOL(field) \
-            if (strcmp(key, #field) == 0) \
-                config->field = strcmp(value, "true") == 0;
-        
-        #define SET_DURATION(field) \
-            if (strcmp(key, #field) == 0) \
-                config->field = parse_duration(value);
-        
-        #define SET_COLOR(field) \
-            if (strcmp(key, #field) == 0) \
-                config->field = parse_color(value);
-
-        SET_STRING(break_title_text);
-        SET_STRING(break_message_text);
-        SET_STRING(break_hint_text);
-
-        SET_STRING(warning_message_text);
-        SET_STRING(warning_hint_text);
-
-        SET_STRING(end_title_text);
-        SET_STRING(end_message_text);
-        SET_STRING(end_hint_text);
-
-        SET_BOOL(warning_enabled);
-        SET_BOOL(skip_enabled);
-        SET_BOOL(snooze_enabled);
-        SET_BOOL(stop_enabled);
-        SET_BOOL(end_enabled);
-        SET_BOOL(hints_enabled);
-        SET_BOOL(time_enabled);
-        SET_BOOL(sound_enabled);
-        SET_BOOL(block_input);
-
-
-        SET_DURATION(timer_duration);
-        SET_DURATION(break_duration);
-        SET_DURATION(warning_duration);
-        SET_DURATION(snooze_duration);
-
-        SET_BOOL(repeat);
-
-        SET_BOOL(detect_idle);
-        SET_DURATION(idle_limit);
-
-        SET_STRING(font_color);
-        SET_STRING(hint_font_color);
-        SET_STRING(background_font_color);
-        SET_STRING(background_color);
-        SET_STRING(progress_color);
-        SET_STRING(border_color);
-
-        SET_STRING(font_name);
-
-        SET_INT(title_font_size);
-        SET_INT(title_font_weight);
-        SET_INT(title_font_slant);
-        SET_STRING(title_font_style);
-
-        SET_INT(message_font_size);
-        SET_INT(message_font_weight);
-        SET_INT(message_font_slant);
-        SET_STRING(message_font_style);
-
-        SET_INT(hint_font_size);
-        SET_INT(hint_font_weight);
-        SET_INT(hint_font_slant);
-        SET_STRING(hint_font_style);
-
-        SET_INT(time_font_size);
-        SET_INT(time_font_weight);
-        SET_INT(time_font_slant);
-        SET_STRING(time_font_style);
-
-        SET_INT(warning_width);
-        SET_INT(warning_height);
-        SET_INT(border_width);
-        SET_INT(progress_weight);
-        SET_INT(margin);
-
-        SET_INT(fps);
-
-        SET_STRING(start_sound_path);
-        SET_STRING(end_sound_path);
-        SET_FLOAT(volume);
+        die("Failed to load xft color!\n");
     }
-    fclose(f);
 }
 
 
-char *get_font_string(const char *font_name, uint font_size, const char *font_style, uint font_weight, uint font_slant)
+static XftFont *load_xft_font(GlobalContext *gctx, const char *family, int size, char *style, int weight, int slant)
 {
-    char *fstring = "%s:style=%s:size=%u:weight=%d:slant=%d";
-    int size = snprintf(NULL, 0, fstring, font_name, font_style, font_size, font_weight, font_slant);
-    char *string = malloc(size + 1);
-    assert(string);
-    snprintf(string, size + 1, fstring, font_name, font_style, font_size, font_weight, font_slant);
-    return string;
-}
-
+    char *font_str = get_font_string(family, size, style, weight, slant);
+    XftFont *font = XftFontOpenName(gctx->display, gctx->screen, font_str);
 
-static void apply_volume(char *buf, size_t bytes, int bits, float volume)
-{
-    if (volume == 1.0f) return;
+    if (!font)
+        die("Failed to load xft font!");
 
-    if (bits == 8) 
-    {
-        // 8-bit PCM is unsigned
-        for (size_t i = 0; i < bytes; i++) 
-        {
-            int s = (unsigned char)buf[i] - 128;
-            s = (int)(s * volume);
-            if (s > 127) s = 127;
-            if (s < -128) s = -128;
-            buf[i] = (char)(s + 128);
-        }
-    }
-    else if (bits == 16) 
-    {
-        // 16-bit PCM is signed little-endian
-        int16_t *p = (int16_t*)buf;
-        size_t samples = bytes / 2;
-        for (size_t i = 0; i < samples; i++) 
-        {
-            int v = (int)(p[i] * volume);
-            if (v > 32767) v = 32767;
-            if (v < -32768) v = -32768;
-            p[i] = (int16_t)v;
-        }
-    }
+    return font;
 }
 
 
-int play_wav(const char *path, float volume)
+/* Take the answer to the focus query, waiting for it only if asked to */
+static void collect_focus(GlobalContext *gctx, bool wait)
 {
-    FILE *f = fopen(path, "rb");
-    if (!f)
-    {
-        printf("Sound file is not available!\n");
-        return -1;
-    }
-
-    WavHeader h;
-    if (fread(&h, sizeof(h), 1, f) != 1) 
-    {
-        fclose(f);
-        return -1;
-    }
-
-    if (memcmp(h.riff, "RIFF", 4) ||
-        memcmp(h.wave, "WAVE", 4) ||
-        memcmp(h.fmt,  "fmt ", 4) ||
-        h.audio_format != 1) // must be PCM
-    {
-        fclose(f);
-        return -1;
-    }
+    if (!gctx->focus_pending)
+        return;
 
-    // Skip extra fmt bytes if present
-    if (h.fmt_len > 16) 
+    xcb_get_input_focus_reply_t *reply = NULL;
+    if (wait)
     {
-        fseek(f, h.fmt_len - 16, SEEK_CUR);
+        reply = xcb_get_input_focus_reply(gctx->xcb, gctx->focus_query, NULL);
     }
-
-    // Locate the "data" chunk
-    char tag[4];
-    uint32_t chunk_size = 0;
-
-    while (fread(tag, 1, 4, f) == 4) 
+    else
     {
-        fread(&chunk_size, 4, 1, f);
-
-        if (!memcmp(tag, "data", 4)) {
-            break;
+        XEventsQueued(gctx->display, QueuedAfterReading);
+        if (!xcb_poll_for_reply(gctx->xcb, gctx->focus_query.sequence, (void **)&reply, NULL))
+        {
+            // Overtaken by a newer query
+            xcb_discard_reply(gctx->xcb, gctx->focus_query.sequence);
         }
-        // Skip unknown chunks
-        fseek(f, chunk_size, SEEK_CUR);
-    }
-
-    uint32_t data_size = chunk_size;
-    uint32_t remaining = data_size;
-
-    // Initialize libao
-    ao_initialize();
-    int driver = ao_default_driver_id();
-
-    ao_sample_format fmt = {
-        .bits        = h.bits_per_sample,
-        .channels    = h.num_channels,
-        .rate        = h.sample_rate,
-        .byte_format = AO_FMT_LITTLE
-    };
-
-    ao_device *dev = ao_open_live(driver, &fmt, NULL);
-    if (!dev) 
-    {
-        ao_shutdown();
-        fclose(f);
-        return -1;
     }
+    gctx->focus_pending = false;
 
-    // Streaming loop
-    const size_t buf_size = 4096;
-    char *buffer = malloc(buf_size);
-    if (!buffer) 
-    {
-        ao_close(dev);
-        ao_shutdown();
-        fclose(f);
-        return -1;
-    }
+    if (!reply)
+        return;
 
-    while (remaining > 0) 
+    // Our own windows are never given the focus back
+    if (reply->focus != gctx->pool.warning.window && reply->focus != gctx->pool.overlay[0].window)
     {
-        size_t to_read = remaining < buf_size ? remaining : buf_size;
-        size_t read = fread(buffer, 1, to_read, f);
-        if (read == 0) break;
-
-        // Trim to full frames (block-aligned)
-        read -= read % h.block_align;
-        if (read == 0) break;
-
-        // Apply volume
-        apply_volume(buffer, read, h.bits_per_sample, volume);
-
-        ao_play(dev, buffer, read);
-        remaining -= read;
-    }
-
-    // Clean up
-    free(buffer);
-    ao_close(dev);
-    ao_shutdown();
-    fclose(f);
-
-    return 0;
-}
-
-
-static void play_sine()
-{
-    ao_initialize();
-
-    int driver = ao_default_driver_id();
-
-    ao_sample_format format = {
-        .bits = 16,
-        .channels = 1,
-        .rate = 44100,
-        .byte_format = AO_FMT_LITTLE
-    };
-
-    ao_device *device = ao_open_live(driver, &format, NULL);
-    if (!device) return;
-
-    short buf[44100];
-    for (int i = 0; i < 44100; i++) {
-        buf[i] = (short)(sin(2 * M_PI * 440 * i / 44100.0) * 30000);
+        gctx->last_focus = reply->focus;
+        gctx->revert_to = reply->revert_to;
     }
-
-    ao_play(device, (char*)buf, sizeof(buf));
-
-    ao_close(device);
-    ao_shutdown();
-}
-
-
-typedef struct 
-{
-    char *path;
-    float volume;
-} PlayJob;
-
-
-static void *play_thread(void *arg)
-{
-    PlayJob *job = (PlayJob*)arg;
-    play_wav(job->path, job->volume);
-    free(job->path);
-    free(job);
-    return NULL;
+    free(reply);
 }
 
 
-int play_wav_async(const char *path, float volume)
+/* Ask who has the focus before we take it, the answer is collected when it is given back */
+static void query_focus(GlobalContext *gctx)
 {
-    PlayJob *job = malloc(sizeof(PlayJob));
-    job->path = strdup(path);
-    job->volume = volume;
-
-    pthread_t t;
-    pthread_create(&t, NULL, play_thread, job);
-    pthread_detach(t);
-
-    return 0;
-}
-
-
-double pt_to_px(double pt, double dpi)
-{
-    return pt * dpi / 72.0;
+    collect_focus(gctx, false);
+    gctx->focus_query = xcb_get_input_focus(gctx->xcb);
+    gctx->focus_pending = true;
 }
 
 
-static void die(const char *msg)
-{
-    fprintf(stderr, "%s\n", msg);
-    exit(1);
-}
-
-
-static void load_color(GlobalContext *gctx, const char *name, XColor *out)
-{
-    if (!XParseColor(gctx->display, gctx->colormap, name, out) ||
-        !XAllocColor(gctx->display, gctx->colormap, out))
-    {
-        die("Failed to load color!\n");
-    }
-}
-
-
-static void load_xft_color(GlobalContext *gctx, const char *name, XftColor *out)
+static void set_input_focus(GlobalContext *gctx, Window window)
 {
-    if (!XftColorAllocName(gctx->display, gctx->visual, gctx->colormap, name, out))
-    {
-        die("Failed to load xft color!\n");
-    }
+    query_focus(gctx);
+    XSetInputFocus(gctx->display, window, RevertToNone, CurrentTime);      
 }
 
 
-static XftFont *load_xft_font(GlobalContext *gctx, const char *family, int size, char *style, int weight, int slant)
+static void restore_focus(GlobalContext *gctx)
 {
-    char *font_str = get_font_string(family, size, style, weight, slant);
-    XftFont *font = XftFontOpenName(gctx->display, gctx->screen, font_str);
-
-    if (!font)
-        die("Failed to load xft font!");
-
-    return font;
+    collect_focus(gctx, true);
+    XSetInputFocus(gctx->display, gctx->last_focus, RevertToNone, CurrentTime);
 }
 
 
 static void init(GlobalContext *gctx)
 {
+    // The input thread's connection is also used from this one, for grabs
+    XInitThreads();
+
     gctx->display = XOpenDisplay(NULL);
     if (!gctx->display)
         die("Can't open display\n");
@@ -626,22 +237,35 @@ static void init(GlobalContext *gctx)
     gctx->visual = DefaultVisual(gctx->display, gctx->screen);
     gctx->colormap = DefaultColormap(gctx->display, gctx->screen);
 
-    gctx->screen_width  = DisplayWidth(gctx->display, gctx->screen);
-    gctx->screen_height = DisplayHeight(gctx->display, gctx->screen);
+    // Requests whose replies can wait go out through XCB and are collected late
+    gctx->xcb = XGetXCBConnection(gctx->display);
+    fade_query(gctx);
+
+    loop_init(gctx);
+    input_init(gctx);
+    audio_init(gctx);
+    idle_init(gctx);
+    activity_init(gctx);
+    schedule_init(gctx);
+
+    /* --- OUTPUTS --- */
+    output_init(gctx);
 
     gctx->frame_time = 1.0d / gctx->config.fps;
 
-    /*
-    // Possible transparency
-    if (XMatchVisualInfo(gctx->display, gctx->screen, 32, TrueColor, &gctx->vinfo)) 
-    {
-        gctx->depth = 32;
-        gctx->visual = gctx->vinfo.visual;
-        gctx->colormap = XCreateColormap(
-            gctx->display, gctx->root, gctx->visual, AllocNone
-        );
-    }
-    */
+    /* --- TRANSPARENCY --- */
+    // ARGB visual when a compositing manager runs, before anything depends on the depth
+    fade_init(gctx);
+
+    /* --- PRESENTATION --- */
+    // Low-memory mode has no full-size back buffer to present or share
+    if (gctx->config.present_enabled && !gctx->config.low_memory)
+        present_init(gctx);
+
+    // Present flips server-side pixmaps, so it takes precedence over SHM
+    gctx->shm = !gctx->present.enabled && !gctx->config.low_memory && gctx->config.shm_enabled && shm_supported(gctx->display, gctx->visual, gctx->depth);
+    if (gctx->shm)
+        gctx->shm_completion = XShmGetEventBase(gctx->display) + ShmCompletion;
 
     /* --- DPI --- */
     const char *xft_dpi = XGetDefault(gctx->display, "Xft", "dpi");
@@ -651,9 +275,16 @@ static void init(GlobalContext *gctx)
     load_xft_color(gctx, gctx->config.font_color, &gctx->font_color);
     load_xft_color(gctx, gctx->config.hint_font_color, &gctx->hint_font_color);
     load_xft_color(gctx, gctx->config.background_font_color, &gctx->background_font_color);
-    load_color(gctx, gctx->config.background_color, &gctx->background_color);
-    load_color(gctx, gctx->config.border_color, &gctx->border_color);
-    load_color(gctx, gctx->config.progress_color, &gctx->progress_color); 
+    ColorRequest colors[] = {
+        { gctx->config.background_color, &gctx->background_color },
+        { gctx->config.border_color, &gctx->border_color },
+        { gctx->config.progress_color, &gctx->progress_color },
+    };
+    load_colors(gctx, colors, sizeof(colors) / sizeof(colors[0]));
+
+    /* --- BACKGROUND --- */
+    background_init(gctx);
+    snapshot_init(gctx);
 
     /* ---- FONTS ---- */
     gctx->title_font = load_xft_font(gctx, gctx->config.font_name, gctx->config.title_font_size, gctx->config.title_font_style, gctx->config.title_font_weight, gctx->config.title_font_slant);
@@ -666,250 +297,360 @@ static void init(GlobalContext *gctx)
 
     gctx->time_font = load_xft_font(gctx, gctx->config.font_name, gctx->config.time_font_size, gctx->config.time_font_style, gctx->config.time_font_weight, gctx->config.time_font_slant);
 
+    /* ---- GLYPH ATLASES ---- */
+    if (gctx->config.time_enabled)
+        atlas_build(gctx->display, gctx->root, &gctx->time_atlas, gctx->time_font, "0123456789:");
+
+    if (strchr(gctx->config.warning_message_text, '%'))
+    {
+        char charset[512];
+        snprintf(charset, sizeof(charset), "0123456789%s", gctx->config.warning_message_text);
+        atlas_build(gctx->display, gctx->root, &gctx->warning_atlas, gctx->warning_font, charset);
+    }
+
+    /* ---- BREATHING RINGS ---- */
+    breath_init(gctx);
+
     /* ---- FOCUS ---- */
-    XGetInputFocus(gctx->display, &gctx->last_focus, &gctx->revert_to);
+    query_focus(gctx);
 }
 
 
-static WindowContext spawn_window(GlobalContext *gctx, uint width, uint height, int x, int y, int border, XColor *background_color, bool override_redirect)
+static void create_buffer(GlobalContext *gctx, WindowContext *wctx, uint width, uint height)
 {
-    WindowContext wctx;
+    wctx->image = NULL;
+    wctx->shm_pending = 0;
+    wctx->draw_buffer = None;
+    wctx->draw_context = NULL;
+    wctx->scratch = None;
+    wctx->scratch_context = NULL;
+    wctx->scratch_width = 0;
+    wctx->scratch_height = 0;
+
+    // Low-memory mode draws on the window through a small scratch buffer instead
+    bool full_buffer = !gctx->config.low_memory;
+
+    // Prefer a shared-memory image, fall back to a server-side pixmap (e.g. remote display)
+    if (full_buffer && (!gctx->shm || !shm_create(gctx->display, gctx->visual, gctx->depth, width, height, &wctx->image, &wctx->shm_info)))
+    {
+        wctx->image = NULL;
+        wctx->draw_buffer = XCreatePixmap(gctx->display, wctx->window, width, height, gctx->depth);
+        wctx->draw_context = XftDrawCreate(gctx->display, wctx->draw_buffer, gctx->visual, gctx->colormap);
+    }
+
+    wctx->width = width;
+    wctx->height = height;
+    gctx->pool.allocations++;
+}
+
 
+static void free_buffer(GlobalContext *gctx, WindowContext *wctx)
+{
+    fade_drop(gctx, wctx);
+
+    if (wctx->image)
+    {
+        scene_wait_shm(gctx, wctx);
+        shm_destroy(gctx->display, wctx->image, &wctx->shm_info);
+        wctx->image = NULL;
+    }
+
+    if (wctx->draw_buffer)
+    {
+        XftDrawDestroy(wctx->draw_context);
+        XFreePixmap(gctx->display, wctx->draw_buffer);
+        wctx->draw_buffer = None;
+    }
+
+    if (wctx->scratch)
+    {
+        XftDrawDestroy(wctx->scratch_context);
+        XFreePixmap(gctx->display, wctx->scratch);
+        wctx->scratch = None;
+    }
+
+    wctx->width = 0;
+    wctx->height = 0;
+}
+
+
+static void spawn_window(GlobalContext *gctx, WindowContext *wctx, uint width, uint height, int x, int y, int border, XColor *background_color, bool override_redirect)
+{
     XSetWindowAttributes attrs;
+    unsigned long mask = CWColormap | CWOverrideRedirect | CWBorderPixel;
     attrs.override_redirect = override_redirect;
-    attrs.background_pixel = background_color->pixel;
-    // attrs.background_pixel = 0;
     attrs.colormap = gctx->colormap;
+    attrs.border_pixel = gctx->border_color.pixel; // Required when the visual differs from the root
+
+    if (gctx->composited)
+    {
+        attrs.background_pixel = 0; // Transparent until the first frame
+        mask |= CWBackPixel;
+    }
+    else if (gctx->fade)
+    {
+        attrs.background_pixmap = None; // Keeps showing the screen it covers, the fade starts from it
+        mask |= CWBackPixmap;
+    }
+    else
+    {
+        attrs.background_pixel = background_color->pixel;
+        mask |= CWBackPixel;
+    }
     
-    // Create Warning window
-    wctx.window = XCreateWindow(gctx->display, gctx->root, x, y, width, height, border, gctx->depth, InputOutput, gctx->visual, CWColormap | CWOverrideRedirect | CWBackPixel, &attrs);
+    // Created unmapped, shown by show_window once its first frame is ready
+    wctx->window = XCreateWindow(gctx->display, gctx->root, x, y, width, height, border, gctx->depth, InputOutput, gctx->visual, mask, &attrs);
+    wctx->graphics_context = XCreateGC(gctx->display, wctx->window, 0, NULL);
 
-    XMapWindow(gctx->display, wctx.window);
-    XSync(gctx->display, False);
+    present_select(gctx, wctx);
+    input_watch(gctx, wctx->window);
+}
 
-    Pixmap draw_buffer = XCreatePixmap(gctx->display, wctx.window, width, height, gctx->depth);
-    XftDraw *draw_context = XftDrawCreate(gctx->display, draw_buffer, gctx->visual, gctx->colormap);
-    GC graphics_context = XCreateGC(gctx->display, wctx.window, 0, NULL);
 
-    wctx.width = width;
-    wctx.height = height;
-    wctx.draw_buffer = draw_buffer;
-    wctx.draw_context = draw_context;
-    wctx.graphics_context = graphics_context;
+/* Keep the buffer if it already has the size */
+static void acquire_buffer(GlobalContext *gctx, WindowContext *wctx, uint width, uint height)
+{
+    if (wctx->width == width && wctx->height == height)
+        return;
 
-    return wctx;
+    free_buffer(gctx, wctx);
+    create_buffer(gctx, wctx, width, height);
+
+    if (gctx->debug)
+        printf("Window buffers allocated: %lu\n", gctx->pool.allocations);
 }
 
 
-static void resize_window(GlobalContext *gctx, WindowContext *wctx, uint width, uint height, int x, int y)
+/*
+    The warning and the overlay window live for the whole process, each
+    with buffers of its own size. Between cycles windows are only unmapped,
+    and buffers are reallocated only when the requested size changes.
+*/
+static void acquire_window(GlobalContext *gctx, WindowContext *wctx, uint width, uint height, int x, int y, int border)
 {
-    XMoveResizeWindow(gctx->display, wctx->window, x, y, width, height);
+    if (!wctx->created)
+    {
+        spawn_window(gctx, wctx, width, height, x, y, border, &gctx->background_color, true);
+        wctx->created = true;
+    }
+    else
+    {
+        XMoveResizeWindow(gctx->display, wctx->window, x, y, width, height);
+        XSetWindowBorderWidth(gctx->display, wctx->window, border);
+    }
 
-    Pixmap draw_buffer = XCreatePixmap(gctx->display, wctx->window, width, height, gctx->depth);
-    XftDraw *draw_context = XftDrawCreate(gctx->display, draw_buffer, gctx->visual, gctx->colormap);
-    GC graphics_context = XCreateGC(gctx->display, wctx->window, 0, NULL);
+    acquire_buffer(gctx, wctx, width, height);
 
-    wctx->width = width;
-    wctx->height = height;
-    wctx->draw_buffer = draw_buffer;
-    wctx->draw_context = draw_context;
-    wctx->graphics_context = graphics_context;
+    wctx->root_x = x + border;
+    wctx->root_y = y + border;
+    wctx->border = border;
+
+    XRectangle whole = { 0, 0, width, height };
+    wctx->outputs[0] = whole;
+    wctx->output_count = 1;
+    wctx->next = NULL;
 }
 
 
-static void draw_warning(GlobalContext *gctx, char *warning_text, char *hint_text, uint time, WindowContext *wctx)
+/*
+    The overlay window spans the screen and keeps one buffer per distinct
+    output size, linked as views. Identical monitors share a buffer, so a
+    frame is composed once and copied to each of them.
+*/
+static void acquire_overlay(GlobalContext *gctx)
 {
-    char text[256];
-    sprintf(text, warning_text, time);
+    WindowContext *views = gctx->pool.overlay;
+
+    if (!views[0].created)
+    {
+        spawn_window(gctx, &views[0], gctx->screen_width, gctx->screen_height, 0, 0, 0, &gctx->background_color, true);
+        views[0].created = true;
+    }
+    else
+    {
+        XMoveResizeWindow(gctx->display, views[0].window, 0, 0, gctx->screen_width, gctx->screen_height);
+    }
 
-    // Calculate text extents
+    // Layers depend on the output sizes
+    scene_free(gctx, &views[0]);
 
-    XGlyphInfo warning_extents;
-    XftTextExtentsUtf8(gctx->display, gctx->warning_font, (XftChar8 *)text, strlen(text), &warning_extents);
+    uint widths[OUTPUT_MAX];
+    uint heights[OUTPUT_MAX];
+    int count = 0;
 
-    // Draw Warning Text
+    for (int o = 0; o < gctx->output_count; o++)
+    {
+        XRectangle rect = gctx->outputs[o].rect;
 
-    int warning_text_x = (wctx->width - warning_extents.width) / 2;
-    int warning_text_y = (wctx->height - warning_extents.height) / 2 + warning_extents.height - (warning_extents.height - warning_extents.y);
-    XftDrawStringUtf8(wctx->draw_context, &gctx->font_color, gctx->warning_font, warning_text_x, warning_text_y, (XftChar8 *)text, strlen(text));
+        // A desktop snapshot differs per output, nothing can be shared
+        int v = gctx->snapshot.enabled ? count : 0;
+        while (v < count && (widths[v] != rect.width || heights[v] != rect.height))
+            v++;
 
-    // Draw Hint
+        if (v == count)
+        {
+            widths[count] = rect.width;
+            heights[count] = rect.height;
+            views[count].output_count = 0;
+            count++;
+        }
+        views[v].outputs[views[v].output_count++] = rect;
+    }
 
-    if (hint_text && gctx->config.hints_enabled)
+    for (int v = 0; v < OUTPUT_MAX; v++)
     {
-        XGlyphInfo hint_extents;
-        XftTextExtentsUtf8(gctx->display, gctx->hint_font, (XftChar8 *)hint_text, strlen(hint_text), &hint_extents);
+        WindowContext *view = &views[v];
+
+        // Views past the last size drop their buffers
+        if (v >= count)
+        {
+            free_buffer(gctx, view);
+            view->output_count = 0;
+            view->next = NULL;
+            continue;
+        }
 
-        int hint_text_x = (wctx->width - hint_extents.width) / 2;
-        int hint_text_y = wctx->height - hint_extents.height;
-        XftDrawStringUtf8(wctx->draw_context, &gctx->hint_font_color, gctx->hint_font, hint_text_x, hint_text_y, (XftChar8 *)hint_text, strlen(hint_text));
+        view->window = views[0].window;
+        view->graphics_context = views[0].graphics_context;
+        view->root_x = 0;
+        view->root_y = 0;
+        view->border = 0;
+        view->next = v + 1 < count ? &views[v + 1] : NULL;
+        acquire_buffer(gctx, view, widths[v], heights[v]);
     }
-    
-    // Update display
-    XCopyArea(gctx->display, wctx->draw_buffer, wctx->window, wctx->graphics_context, 0, 0, wctx->width, wctx->height, 0, 0);
-    XFlush(gctx->display);
 }
 
 
-static void clear_window(GlobalContext *gctx, WindowContext *wctx, XColor color)
+/* Map and raise in one request, nothing waits for the server */
+static void show_window(GlobalContext *gctx, WindowContext *wctx)
 {
-    XSetForeground(gctx->display, wctx->graphics_context, color.pixel);
-    XFillRectangle(gctx->display, wctx->draw_buffer, wctx->graphics_context, 0, 0, wctx->width, wctx->height);
+    if (wctx->mapped)
+        XRaiseWindow(gctx->display, wctx->window);
+    else
+        XMapRaised(gctx->display, wctx->window);
+
+    wctx->mapped = true;
+    gctx->wctx = wctx;
 }
 
 
-static void draw_progress(GlobalContext *gctx, WindowContext *wctx, double progress)
+static void release_window(GlobalContext *gctx, WindowContext *wctx)
 {
-    XSetForeground(gctx->display, wctx->graphics_context, gctx->progress_color.pixel);
-
-    // int progress_max_width = 840;
-    int progress_max_width = wctx->width;
-    int progress_width = progress_max_width * progress;
-    // int progress_height = pt_to_px(config.progress_weight, dpi);
-    int progress_height = wctx->height;
-    int progress_x = (wctx->width - progress_max_width) / 2;
-    // int progress_y = title_text_y + title_extents.y;
-    // int progress_y = wctx->height - progress_height;
-    int progress_y = 0;
-    XFillRectangle(gctx->display, wctx->draw_buffer, wctx->graphics_context, progress_x, progress_y, progress_width, progress_height);
-
-}
+    if (!wctx->created)
+        return;
 
+    // Completions of this window would otherwise be consumed by the next one
+    scene_wait_shm(gctx, wctx);
+    scene_free(gctx, wctx);
+    fade_release(gctx, wctx);
+    present_release(gctx);
 
-void format_time(uint32_t seconds, char *out, size_t out_size)
-{
-    uint32_t h = seconds / 3600;
-    uint32_t m = (seconds % 3600) / 60;
-    uint32_t s = seconds % 60;
-
-    if (h > 0) {
-        // hh:mm:ss
-        snprintf(out, out_size, "%02u:%02u:%02u", h, m, s);
-    } else {
-        // mm:ss
-        snprintf(out, out_size, "%02u:%02u", m, s);
+    if (wctx->mapped)
+    {
+        XUnmapWindow(gctx->display, wctx->window);
+        wctx->mapped = false;
     }
 }
 
 
-static void draw_message(GlobalContext *gctx, char *title_text, char *message_text, char *hint_text, uint time, WindowContext *wctx)
+static void destroy_window(GlobalContext *gctx, WindowContext *wctx)
 {
-    // Draw time left
-    
-    if (gctx->config.time_enabled)
-    {
-        char time_text[256];
-        format_time(time, time_text, 256);
-
-        XGlyphInfo time_extents;
-        XftTextExtentsUtf8(gctx->display, gctx->time_font, (XftChar8 *)time_text, strlen(time_text), &time_extents);
+    if (!wctx->created)
+        return;
 
-        int time_text_x = (wctx->width - time_extents.xOff) / 2;
-        int time_text_y = (wctx->height - time_extents.yOff) / 3;
-        XftDrawStringUtf8(wctx->draw_context, &gctx->background_font_color, gctx->time_font, time_text_x, time_text_y, (XftChar8 *)time_text, strlen(time_text));
-    }
+    scene_free(gctx, wctx);
+    fade_free(gctx, wctx);
+    for (WindowContext *view = wctx; view; view = view->next)
+        free_buffer(gctx, view);
+    XFreeGC(gctx->display, wctx->graphics_context);
+    XDestroyWindow(gctx->display, wctx->window);
 
-    // Calculate text extents
+    wctx->created = false;
+    wctx->mapped = false;
+}
 
-    XGlyphInfo title_extents;
-    XftTextExtentsUtf8(gctx->display, gctx->title_font, (XftChar8 *)title_text, strlen(title_text), &title_extents);
-    XGlyphInfo message_extents;
-    XftTextExtentsUtf8(gctx->display, gctx->message_font, (XftChar8 *)message_text, strlen(message_text), &message_extents);
 
-    // Count Message lines and calculate multiline heigth
+static void place_warning(GlobalContext *gctx)
+{
+    uint warning_width = pt_to_px(gctx->config.warning_width, gctx->dpi);
+    uint warning_height = pt_to_px(gctx->config.warning_height, gctx->dpi);
 
-    int message_lines_count = 0;
+    // Centered on the primary output
+    XRectangle primary = output_primary(gctx)->rect;
+    int warning_x = primary.x + ((int)primary.width - (int)warning_width) / 2;
+    int warning_y = primary.y + ((int)primary.height - (int)warning_height) / 2;
 
-    const char *c = message_text;
-    while (c = strchr(c, '\n')) 
-    {
-        message_lines_count++;
-        c++; // Move past the found newline
-    }
+    acquire_window(gctx, &gctx->pool.warning, warning_width, warning_height, warning_x, warning_y, gctx->config.border_width);
+}
 
-    int pixel_margin = pt_to_px(gctx->config.margin, gctx->dpi);
-    int message_heigth = message_lines_count * message_extents.height + (message_lines_count - 1) * message_extents.height;
 
-    // Draw Title
+/* Follow a new output configuration, only buffers of changed sizes are reallocated */
+static void screen_changed(GlobalContext *gctx)
+{
+    WindowContext *warning = &gctx->pool.warning;
+    WindowContext *overlay = &gctx->pool.overlay[0];
 
-    int title_text_x = (wctx->width - title_extents.width) / 2;
-    int title_text_y = (wctx->height - title_extents.height - message_heigth - pixel_margin) / 2 + title_extents.height - title_extents.y;
+    if (warning->mapped)
+        place_warning(gctx);
 
-    XftDrawStringUtf8(wctx->draw_context, &gctx->font_color, gctx->title_font, title_text_x, title_text_y, (XftChar8 *)title_text, strlen(title_text));
+    if (!overlay->created)
+        return;
 
-    // Draw Message line by line
+    ScreenType type = overlay->scene.type;
+    bool shown = overlay->mapped && overlay->scene.valid;
 
-    const char *message_line = strtok(message_text, "\n");
-    for (int i = 0; message_line; i++)
-    {
-        XGlyphInfo message_line_extents;
-        XftTextExtentsUtf8(gctx->display, gctx->message_font, (XftChar8 *)message_line, strlen(message_line), &message_line_extents);
+    // A prepared break is redone by the next prepare_break
+    acquire_overlay(gctx);
 
-        int message_line_x = (wctx->width - message_line_extents.width) / 2;
-        int message_start_y = (wctx->height - title_extents.height - message_heigth - pixel_margin) / 2 + title_extents.height + pixel_margin;
-        int message_line_y = message_start_y + message_extents.height + message_extents.height * i * 1.5 - message_extents.y;
+    // The next frame composes the rebuilt screen
+    if (shown)
+        scene_build(gctx, overlay, type);
+}
 
-        XftDrawStringUtf8(wctx->draw_context, &gctx->font_color, gctx->message_font, message_line_x, message_line_y, (XftChar8 *)message_line, strlen(message_line));
-        message_line = strtok(NULL, "\n");
-    }
 
-    // Draw Hint
+/* Handle screen changes that queued up while nothing read events */
+static void sync_outputs(GlobalContext *gctx)
+{
+    if (!gctx->randr_event)
+        return;
 
-    if (hint_text && gctx->config.hints_enabled)
-    {
-        XGlyphInfo hint_extents;
-        XftTextExtentsUtf8(gctx->display, gctx->hint_font, (XftChar8 *)hint_text, strlen(hint_text), &hint_extents);
+    XEvent event;
+    bool changed = false;
+    while (XCheckTypedEvent(gctx->display, gctx->randr_event, &event))
+        changed |= output_event(gctx, &event);
 
-        int hint_text_x = (wctx->width - hint_extents.width) / 2;
-        int hint_text_y = wctx->height - hint_extents.height;
-        XftDrawStringUtf8(wctx->draw_context, &gctx->hint_font_color, gctx->hint_font, hint_text_x, hint_text_y, (XftChar8 *)hint_text, strlen(hint_text));
-    }
-    
-    // Update display
-    XCopyArea(gctx->display, wctx->draw_buffer, wctx->window, wctx->graphics_context, 0, 0, wctx->width, wctx->height, 0, 0);
-    XFlush(gctx->display);
+    if (changed)
+        screen_changed(gctx);
 }
 
-int event_wait(Display *display, XEvent *event, double timeout_sec)
-{
-    /* If events are already queued, return immediately */
-    if (XPending(display)) 
-    {
-        XNextEvent(display, event);
-        return 1;
-    }
 
-    int fd = ConnectionNumber(display);
+/*
+    Render the break overlay on its unmapped window ahead of time. The first
+    break frame does not depend on the clock, so it stays valid until the
+    overlay is used.
+*/
+static void prepare_break(GlobalContext *gctx)
+{
+    WindowContext *overlay = &gctx->pool.overlay[0];
+    Scene *scene = &overlay->scene;
 
-    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    schedule_pick(gctx);
 
-    int timeout_ms;
+    sync_outputs(gctx);
+    if (scene->valid && scene->hidden && scene->type == SCREEN_BREAK && gctx->schedule.prepared == gctx->schedule.active)
+        return;
 
-    if (timeout_sec < 0.0)
-        timeout_ms = -1;            /* wait forever */
+    // Grabbed only while no window of ours is mapped, the warning would be blurred into the break.
+    // While it is up, e.g. after a screen change or with another schedule due, the last grab is kept
+    if (gctx->pool.warning.mapped)
+        snapshot_keep(gctx);
     else
-        timeout_ms = (int)(timeout_sec * 1000);
+        snapshot_capture(gctx);
 
-    int ret = poll(&pfd, 1, timeout_ms);
-
-    if (ret > 0) 
-    {
-        if (pfd.revents & POLLIN) 
-        {
-            XNextEvent(display, event);
-            return 1;
-        }
-        return -1; /* unexpected event */
-    } 
-    else if (ret == 0) 
-    {
-        return 0;  /* timeout */
-    } 
-    else 
-    {
-        perror("poll");
-        return -1;
-    }
+    acquire_overlay(gctx);
+    scene_prepare(gctx, overlay, SCREEN_BREAK, 0.0, gctx->config.break_duration);
+    gctx->schedule.prepared = gctx->schedule.active;
+    XFlush(gctx->display);
 }
 
 
@@ -950,96 +691,199 @@ static void parse_args(int argc, char **argv, GlobalContext *gctx)
 }
 
 
-static void set_input_focus(GlobalContext *gctx, Window window)
-{
-    Window last_focus;
-    XGetInputFocus(gctx->display, &last_focus, &gctx->revert_to);
-    if (last_focus != gctx->wctx.window)
-        gctx->last_focus = last_focus;
-    XSetInputFocus(gctx->display, window, RevertToNone, CurrentTime);      
-}
-
-
 GlobalState run_frame_event_loop(GlobalContext *gctx, FrameEventLoop *loop, void *userdata)
 {
-    XEvent event;
     Timer timer = {0};
     timer_start(&timer);
     GlobalState state = STATE_NONE;
 
     double next_frame = 0;
+    input_expect(gctx, loop->keys);
 
     while (loop->duration <= 0 || timer_elapsed(&timer) < loop->duration) 
     {
-        double elapsed = timer_elapsed(&timer);
-        double wait_time = next_frame - elapsed;
-        if (wait_time < 0) wait_time = 0;
+        // Keys go first, they wait for the frame drawn last at most
+        state = input_take(gctx, loop->keys);
+        if (state != STATE_NONE)
+            break;
 
-        int r = event_wait(gctx->display, &event, wait_time);
-        if (r == -1)
+        // Woken at the next frame or at the end, whichever comes first
+        double deadline = next_frame;
+        if (loop->duration > 0 && deadline > loop->duration)
+            deadline = loop->duration;
+
+        LoopWake wake = loop_wait(gctx, &timer, deadline);
+        if (wake == LOOP_ERROR)
             die("Failed input!\n");
 
-        if (r == 0) 
+        if (wake == LOOP_INPUT)
+            continue;
+
+        if (wake == LOOP_SIGNAL)
         {
-            loop->on_frame(gctx, elapsed, loop->duration, userdata);
-            next_frame += gctx->frame_time;
+            printf("Caught %s\n", strsignal(gctx->loop.signal));
+            state = STATE_EXIT;
+            break;
+        }
+
+        if (wake == LOOP_TIMEOUT) 
+        {
+            double elapsed = timer_elapsed(&timer);
+            state = loop->on_frame(gctx, elapsed, loop->duration, userdata);
+            if (state != STATE_NONE)
+                break;
+
+            // Frames keep to their grid, missed ones are skipped rather than caught up
+            double paced = timer_pace(gctx->frame_time, deadline, elapsed);
+
+            // Sleep until the next visible change, fps is only a cap
+            if (loop->next_frame)
+                next_frame = fmax(loop->next_frame(gctx, elapsed, loop->duration, userdata), paced);
+            else
+                next_frame = paced;
+
+            // A shown window takes its frames on vblanks
+            if (gctx->wctx && gctx->wctx->mapped)
+                next_frame = present_align(gctx, &timer, next_frame, elapsed);
             continue;
         }
 
-        state = loop->on_event(gctx, &event, userdata);
-        if (state != STATE_NONE) 
+        // Events after one that ends the state are left to the next
+        XEvent *event;
+        while (state == STATE_NONE && (event = loop_event(gctx)))
         {
-            if (loop->on_exit) 
-                return loop->on_exit(gctx, state, userdata);
-            return state;
+
+            if (output_event(gctx, event))
+            {
+                screen_changed(gctx);
+                next_frame = timer_elapsed(&timer); // Draw the rebuilt screen right away
+                continue;
+            }
+
+            if (idle_event(gctx, event))
+            {
+                next_frame = timer_elapsed(&timer); // Let the state see the change
+                continue;
+            }
+
+            if (scene_event(gctx, gctx->wctx, event))
+                continue;
+
+            state = loop->on_event(gctx, event, userdata);
         }
+
+        if (state != STATE_NONE) 
+            break;
     }
-    
-    state = STATE_TIMEOUT;
+
+    input_expect(gctx, STATE_NONE);
+
+    if (state == STATE_NONE)
+        state = STATE_TIMEOUT;
     if (loop->on_exit) 
         return loop->on_exit(gctx, state, userdata);
     return state;
 }
 
 
+/* Whether the user is idle now, queried only when alarms are missing and a query is due */
+static bool wait_idle(GlobalContext *gctx, WaitProgress *wait, double elapsed)
+{
+    if (gctx->idle.alarms)
+        return gctx->idle.idle;
+
+    if (elapsed < wait->next_query)
+        return wait->idle;
+
+    // Idleness can't reach the limit sooner than the time it has left
+    double idle = idle_query(gctx);
+    double limit = gctx->config.idle_limit;
+    wait->next_query = elapsed + (idle < limit - 1.0 ? limit - idle : 1.0);
+    return idle >= limit;
+}
+
+
+static GlobalState wait_on_frame(GlobalContext *gctx, double elapsed, double duration, void *ud)
+{
+    WaitProgress *wait = ud;
+    (void)duration;
+
+    bool idle = gctx->config.detect_idle && wait_idle(gctx, wait, elapsed);
+    GlobalState state = wait_update(gctx, wait, elapsed, idle);
+
+    if (!wait->idle && schedule_left(gctx) <= PREPARE_TIME)
+        prepare_break(gctx);
+    return state;
+}
+
+
+static double wait_next_frame(GlobalContext *gctx, double elapsed, double duration, void *ud)
+{
+    WaitProgress *wait = ud;
+    (void)duration;
+
+    // While away the alarm wakes the loop on return, polling has to look
+    double next = wait_next(gctx, wait, elapsed, PREPARE_TIME);
+    if (gctx->config.detect_idle && !gctx->idle.alarms)
+        next = fmin(next, wait->next_query);
+    return next;
+}
+
+
+static GlobalState ignore_event(GlobalContext *gctx, XEvent *event, void *ud)
+{
+    (void)gctx;
+    (void)event;
+    (void)ud;
+    return STATE_NONE;
+}
+
+
+/* Where a finished wait or snooze leads */
+static GlobalState wait_on_exit(GlobalContext *gctx, GlobalState state, void *ud)
+{
+    (void)ud;
+    return state_exit(&gctx->config, STATE_WAIT, state);
+}
+
+
 static GlobalState process_wait(GlobalContext *gctx)
 {
     printf("Waiting...\n");
 
-    // If detecting idle we check it every second
-    if (gctx->config.detect_idle)
-    {
-        XScreenSaverInfo *info = XScreenSaverAllocInfo();
-        for (uint t = 0; t < gctx->config.timer_duration; t++)
-        {
-            XScreenSaverQueryInfo(gctx->display, gctx->root, info);
-            if (info->idle / 1000u > gctx->config.idle_limit)
-                t = 0; // Reset timer
-            sleep(1);
-        }
-        XFree(info);
-    }
-    // In other case we sleep whole time
-    else
-    {
-        sleep(gctx->config.timer_duration);
-    }
-    
-    if (gctx->config.warning_enabled)
-        return STATE_WARNING;
+    // Ends on its own, idleness and activity move the end
+    WaitProgress wait;
+    wait_start(gctx, &wait);
+    FrameEventLoop loop = {
+        .on_frame = wait_on_frame,
+        .on_event = ignore_event,
+        .on_exit  = wait_on_exit,
+        .next_frame = wait_next_frame,
+        .duration = 0
+    };
+
+    return run_frame_event_loop(gctx, &loop, &wait);
+}
 
-    return STATE_BREAK;
+
+static double next_scene_change(GlobalContext *gctx, double elapsed, double duration, void *ud)
+{
+    (void)ud;
+    return scene_next_change(gctx, gctx->wctx, elapsed, duration);
 }
 
 
-static void warning_on_frame(GlobalContext *gctx, double elapsed, double duration, void *ud)
+static GlobalState warning_on_frame(GlobalContext *gctx, double elapsed, double duration, void *ud)
 {
     double time_left = duration - elapsed;
     double progress = time_left / duration;
 
-    clear_window(gctx, &gctx->wctx, gctx->background_color);
-    draw_progress(gctx, &gctx->wctx, progress);
-    draw_warning(gctx, gctx->config.warning_message_text, gctx->config.warning_hint_text, (int)time_left, &gctx->wctx);
+    scene_draw(gctx, gctx->wctx, progress, (int)time_left);
+
+    // Covers warnings reached without a wait, e.g. after a snooze
+    if (time_left <= PREPARE_TIME)
+        prepare_break(gctx);
+    return STATE_NONE;
 }
 
 
@@ -1049,26 +893,12 @@ static GlobalState warning_on_event(GlobalContext *gctx, XEvent *event, void *ud
 
     if (event->type == ButtonPress)
     {
-        set_input_focus(gctx, gctx->wctx.window);
+        set_input_focus(gctx, gctx->wctx->window);
     }
     else if (event->type == KeyPress)
     {
         KeySym key = XLookupKeysym(&event->xkey, 0);
-        switch (key)
-        {
-            case XK_space: 
-                return STATE_BREAK;
-            case XK_w: // Snooze
-                if (gctx->config.snooze_enabled)
-                    return STATE_SNOOZE;
-                break;
-            case XK_s: // Skip
-                if (gctx->config.skip_enabled)
-                    return STATE_RESTART;
-                break;
-            case XK_q: // Quit
-                return STATE_EXIT;
-        }
+        return state_key(&gctx->config, STATE_WARNING, key);
     }
     return STATE_NONE;
 }
@@ -1076,58 +906,57 @@ static GlobalState warning_on_event(GlobalContext *gctx, XEvent *event, void *ud
 
 static GlobalState warning_on_exit(GlobalContext *gctx, GlobalState state, void *ud)
 {
-    switch (state)
-    {
-        case STATE_BREAK: 
-        case STATE_TIMEOUT:
-            return STATE_BREAK;
-        case STATE_SNOOZE: // Snooze
-            return state;
-        case STATE_RESTART: // Skip
-            return state;
-    }
-    return STATE_EXIT;
+    (void)ud;
+    return state_exit(&gctx->config, STATE_WARNING, state);
 }
 
 
 static GlobalState process_warning(GlobalContext *gctx)
 {
-    uint warning_width = pt_to_px(gctx->config.warning_width, gctx->dpi);
-    uint warning_height = pt_to_px(gctx->config.warning_height, gctx->dpi);
+    WindowContext *wctx = &gctx->pool.warning;
+
+    sync_outputs(gctx);
+    place_warning(gctx);
+    XSetWindowBorder(gctx->display, wctx->window, gctx->border_color.pixel);
+
+    // Listen for keypresses
+    // XGrabKeyboard(gctx->display, wctx->window, True, GrabModeAsync, GrabModeAsync, CurrentTime);
+    XSelectInput(gctx->display, wctx->window, input_key_mask(gctx) | ButtonPressMask | ExposureMask);
 
-    int warning_x = (gctx->screen_width  - warning_width) / 2;
-    int warning_y = (gctx->screen_height - warning_height) / 2;
+    // Keys count from here, one during the fade ends it and is taken by the loop
+    input_expect(gctx, STATE_WARNING);
 
-    gctx->wctx = spawn_window(gctx, warning_width, warning_height, warning_x, warning_y, gctx->config.border_width, &gctx->background_color, true);
+    // Composed before mapping, the fade starts from the first frame
+    scene_prepare(gctx, wctx, SCREEN_WARNING, 1.0, gctx->config.warning_duration);
+    fade_begin(gctx, wctx, gctx->config.warning_opacity);
+
+    show_window(gctx, wctx);
+    fade_in(gctx, wctx);
+    scene_show(gctx, wctx);
 
     // Manage window focus
-    XRaiseWindow(gctx->display, gctx->wctx.window);
-    set_input_focus(gctx, gctx->wctx.window);
-    XSetWindowBorder(gctx->display, gctx->wctx.window, gctx->border_color.pixel);
+    set_input_focus(gctx, wctx->window);
     XFlush(gctx->display);  
 
-    // Listen for keypresses
-    // XGrabKeyboard(gctx->display, gctx->wctx.window, True, GrabModeAsync, GrabModeAsync, CurrentTime);
-    XSelectInput(gctx->display, gctx->wctx.window, KeyPressMask | ButtonPressMask);
-
     FrameEventLoop loop = {
         .on_frame = warning_on_frame,
         .on_event = warning_on_event,
         .on_exit  = warning_on_exit,
-        .duration = gctx->config.warning_duration
+        .next_frame = next_scene_change,
+        .duration = gctx->config.warning_duration,
+        .keys = STATE_WARNING
     };
 
     return run_frame_event_loop(gctx, &loop, NULL);
 }
 
-static void break_on_frame(GlobalContext *gctx, double elapsed, double duration, void *ud)
+static GlobalState break_on_frame(GlobalContext *gctx, double elapsed, double duration, void *ud)
 {
     double time_left = duration - elapsed;
     double progress = elapsed / duration;
 
-    clear_window(gctx, &gctx->wctx, gctx->background_color);
-    draw_progress(gctx, &gctx->wctx, progress);
-    draw_message(gctx, gctx->config.break_title_text, gctx->config.break_message_text, gctx->config.break_hint_text, time_left, &gctx->wctx);
+    scene_draw(gctx, gctx->wctx, progress, time_left);
+    return STATE_NONE;
 }
 
 
@@ -1137,22 +966,12 @@ static GlobalState break_on_event(GlobalContext *gctx, XEvent *event, void *ud)
 
     if (event->type == ButtonPress)
     {
-        set_input_focus(gctx, gctx->wctx.window);
+        set_input_focus(gctx, gctx->wctx->window);
     }
     else if (event->type == KeyPress)
     {
         KeySym key = XLookupKeysym(&event->xkey, 0);
-        switch (key)
-        {
-            case XK_s: // Skip
-                if (gctx->config.stop_enabled)
-                    return STATE_RESTART;
-                break;
-            case XK_q: // Quit
-                if (gctx->config.stop_enabled)
-                    return STATE_EXIT;
-                break;
-        }
+        return state_key(&gctx->config, STATE_BREAK, key);
     }
     return STATE_NONE;
 }
@@ -1162,26 +981,18 @@ static GlobalState break_on_exit(GlobalContext *gctx, GlobalState state, void *u
 {
     (void)ud;
 
-    switch (state)
+    if (gctx->debug)
     {
-        case STATE_END:
-        case STATE_TIMEOUT:
-        {
-            // Break ended, go to End Screen
-            if (gctx->config.end_enabled)
-                return STATE_END;
-            // Break ended, restart without End Screen
-            if (gctx->config.repeat)
-                return STATE_RESTART;
-            return STATE_EXIT;
-        }
-        // Skip Break and restart
-        case STATE_RESTART:
-        {
-            return state;
-        }
+        present_report(gctx);
+        breath_report(gctx);
+        loop_report(gctx);
+        timer_report();
+        input_report(gctx);
+        activity_report(gctx);
+        audio_report(gctx);
     }
-    return STATE_EXIT;
+
+    return state_exit(&gctx->config, STATE_BREAK, state);
 }
 
 
@@ -1189,95 +1000,164 @@ static GlobalState process_break(GlobalContext *gctx)
 {
     printf("Starting break...\n");
 
-    if (gctx->config.warning_enabled)
-        resize_window(gctx, &gctx->wctx, gctx->screen_width, gctx->screen_height, 0, 0);
-    else
-        gctx->wctx = spawn_window(gctx, gctx->screen_width, gctx->screen_height, 0, 0, 0, &gctx->background_color, true);
-    set_input_focus(gctx, gctx->wctx.window);
-    XRaiseWindow(gctx->display, gctx->wctx.window);
-    XFlush(gctx->display);
+    Timer transition = {0};
+    timer_start(&transition);
+
+    // Keys count from here, one cuts the snapshot and the fade short and is taken by the loop
+    input_expect(gctx, STATE_BREAK);
+
+    // Normally done during the wait or the warning, the transition is then only a map
+    prepare_break(gctx);
+    breath_start(gctx);
+
+    WindowContext *wctx = &gctx->pool.overlay[0];
+
+    // Listen for keypresses
+    // XGrabKeyboard(gctx->display, wctx->window, True, GrabModeAsync, GrabModeAsync, CurrentTime);
+    XSelectInput(gctx->display, wctx->window, input_key_mask(gctx) | ButtonPressMask | ExposureMask | StructureNotifyMask);
+
+    fade_begin(gctx, wctx, 1.0);
+    show_window(gctx, wctx);
+    fade_in(gctx, wctx);
+    scene_show(gctx, wctx);
+    set_input_focus(gctx, wctx->window);
 
     if (gctx->config.block_input)
     {
         // Try to grab pointer and keyboard
-        XGrabPointer(gctx->display, gctx->wctx.window, True, ButtonPressMask | ButtonReleaseMask | PointerMotionMask, GrabModeAsync, GrabModeAsync, None, None, CurrentTime);
-        XGrabKeyboard(gctx->display, gctx->wctx.window, True, GrabModeAsync, GrabModeAsync, CurrentTime);
+        XGrabPointer(gctx->display, wctx->window, True, ButtonPressMask | ButtonReleaseMask | PointerMotionMask, GrabModeAsync, GrabModeAsync, None, None, CurrentTime);
+        input_grab(gctx, wctx->window);
     }
-    
-    double progress = 0;
+    XFlush(gctx->display);
 
-    // Draw break message
-    clear_window(gctx, &gctx->wctx, gctx->background_color);
-    draw_progress(gctx, &gctx->wctx, progress);
-    draw_message(gctx, gctx->config.break_title_text, gctx->config.break_message_text, gctx->config.break_hint_text, gctx->config.break_duration, &gctx->wctx);
-
-    // Play sound
-    if (gctx->config.sound_enabled)
-        play_wav_async(gctx->config.start_sound_path, gctx->config.volume);
+    // The overlay covers the warning, so hide it only after
+    release_window(gctx, &gctx->pool.warning);
 
+    // A round trip, on a remote display it costs more than it tells
+    if (gctx->debug)
+    {
+        XSync(gctx->display, False);
+        printf("Break overlay shown in %.2f ms\n", timer_elapsed(&transition) * 1000.0);
+    }
 
-    // Listen for keypresses
-    // XGrabKeyboard(gctx->display, gctx->wctx.window, True, GrabModeAsync, GrabModeAsync, CurrentTime);
-    XSelectInput(gctx->display, gctx->wctx.window, KeyPressMask | ButtonPressMask | ExposureMask | StructureNotifyMask);
+    // Play sound
+    audio_play(gctx, gctx->config.start_sound_path, gctx->config.volume);
 
     FrameEventLoop loop = {
         .on_frame = break_on_frame,
         .on_event = break_on_event,
         .on_exit  = break_on_exit,
-        .duration = gctx->config.break_duration
+        .next_frame = next_scene_change,
+        .duration = gctx->config.break_duration,
+        .keys = STATE_BREAK
     };
 
     return run_frame_event_loop(gctx, &loop, NULL);
 }
 
 
+static GlobalState end_on_frame(GlobalContext *gctx, double elapsed, double duration, void *ud)
+{
+    (void)elapsed;
+    (void)duration;
+    (void)ud;
+
+    scene_draw(gctx, gctx->wctx, 1.0, 0);
+    return STATE_NONE;
+}
+
+
+static double end_next_frame(GlobalContext *gctx, double elapsed, double duration, void *ud)
+{
+    (void)gctx;
+    (void)elapsed;
+    (void)duration;
+    (void)ud;
+    return INFINITY;
+}
+
+
+static GlobalState end_on_event(GlobalContext *gctx, XEvent *event, void *ud)
+{
+    (void)ud;
+
+    if (event->type != KeyPress)
+        return STATE_NONE;
+
+    return state_key(&gctx->config, STATE_END, XLookupKeysym(&event->xkey, 0));
+}
+
+
 static GlobalState process_end(GlobalContext *gctx)
 {
     printf("Ending break...\n");
 
     // Draw end message
-    clear_window(gctx, &gctx->wctx, gctx->background_color);
-    draw_progress(gctx, &gctx->wctx, 1.0);
-    draw_message(gctx, gctx->config.end_title_text, gctx->config.end_message_text, gctx->config.end_hint_text, 0, &gctx->wctx);
+    scene_build(gctx, gctx->wctx, SCREEN_END);
+    scene_draw(gctx, gctx->wctx, 1.0, 0);
 
     // Play sound
-    if (gctx->config.sound_enabled)
-        play_wav_async(gctx->config.end_sound_path, gctx->config.volume);
+    audio_play(gctx, gctx->config.end_sound_path, gctx->config.volume);
 
     // Listen for keypresses
-    XSelectInput(gctx->display, gctx->wctx.window, KeyPressMask | ExposureMask);
+    XSelectInput(gctx->display, gctx->wctx->window, input_key_mask(gctx) | ExposureMask);
 
-    XEvent event;
+    // Nothing moves, frames only redraw a rebuilt screen
+    FrameEventLoop loop = {
+        .on_frame = end_on_frame,
+        .on_event = end_on_event,
+        .next_frame = end_next_frame,
+        .duration = 0,
+        .keys = STATE_END
+    };
 
-    while (true) 
-    {
-        XNextEvent(gctx->display, &event);
-        if (event.type == KeyPress) 
-        {
-            KeySym key = XLookupKeysym(&event.xkey, 0);
-            break;
-        }
-    }
+    return run_frame_event_loop(gctx, &loop, NULL);
+}
 
-    if(gctx->config.repeat)
-        return STATE_RESTART;
 
-    return STATE_EXIT;
+static GlobalState snooze_on_frame(GlobalContext *gctx, double elapsed, double duration, void *ud)
+{
+    (void)ud;
+
+    if (duration - elapsed <= PREPARE_TIME)
+        prepare_break(gctx);
+    return STATE_NONE;
+}
+
+
+/* Once to prepare the break, then at the end */
+static double snooze_next_frame(GlobalContext *gctx, double elapsed, double duration, void *ud)
+{
+    (void)gctx;
+    (void)ud;
+
+    double prepare = duration - PREPARE_TIME;
+    return elapsed < prepare ? prepare : duration;
 }
 
 
 static GlobalState process_snooze(GlobalContext *gctx)
 {
     printf("Snoozing...\n");
-    XDestroyWindow(gctx->display, gctx->wctx.window);
-    XSetInputFocus(gctx->display, gctx->last_focus, RevertToNone, CurrentTime);
+    fade_out(gctx, gctx->wctx);
+    release_window(gctx, gctx->wctx);
+
+    // The desktop will have changed, grab it again before the next break
+    if (gctx->snapshot.enabled)
+        release_window(gctx, &gctx->pool.overlay[0]);
+
+    restore_focus(gctx);
     XFlush(gctx->display);
-    sleep(gctx->config.snooze_duration);
-        
-    if (gctx->config.warning_enabled)
-        return STATE_WARNING;
 
-    return STATE_BREAK;
+    FrameEventLoop loop = {
+        .on_frame = snooze_on_frame,
+        .on_event = ignore_event,
+        .on_exit  = wait_on_exit,
+        .next_frame = snooze_next_frame,
+        .duration = gctx->config.snooze_duration
+    };
+
+    return run_frame_event_loop(gctx, &loop, NULL);
 }
 
 
@@ -1285,14 +1165,17 @@ static GlobalState process_restart(GlobalContext *gctx)
 {
     printf("Restarting break...\n");
 
+    schedule_done(gctx);
+
     if (gctx->config.block_input)
     {
-        XUngrabKeyboard(gctx->display, CurrentTime);
+        input_ungrab(gctx);
         XUngrabPointer(gctx->display, CurrentTime);
     }
-    XDestroyWindow(gctx->display, gctx->wctx.window);
+    fade_out(gctx, gctx->wctx);
+    release_window(gctx, gctx->wctx);
 
-    XSetInputFocus(gctx->display, gctx->last_focus, RevertToNone, CurrentTime);
+    restore_focus(gctx);
     XFlush(gctx->display);
 
     return STATE_WAIT;
@@ -1304,12 +1187,23 @@ static GlobalState process_exit(GlobalContext *gctx)
 
     if (gctx->config.block_input)
     {
-        XUngrabKeyboard(gctx->display, CurrentTime);
+        input_ungrab(gctx);
         XUngrabPointer(gctx->display, CurrentTime);
     }
-    XDestroyWindow(gctx->display, gctx->wctx.window);
-
-    XSetInputFocus(gctx->display, gctx->last_focus, RevertToNone, CurrentTime);
+    destroy_window(gctx, &gctx->pool.warning);
+    destroy_window(gctx, &gctx->pool.overlay[0]);
+
+    restore_focus(gctx);
+    atlas_free(gctx->display, &gctx->time_atlas);
+    atlas_free(gctx->display, &gctx->warning_atlas);
+    background_free(gctx);
+    snapshot_free(gctx);
+    breath_free(gctx);
+    idle_free(gctx);
+    activity_free(gctx);
+    audio_free(gctx);
+    input_free(gctx);
+    loop_free(gctx);
     XCloseDisplay(gctx->display);
 
     return STATE_EXIT;
@@ -1326,32 +1220,16 @@ int main(int argc, char **argv)
 
     init(&gctx);
 
-    GlobalState state = STATE_WAIT;
+    static const StateHandler handlers[STATE_EXIT] = {
+        [STATE_WAIT] = process_wait,
+        [STATE_WARNING] = process_warning,
+        [STATE_SNOOZE] = process_snooze,
+        [STATE_BREAK] = process_break,
+        [STATE_END] = process_end,
+        [STATE_RESTART] = process_restart,
+    };
+    state_run(&gctx, handlers, NULL);
 
-    while (state != STATE_EXIT)
-    {
-        switch (state)
-        {
-            case STATE_WAIT: 
-                state = process_wait(&gctx);
-                break;
-            case STATE_WARNING:
-                state = process_warning(&gctx);
-                break;
-            case STATE_SNOOZE:
-                state = process_snooze(&gctx);
-                break;
-            case STATE_BREAK:
-                state = process_break(&gctx);
-                break;
-            case STATE_RESTART:
-                state = process_restart(&gctx);
-                break;
-            case STATE_END:
-                state = process_end(&gctx);
-                break;
-        }
-    }
     process_exit(&gctx);
     return 0;
 }
@@ -1,14 +1,51 @@
+#ifndef MAIN_H
+#define MAIN_H
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/Xft/Xft.h>
+#include <X11/extensions/Xrender.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/sync.h>
+#include <xcb/xcb.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#define SCHEDULE_MAX 8
+#define SCHEDULE_NAME 32
+
+
+/* Break cycle of a config section, the top level forms one when there are none */
+typedef struct
+{
+    char name[SCHEDULE_NAME];
+    time_t timer_duration;
+    time_t break_duration;
+    time_t warning_duration;
+
+    char break_title_text[128];
+    char break_message_text[1024];
+    char break_hint_text[256];
+
+    char start_sound_path[512];
+    char end_sound_path[512];
+} Schedule;
+
+
 typedef struct cfg
 {
     char break_title_text[128]; // Break Message Title
-    char break_message_text[256]; // Break Message
+    char break_message_text[1024]; // Break Message
     char break_hint_text[256]; // Break Hint
                                //
     char warning_message_text[256]; // Warning Message
     char warning_hint_text[256]; // Warning Hint
                                  //
     char end_title_text[128]; // End Screen Title
-    char end_message_text[256]; // End Screen Message
+    char end_message_text[1024]; // End Screen Message
     char end_hint_text[256]; // End Screen Message
 
     bool warning_enabled;
@@ -20,6 +57,19 @@ typedef struct cfg
     bool time_enabled;
     bool sound_enabled;
     bool block_input;
+    bool shm_enabled;
+    bool present_enabled;
+    bool low_memory;
+    bool primary_only;
+    bool desktop_background;
+    int desktop_blur; // Blur radius in pt
+    float desktop_dim;
+    bool breathing_enabled;
+    float breathing_inhale; // Seconds
+    float breathing_hold;
+    float breathing_exhale;
+    int breathing_radius; // Largest ring radius in pt
+    float breathing_budget; // Frame cost in ms before the animation slows down
 
     time_t timer_duration; // Time before/between Breaks
     time_t break_duration; // Duration of Breaks
@@ -31,12 +81,18 @@ typedef struct cfg
     bool detect_idle;
     time_t idle_limit;
 
+    bool activity_enabled; // Needs XREST_RECORD at build time
+    int activity_keys; // Keystrokes per minute of intense work
+    int activity_distance; // Pointer travel in px per minute of intense work, 0 ignores it
+    float activity_weight; // How many seconds an intense second of work counts for
+
     char font_color[16]; // Main foreground color
     char hint_font_color[16]; // Hint font color
     char background_font_color[16]; // Time font color
     char background_color[16]; // Backgroung color
     char progress_color[16];
     char border_color[16];
+    char background_image[512]; // PPM or PAM file under the break and end screens
 
     char font_name[128]; // Main font name
 
@@ -67,13 +123,322 @@ typedef struct cfg
     int margin;
 
     int fps;
+    float fade_duration; // Seconds of the fade in and out, 0 (the default) disables
+    float warning_opacity; // Needs a compositing manager
 
     char start_sound_path[512];
     char end_sound_path[512];
     float volume;
+
+    Schedule schedules[SCHEDULE_MAX]; // From [name] sections
+    int schedule_count;
 } Config;
 
 
+#define ATLAS_MAX_GLYPHS 128
+
+typedef struct
+{
+    XftFont *font;
+    Pixmap pixmap; // A8 strip of pre-rasterized glyphs
+    Picture mask;
+    int top; // Highest ink above the baseline
+    int width; // Strip size
+    int height;
+    bool present[ATLAS_MAX_GLYPHS];
+    short cell_x[ATLAS_MAX_GLYPHS]; // Glyph position in the strip
+    short cell_width[ATLAS_MAX_GLYPHS];
+    short bearing[ATLAS_MAX_GLYPHS]; // Ink offset left of the pen
+    short advance[ATLAS_MAX_GLYPHS];
+    XImage *image; // Client-side copy for the SHM path, fetched on first use
+} GlyphAtlas;
+
+
+typedef enum {
+    SCREEN_WARNING,
+    SCREEN_BREAK,
+    SCREEN_END,
+    SCREEN_COUNT
+} ScreenType;
+
+
+#define LAYOUT_MAX_LINES 32
+
+typedef struct
+{
+    int offset; // Into TextLayout.text
+    int length;
+    int x; // Pen origin relative to the block
+    int y; // Baseline relative to the block
+    XRectangle rect; // Ink bounds relative to the block
+} LayoutLine;
+
+
+/* Font as the layout engine sees it, measured by the renderer that draws it */
+typedef struct
+{
+    void *handle; // XftFont or SoftFont, also the layout cache key
+    void *context; // Passed back to extents
+    int ascent;
+    int height;
+    void (*extents)(void *context, void *handle, const char *text, int length, XGlyphInfo *extents);
+} LayoutFont;
+
+
+typedef struct
+{
+    // Cache key
+    char text[1024];
+    void *font;
+    int max_width;
+    bool valid;
+
+    LayoutLine lines[LAYOUT_MAX_LINES];
+    int line_count;
+    int height;
+} TextLayout;
+
+
+typedef enum {
+    LAYOUT_TITLE, // Or the warning text
+    LAYOUT_MESSAGE,
+    LAYOUT_HINT,
+    LAYOUT_COUNT
+} LayoutBlock;
+
+
+typedef enum {
+    RENDER_FONT_TITLE,
+    RENDER_FONT_MESSAGE, // Also the warning text
+    RENDER_FONT_HINT,
+    RENDER_FONT_TIME,
+    RENDER_FONT_COUNT
+} RenderFont;
+
+
+typedef enum {
+    RENDER_COLOR_FONT,
+    RENDER_COLOR_HINT,
+    RENDER_COLOR_BACKGROUND_FONT,
+    RENDER_COLOR_BACKGROUND,
+    RENDER_COLOR_PROGRESS,
+    RENDER_COLOR_COUNT
+} RenderColor;
+
+
+/* What drawing a screen needs, implemented once per render backend */
+typedef struct
+{
+    const char *name;
+    void *data; // Passed back to every operation
+
+    const LayoutFont *(*font)(void *data, RenderFont font);
+    void (*fill)(void *data, XRectangle r, RenderColor color);
+    void (*text)(void *data, RenderFont font, RenderColor color, int x, int y, const char *text, int length); // At a baseline origin
+} RenderBackend;
+
+
+typedef struct
+{
+    RenderBackend backend;
+    const Config *config;
+    double dpi;
+    TextLayout layouts[SCREEN_COUNT][LAYOUT_COUNT];
+} Renderer;
+
+
+#define SOFT_GLYPHS 256 // Cached per font, the rest is rasterized when drawn
+
+typedef struct
+{
+    bool cached;
+    uint8_t *coverage; // A8, pitch bytes per row
+    int pitch;
+    int width;
+    int height;
+    int left; // Ink left of the pen
+    int top; // Ink top above the baseline
+    int advance;
+} SoftGlyph;
+
+
+typedef struct
+{
+    FT_Face face;
+    SoftGlyph glyphs[SOFT_GLYPHS];
+    LayoutFont measure;
+} SoftFont;
+
+
+typedef struct
+{
+    FT_Library library;
+    SoftFont fonts[RENDER_FONT_COUNT];
+    uint32_t colors[RENDER_COLOR_COUNT]; // In canvas byte order
+    uint8_t *pixels; // RGBA, stride bytes per row
+    uint width;
+    uint height;
+    uint stride;
+} SoftRenderer;
+
+
+typedef struct
+{
+    Pixmap pixmap; // A8 coverage of the static text
+    Picture mask;
+    Picture fill; // Solid source in the text color
+    XRectangle rect; // Position on the window
+    XRenderColor color;
+    XImage *coverage; // Client-side copy for the SHM path
+} SceneLayer;
+
+
+typedef struct
+{
+    uint width;
+    uint height;
+    Pixmap plain; // Server-side copies, without SHM
+    Pixmap tinted; // Blended with the progress color
+    XImage *plain_image; // Client-side copies for the SHM path
+    XImage *tinted_image;
+} Background;
+
+
+#define BACKGROUND_MAX_SIZES 8
+
+typedef struct
+{
+    bool enabled;
+    uint32_t key; // Identity of the source file in the disk cache
+    uint8_t *pixels; // Decoded RGB source, only once a size had to be scaled
+    uint width;
+    uint height;
+    Background sizes[BACKGROUND_MAX_SIZES];
+    int size_count;
+    int next_slot;
+} BackgroundImage;
+
+
+typedef struct
+{
+    bool enabled;
+    bool valid; // Captured for the coming break
+    bool shm; // Grab and upload through MIT-SHM
+    XImage *capture; // Screen grab, blurred in place
+    XImage *scratch; // Blur ping-pong buffer, ends up tinted
+    XShmSegmentInfo capture_info;
+    XShmSegmentInfo scratch_info;
+    Background background; // The images in the SHM path, uploaded pixmaps otherwise
+} Snapshot;
+
+
+#define BREATH_LEVELS 96
+
+typedef struct
+{
+    uint size; // Square around the ring
+    Pixmap pixmap; // A8 coverage, without SHM
+    Picture mask;
+    XImage *image; // A8 coverage in memory, with SHM
+} BreathRing;
+
+
+/* Request whose reply shows the server got through everything sent before it */
+typedef struct
+{
+    unsigned int sequence;
+    bool pending;
+} Fence;
+
+
+typedef struct
+{
+    bool enabled;
+    BreathRing rings[BREATH_LEVELS]; // Smallest to largest radius
+    int ring_count;
+
+    double interval; // Seconds between animation frames, doubled past the budget
+    double cost; // Moving average of the frame cost in seconds
+    int samples; // Frames averaged since the last interval change
+    double max_cost;
+    double total_cost;
+    unsigned long frames;
+    unsigned long late; // Frames the server was still busy with the one before
+    Fence fence; // Sent after each frame
+} Breath;
+
+
+#define SCENE_MAX_LAYERS 2
+#define SCENE_MAX_DAMAGE 8
+
+typedef struct
+{
+    ScreenType type;
+    bool valid;
+
+    // Static text rendered once per screen, grouped by color
+    SceneLayer layers[SCENE_MAX_LAYERS];
+    int layer_count;
+
+    // Text that changes with time (countdown, formatted warning)
+    bool dynamic_enabled;
+    XftFont *dynamic_font;
+    XftColor *dynamic_color;
+    GlyphAtlas *dynamic_atlas; // Optional, replaces Xft for the dynamic text
+    Picture dynamic_fill;
+    bool dynamic_from_atlas;
+    XImage *dynamic_image; // Coverage of dynamic text missing from the atlas, SHM path
+    char dynamic_text[256];
+    int dynamic_x;
+    int dynamic_y;
+    XRectangle dynamic_rect;
+
+    const Background *background; // Pre-scaled image under everything, NULL for a flat color
+    int background_x; // Buffer origin within the background
+    int background_y;
+    int progress_width; // Last drawn progress edge in px
+
+    // Breathing guide ring, centered on the view
+    bool breath_enabled;
+    int breath_level; // Ring drawn, -1 before the first frame
+    XRectangle breath_rect;
+    Picture breath_fill;
+
+    bool hidden; // Window not mapped yet, frames are composed but not published
+
+    // Regions to recompose and publish on the next frame
+    XRectangle damage[SCENE_MAX_DAMAGE];
+    int damage_count;
+} Scene;
+
+
+typedef struct
+{
+    Picture window; // Owned by the first view
+    Picture source; // Composed frame of the view
+    Pixmap pixmap; // Server copy of an SHM back buffer
+    Picture mask; // Opacity applied to every publish, None when opaque
+    double opacity;
+
+    // Screen the window covered with its border when it appeared, first view only, without a compositing manager
+    Pixmap under;
+    Picture under_picture;
+    int under_x; // On the root window
+    int under_y;
+    uint under_width;
+    uint under_height;
+} Fade;
+
+
+#define OUTPUT_MAX 8
+
+typedef struct
+{
+    XRectangle rect; // CRTC area on the root window
+    bool primary;
+} Output;
+
+
 typedef struct wctx
 {
     Window window;
@@ -82,16 +447,250 @@ typedef struct wctx
     Pixmap draw_buffer;
     XftDraw *draw_context;
     GC graphics_context;
+
+    // MIT-SHM back buffer, replaces draw_buffer when set
+    XImage *image;
+    XShmSegmentInfo shm_info;
+    int shm_pending; // Puts not yet completed by the server
+
+    // Low-memory mode scratch buffer, sized to the largest text box
+    Pixmap scratch;
+    XftDraw *scratch_context;
+    uint scratch_width;
+    uint scratch_height;
+
+    Scene scene; // What the window shows
+    Fade fade;
+    int root_x; // Buffer origin on the root window, inside the border
+    int root_y;
+    int border;
+    bool created;
+    bool mapped;
+
+    // Window areas showing this buffer, every output of the buffer's size
+    XRectangle outputs[OUTPUT_MAX];
+    int output_count;
+    struct wctx *next; // Buffer for outputs of another size on the same window
 } WindowContext;
 
 
+typedef struct
+{
+    WindowContext warning; // Bordered warning window
+    WindowContext overlay[OUTPUT_MAX]; // Full-screen break and end window, one buffer per output size
+    unsigned long allocations; // Buffer allocations over the process lifetime
+} WindowPool;
+
+
+typedef struct
+{
+    bool enabled; // Present extension in use, needs XREST_PRESENT at build time
+    int opcode;
+    bool in_flight; // A frame waits for its vblank
+
+    // Last presentation reported by PresentCompleteNotify
+    uint64_t ust; // Microseconds
+    uint64_t msc; // Vblank counter
+    double refresh; // Estimated vblank period in seconds
+
+    uint32_t serial;
+    unsigned long presented;
+    unsigned long dropped;
+} PresentContext;
+
+
+#define LOOP_BATCH 64 // Events handled between two deadline checks
+
+
+typedef struct
+{
+    int epoll;
+    int timer; // timerfd, armed at the deadline of the current wait
+    int signals; // signalfd of the signals that end the program
+    int signal; // Last one caught
+    int input; // eventfd of the input thread, -1 without one
+
+    XEvent batch[LOOP_BATCH]; // Events of the last wake, coalesced
+    int batch_count;
+    int batch_next; // First one not handled yet
+
+    unsigned long batches;
+    unsigned long events; // Read off the queue
+    unsigned long coalesced; // Merged into a later event of the same batch
+    int max_depth; // Most events queued at once
+} EventLoop;
+
+
+typedef enum {
+    LOOP_ERROR = -1,
+    LOOP_TIMEOUT,
+    LOOP_EVENT,
+    LOOP_SIGNAL,
+    LOOP_INPUT
+} LoopWake;
+
+
+typedef enum {
+    STATE_NONE,
+    STATE_WAIT,
+    STATE_WARNING,
+    STATE_SNOOZE,
+    STATE_BREAK,
+    STATE_END,
+    STATE_RESTART,
+    STATE_EXIT,
+    STATE_TIMEOUT
+} GlobalState;
+
+
+typedef struct
+{
+    bool idle; // Idle when last seen, the time away counts as a break once the user is back
+    double idle_since; // Elapsed time idleness was first seen
+    double next_query; // Elapsed time of the next idle query when polling
+    double next_sample; // Elapsed time of the next activity sample
+} WaitProgress;
+
+
+#define INPUT_KEYS 16
+
+
+typedef struct
+{
+    GlobalState state; // Transition the key leads to
+    GlobalState from; // State it was translated in
+    struct timespec stamp; // When the input thread read it
+} InputKey;
+
+
+typedef struct
+{
+    bool enabled; // Keys come through the input thread
+    Display *display; // Connection of its own, keys are read off it only
+    pthread_t thread;
+    atomic_bool running;
+    int wake; // eventfd, wakes the main loop when a key is posted
+    int nudge; // eventfd, wakes the input thread
+
+    _Atomic GlobalState state; // State keys are translated for, STATE_NONE drops them
+    InputKey keys[INPUT_KEYS]; // Ring with one producer, the input thread, and one consumer
+    atomic_uint head; // Written by the input thread only
+    atomic_uint tail; // Written by the main thread only
+
+    unsigned long taken;
+    double latency_total; // Seconds from reading a key to its transition
+    double latency_max;
+} InputContext;
+
+
+#define AUDIO_JOBS 8
+
+
+typedef struct
+{
+    char path[512];
+    float volume;
+    struct timespec queued; // When it was asked for
+} AudioJob;
+
+
+typedef struct
+{
+    bool enabled; // Clips go to the audio thread
+    pthread_t thread;
+    atomic_bool running;
+    int wake; // eventfd, wakes the audio thread when a clip is queued or on exit
+
+    AudioJob jobs[AUDIO_JOBS]; // Ring with one producer, the main thread, and one consumer
+    atomic_uint head; // Written by the main thread only
+    atomic_uint tail; // Written by the audio thread only
+
+    // Audio thread only
+    struct ao_device *device; // Kept open between clips
+    int bits; // Format the device is open with
+    int channels;
+    int rate;
+    char buffer[4096];
+
+    atomic_ulong played;
+    atomic_ulong reopened; // Device opens, the first included
+    atomic_ulong latency_total; // Nanoseconds from asking for a clip to its first sample
+    atomic_ulong latency_max;
+} AudioContext;
+
+
+/* Input per minute over a sample */
+typedef struct
+{
+    double seconds; // Covered by the sample
+    double keys;
+    double distance; // Pointer travel in px
+} ActivityRate;
+
+
+typedef struct
+{
+    bool enabled; // Metered through RECORD
+    Display *control; // Creates and ends the record context
+    Display *data; // Blocked delivering records on the meter thread
+    unsigned long context; // XRecordContext
+    pthread_t thread;
+
+    // Meter thread only, published once a second
+    unsigned long keys;
+    double distance;
+    int pointer_x;
+    int pointer_y;
+    bool pointer_known;
+    unsigned long published_at; // Server time in ms
+
+    atomic_ulong published_keys; // Totals so far
+    atomic_ulong published_distance;
+    atomic_ulong published_records;
+    atomic_ulong cpu_ns; // Meter thread CPU time
+    unsigned long records; // Meter thread only
+
+    // Read side
+    unsigned long sampled_keys;
+    unsigned long sampled_distance;
+    struct timespec sampled_at;
+    double spent; // Seconds of work counted on top of the clock
+} ActivityContext;
+
+
+typedef struct
+{
+    bool alarms; // IDLETIME alarms in use, polled otherwise
+    int event_base; // SYNC extension events
+    XSyncCounter counter; // IDLETIME, milliseconds since the last input
+    XSyncAlarm alarm; // Fires on crossing idle_limit, either way
+    bool idle; // Past idle_limit when the alarm last fired
+    unsigned long alarms_fired;
+} IdleContext;
+
+
+typedef struct
+{
+    Schedule schedules[SCHEDULE_MAX];
+    int count;
+    struct timespec epoch; // Deadlines are seconds on the monotonic clock after it
+    double due[SCHEDULE_MAX];
+    int heap[SCHEDULE_MAX]; // Schedule indices, the nearest deadline first
+    int active; // Schedule of the coming or current break, -1 before one is picked
+    int prepared; // Schedule the hidden break overlay was composed for
+    bool sections; // From [name] sections, otherwise the one of the top level
+} ScheduleContext;
+
+
 typedef struct gctx
 {
     Config config;
     bool debug;
-    WindowContext wctx;
+    WindowContext *wctx; // Window of the current state
+    WindowPool pool;
 
     Display *display;
+    xcb_connection_t *xcb; // Under the display, for requests whose replies are collected late
     int screen;
     double dpi;
     int depth;
@@ -103,12 +702,25 @@ typedef struct gctx
     uint screen_width;
     uint screen_height;
 
+    Output outputs[OUTPUT_MAX];
+    int output_count;
+    int randr_event; // RRScreenChangeNotify event type, 0 without RandR
+
     XftFont *title_font;
     XftFont *message_font;
     XftFont *warning_font;
     XftFont *hint_font;
     XftFont *time_font;
 
+    GlyphAtlas time_atlas;
+    GlyphAtlas warning_atlas;
+
+    Renderer renderer; // Places the static text of every view, bound on first use
+
+    BackgroundImage background;
+    Snapshot snapshot;
+    Breath breath;
+
     XftColor font_color;
     XColor background_color;
     XftColor hint_font_color;
@@ -118,30 +730,37 @@ typedef struct gctx
 
     Window last_focus;
     int revert_to;
+    xcb_get_input_focus_cookie_t focus_query; // Focus before ours, collected when it is given back
+    bool focus_pending;
+    xcb_intern_atom_cookie_t cm_atom; // Compositing manager selection, asked before outputs load
+
+    EventLoop loop;
+    InputContext input;
+    AudioContext audio;
+    IdleContext idle;
+    ActivityContext activity;
+    ScheduleContext schedule;
+    PresentContext present;
+    bool shm; // MIT-SHM usable for back buffers
+    bool fade; // Fade transitions in use
+    bool composited; // A compositing manager blends the windows, they use an ARGB visual
+    unsigned long alpha_mask; // Alpha bits of the visual, set in every opaque pixel
+    int shm_completion; // ShmCompletion event type
 
     double frame_time;
     double progress;
 } GlobalContext;
 
 
-typedef enum {
-    STATE_NONE,
-    STATE_WAIT,
-    STATE_WARNING,
-    STATE_SNOOZE,
-    STATE_BREAK,
-    STATE_END,
-    STATE_RESTART,
-    STATE_EXIT,
-    STATE_TIMEOUT
-} GlobalState;
 
 
 typedef struct {
-    void (*on_frame)(GlobalContext *gctx, double elapsed, double duration, void *userdata);
+    GlobalState (*on_frame)(GlobalContext *gctx, double elapsed, double duration, void *userdata); // STATE_NONE to stay in the loop
     GlobalState (*on_event)(GlobalContext *gctx, XEvent *event, void *userdata);
     GlobalState (*on_exit)(GlobalContext *gctx, GlobalState state, void *userdata);
+    double (*next_frame)(GlobalContext *gctx, double elapsed, double duration, void *userdata); // Optional, elapsed time of the next visible change
     double duration;   // <= 0 means infinite
+    GlobalState keys; // State keys are translated for by the input thread, STATE_NONE if they do nothing
 } FrameEventLoop;
 
 
@@ -161,3 +780,9 @@ typedef struct
     uint16_t bits_per_sample;
 } WavHeader;
 #pragma pack(pop)
+
+
+double pt_to_px(double pt, double dpi);
+void format_time(uint32_t seconds, char *out, size_t out_size);
+
+#endif /* MAIN_H */
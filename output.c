@@ -0,0 +1,137 @@
+#include <X11/Xlib.h>
+#include <X11/extensions/Xrandr.h>
+#include <stdio.h>
+
+#include "main.h"
+#include "output.h"
+
+/*
+    Output discovery through XRandR.
+
+    Every active CRTC becomes an output rectangle on the root window, and
+    screen content is laid out per output. Clones driven by several CRTCs
+    at the same place are kept once. Without RandR 1.3 the whole screen is
+    a single output.
+*/
+
+
+static bool same_rect(XRectangle a, XRectangle b)
+{
+    return a.x == b.x && a.y == b.y && a.width == b.width && a.height == b.height;
+}
+
+
+static void add_output(GlobalContext *gctx, XRectangle rect, bool primary)
+{
+    for (int o = 0; o < gctx->output_count; o++)
+    {
+        if (same_rect(gctx->outputs[o].rect, rect))
+        {
+            gctx->outputs[o].primary |= primary;
+            return;
+        }
+    }
+
+    if (gctx->output_count == OUTPUT_MAX)
+        return;
+
+    Output *output = &gctx->outputs[gctx->output_count++];
+    output->rect = rect;
+    output->primary = primary;
+}
+
+
+void output_init(GlobalContext *gctx)
+{
+    int event_base, error_base;
+    int major = 1, minor = 3;
+
+    // Current screen resources need 1.3
+    if (XRRQueryExtension(gctx->display, &event_base, &error_base) &&
+        XRRQueryVersion(gctx->display, &major, &minor) &&
+        (major > 1 || minor >= 3))
+    {
+        gctx->randr_event = event_base + RRScreenChangeNotify;
+        XRRSelectInput(gctx->display, gctx->root, RRScreenChangeNotifyMask);
+    }
+
+    output_update(gctx);
+}
+
+
+void output_update(GlobalContext *gctx)
+{
+    gctx->screen_width  = DisplayWidth(gctx->display, gctx->screen);
+    gctx->screen_height = DisplayHeight(gctx->display, gctx->screen);
+    gctx->output_count = 0;
+
+    if (gctx->randr_event)
+    {
+        XRRScreenResources *resources = XRRGetScreenResourcesCurrent(gctx->display, gctx->root);
+        RROutput primary = XRRGetOutputPrimary(gctx->display, gctx->root);
+
+        for (int c = 0; resources && c < resources->ncrtc; c++)
+        {
+            XRRCrtcInfo *crtc = XRRGetCrtcInfo(gctx->display, resources, resources->crtcs[c]);
+            if (!crtc)
+                continue;
+
+            if (crtc->mode != None && crtc->noutput > 0 && crtc->width > 0 && crtc->height > 0)
+            {
+                XRectangle rect = { crtc->x, crtc->y, crtc->width, crtc->height };
+                bool is_primary = false;
+                for (int o = 0; o < crtc->noutput; o++)
+                    is_primary |= crtc->outputs[o] == primary;
+
+                add_output(gctx, rect, is_primary);
+            }
+            XRRFreeCrtcInfo(crtc);
+        }
+
+        if (resources)
+            XRRFreeScreenResources(resources);
+    }
+
+    if (gctx->output_count == 0)
+    {
+        XRectangle rect = { 0, 0, gctx->screen_width, gctx->screen_height };
+        add_output(gctx, rect, true);
+    }
+
+    if (gctx->config.primary_only)
+    {
+        gctx->outputs[0] = *output_primary(gctx);
+        gctx->output_count = 1;
+    }
+
+    if (gctx->debug)
+    {
+        for (int o = 0; o < gctx->output_count; o++)
+        {
+            XRectangle r = gctx->outputs[o].rect;
+            printf("Output %d: %ux%u+%d+%d%s\n", o, r.width, r.height, r.x, r.y, gctx->outputs[o].primary ? " primary" : "");
+        }
+    }
+}
+
+
+bool output_event(GlobalContext *gctx, XEvent *event)
+{
+    if (!gctx->randr_event || event->type != gctx->randr_event)
+        return false;
+
+    // Keeps DisplayWidth and DisplayHeight current
+    XRRUpdateConfiguration(event);
+    output_update(gctx);
+    return true;
+}
+
+
+const Output *output_primary(GlobalContext *gctx)
+{
+    for (int o = 0; o < gctx->output_count; o++)
+        if (gctx->outputs[o].primary)
+            return &gctx->outputs[o];
+
+    return &gctx->outputs[0];
+}
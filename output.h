@@ -0,0 +1,18 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "main.h"
+
+/* Query XRandR and listen for screen changes, the whole screen is one output without it */
+void output_init(GlobalContext *gctx);
+
+/* Re-read the screen size and the active CRTCs */
+void output_update(GlobalContext *gctx);
+
+/* Handle RRScreenChangeNotify, true if the event was consumed */
+bool output_event(GlobalContext *gctx, XEvent *event);
+
+/* Primary output, or the first one if none is marked */
+const Output *output_primary(GlobalContext *gctx);
+
+#endif /* OUTPUT_H */
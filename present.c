@@ -0,0 +1,180 @@
+#include <X11/Xlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "main.h"
+#include "timer.h"
+#include "present.h"
+
+/*
+    Vblank-paced presentation through the Present extension.
+
+    Damaged regions of the back buffer pixmap are handed to XPresentPixmap
+    for the next vblank. Only one frame is kept in flight: a frame due while
+    the previous one still waits is dropped, and its damage is published
+    with the next one instead of being queued behind it.
+
+    Completions carry the time and count of the vblank they were shown at.
+    From the last one and the measured period the next vblanks are
+    predicted, and frame deadlines are moved onto them, so a frame is
+    drawn right after a vblank with a whole period left to reach the next.
+
+    Needs libXpresent, built with -DXREST_PRESENT.
+*/
+
+#define PRESENT_MARGIN 0.0005 // Seconds after a predicted vblank to draw at
+
+#ifdef XREST_PRESENT
+
+#include <X11/extensions/Xfixes.h>
+#include <X11/extensions/Xpresent.h>
+
+
+bool present_init(GlobalContext *gctx)
+{
+    int event_base, error_base;
+    if (!XPresentQueryExtension(gctx->display, &gctx->present.opcode, &event_base, &error_base))
+        return false;
+
+    // Regions for the update area need a negotiated XFixes version
+    int major = 5, minor = 0;
+    if (!XFixesQueryVersion(gctx->display, &major, &minor))
+        return false;
+
+    gctx->present.enabled = true;
+    return true;
+}
+
+
+void present_select(GlobalContext *gctx, WindowContext *wctx)
+{
+    if (!gctx->present.enabled)
+        return;
+
+    XPresentSelectInput(gctx->display, wctx->window, PresentCompleteNotifyMask);
+}
+
+
+void present_frame(GlobalContext *gctx, WindowContext *wctx, XRectangle *rects, int count)
+{
+    PresentContext *present = &gctx->present;
+
+    // Same pixmap for every output of its size, the last serial completes the frame
+    XserverRegion update = XFixesCreateRegion(gctx->display, rects, count);
+    for (int o = 0; o < wctx->output_count; o++)
+    {
+        XPresentPixmap(gctx->display, wctx->window, wctx->draw_buffer, ++present->serial,
+                       None, update, wctx->outputs[o].x, wctx->outputs[o].y, None, None, None,
+                       PresentOptionNone, 0, 0, 0, NULL, 0);
+    }
+    XFixesDestroyRegion(gctx->display, update);
+
+    present->in_flight = true;
+    present->presented++;
+}
+
+
+bool present_event(GlobalContext *gctx, XEvent *event)
+{
+    PresentContext *present = &gctx->present;
+
+    if (!present->enabled || event->type != GenericEvent || event->xcookie.extension != present->opcode)
+        return false;
+
+    // Claimed by the loop when it was read, reading later events frees unclaimed data
+    XGenericEventCookie *cookie = &event->xcookie;
+    bool claimed = !cookie->data && XGetEventData(gctx->display, cookie);
+
+    if (cookie->data && cookie->evtype == PresentCompleteNotify)
+    {
+        XPresentCompleteNotifyEvent *complete = cookie->data;
+
+        if (complete->serial_number == present->serial)
+            present->in_flight = false;
+
+        if (present->msc && complete->msc > present->msc)
+            present->refresh = (complete->ust - present->ust) * 1e-6 / (complete->msc - present->msc);
+
+        present->ust = complete->ust;
+        present->msc = complete->msc;
+    }
+
+    if (claimed)
+    {
+        XFreeEventData(gctx->display, cookie);
+        cookie->data = NULL;
+    }
+
+    return true;
+}
+
+#else
+
+bool present_init(GlobalContext *gctx)
+{
+    (void)gctx;
+    fprintf(stderr, "Present support is not built in, rebuild with -DXREST_PRESENT\n");
+    return false;
+}
+
+
+void present_select(GlobalContext *gctx, WindowContext *wctx)
+{
+    (void)gctx;
+    (void)wctx;
+}
+
+
+void present_frame(GlobalContext *gctx, WindowContext *wctx, XRectangle *rects, int count)
+{
+    (void)gctx;
+    (void)wctx;
+    (void)rects;
+    (void)count;
+}
+
+
+bool present_event(GlobalContext *gctx, XEvent *event)
+{
+    (void)gctx;
+    (void)event;
+    return false;
+}
+
+#endif /* XREST_PRESENT */
+
+
+void present_release(GlobalContext *gctx)
+{
+    gctx->present.in_flight = false;
+}
+
+
+double present_align(GlobalContext *gctx, const Timer *timer, double at, double now)
+{
+    PresentContext *present = &gctx->present;
+    if (!present->enabled || present->refresh <= 0.0 || !isfinite(at))
+        return at;
+
+    // UST is CLOCK_MONOTONIC in microseconds, the clock Timer reads
+    double start = timer->start.tv_sec + timer->start.tv_nsec * 1e-9;
+    double vblank = present->ust * 1e-6 - start;
+
+    // Last vblank predicted by the deadline, just past it so the frame misses none
+    double aligned = vblank + floor((at - vblank) / present->refresh) * present->refresh + PRESENT_MARGIN;
+    while (aligned <= now)
+        aligned += present->refresh;
+    return aligned;
+}
+
+
+void present_report(GlobalContext *gctx)
+{
+    PresentContext *present = &gctx->present;
+    if (!present->enabled)
+        return;
+
+    printf("Presented %lu frames, dropped %lu, refresh %.2f Hz\n",
+           present->presented, present->dropped,
+           present->refresh > 0 ? 1.0 / present->refresh : 0.0);
+}
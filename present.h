@@ -0,0 +1,28 @@
+#ifndef PRESENT_H
+#define PRESENT_H
+
+#include "main.h"
+#include "timer.h"
+
+/* Query the Present extension, false if unavailable or not built in */
+bool present_init(GlobalContext *gctx);
+
+/* Ask for completion events on a window */
+void present_select(GlobalContext *gctx, WindowContext *wctx);
+
+/* Queue the damaged regions of the back buffer for the next vblank */
+void present_frame(GlobalContext *gctx, WindowContext *wctx, XRectangle *rects, int count);
+
+/* Handle PresentCompleteNotify, true if the event was consumed */
+bool present_event(GlobalContext *gctx, XEvent *event);
+
+/* Forget the frame in flight of a window being hidden, its completion may never come */
+void present_release(GlobalContext *gctx);
+
+/* Move a frame deadline at seconds after the timer start onto the predicted vblank before it, after now */
+double present_align(GlobalContext *gctx, const Timer *timer, double at, double now);
+
+/* Print presentation statistics */
+void present_report(GlobalContext *gctx);
+
+#endif /* PRESENT_H */
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "main.h"
+#include "layout.h"
+#include "render.h"
+
+/*
+    Immediate-mode screen renderer.
+
+    A whole screen is drawn in one pass through the operations of a render
+    backend: the background and progress band, the countdown, then the
+    static text on top. Nothing is retained but the text layouts, so every
+    frame is a full repaint, the worst case of the compositor.
+
+    The placement rules live here only. The compositor in scene.c draws its
+    static text through a backend of its own that collects it into layers,
+    and places the countdown and the progress edge with the same helpers.
+
+    The breathing ring and background images are left out, they live in
+    the caches of the display.
+*/
+
+
+static const LayoutFont *font(Renderer *renderer, RenderFont font)
+{
+    return renderer->backend.font(renderer->backend.data, font);
+}
+
+
+static void draw_layout(Renderer *renderer, const TextLayout *layout, RenderFont font, RenderColor color, int x, int y)
+{
+    const RenderBackend *backend = &renderer->backend;
+
+    for (int l = 0; l < layout->line_count; l++)
+    {
+        const LayoutLine *line = &layout->lines[l];
+        if (line->length > 0)
+            backend->text(backend->data, font, color, x + line->x, y + line->y, layout->text + line->offset, line->length);
+    }
+}
+
+
+static void draw_hint(Renderer *renderer, ScreenType type, uint width, uint height, const char *hint_text, int max_width)
+{
+    if (!hint_text || !renderer->config->hints_enabled)
+        return;
+
+    const LayoutFont *hint_font = font(renderer, RENDER_FONT_HINT);
+    TextLayout *hint = &renderer->layouts[type][LAYOUT_HINT];
+    layout_text(hint, hint_font, hint_text, max_width);
+
+    // Bottom aligned, one ascent above the edge
+    int hint_x = ((int)width - max_width) / 2;
+    int hint_y = (int)height - hint->height - hint_font->ascent;
+    draw_layout(renderer, hint, RENDER_FONT_HINT, RENDER_COLOR_HINT, hint_x, hint_y);
+}
+
+
+static void draw_message(Renderer *renderer, ScreenType type, uint width, uint height, const char *title_text, const char *message_text, const char *hint_text)
+{
+    TextLayout *layouts = renderer->layouts[type];
+
+    int pixel_margin = pt_to_px(renderer->config->margin, renderer->dpi);
+    int max_width = (int)width - 2 * pixel_margin;
+
+    layout_text(&layouts[LAYOUT_TITLE], font(renderer, RENDER_FONT_TITLE), title_text, max_width);
+    layout_text(&layouts[LAYOUT_MESSAGE], font(renderer, RENDER_FONT_MESSAGE), message_text, max_width);
+
+    // Title and message centered as one block
+
+    int block_height = layouts[LAYOUT_TITLE].height + pixel_margin + layouts[LAYOUT_MESSAGE].height;
+    int block_x = ((int)width - max_width) / 2;
+    int block_y = ((int)height - block_height) / 2;
+
+    draw_layout(renderer, &layouts[LAYOUT_TITLE], RENDER_FONT_TITLE, RENDER_COLOR_FONT, block_x, block_y);
+    draw_layout(renderer, &layouts[LAYOUT_MESSAGE], RENDER_FONT_MESSAGE, RENDER_COLOR_FONT, block_x, block_y + layouts[LAYOUT_TITLE].height + pixel_margin);
+
+    draw_hint(renderer, type, width, height, hint_text, max_width);
+}
+
+
+static void draw_warning(Renderer *renderer, uint width, uint height, const char *warning_text, const char *hint_text)
+{
+    int pixel_margin = pt_to_px(renderer->config->margin, renderer->dpi);
+    int max_width = (int)width - 2 * pixel_margin;
+
+    // Warning text with a time format is drawn as dynamic text instead
+    if (!strchr(warning_text, '%'))
+    {
+        TextLayout *warning = &renderer->layouts[SCREEN_WARNING][LAYOUT_TITLE];
+        layout_text(warning, font(renderer, RENDER_FONT_MESSAGE), warning_text, max_width);
+
+        int warning_x = ((int)width - max_width) / 2;
+        int warning_y = ((int)height - warning->height) / 2;
+        draw_layout(renderer, warning, RENDER_FONT_MESSAGE, RENDER_COLOR_FONT, warning_x, warning_y);
+    }
+
+    draw_hint(renderer, SCREEN_WARNING, width, height, hint_text, max_width);
+}
+
+
+static void draw_dynamic(Renderer *renderer, ScreenType type, uint width, uint height, uint time)
+{
+    const Config *config = renderer->config;
+    const RenderBackend *backend = &renderer->backend;
+
+    char text[64];
+    RenderFont dynamic_font;
+    RenderColor color;
+
+    if (type == SCREEN_WARNING)
+    {
+        if (!strchr(config->warning_message_text, '%'))
+            return;
+        snprintf(text, sizeof(text), config->warning_message_text, time);
+        dynamic_font = RENDER_FONT_MESSAGE;
+        color = RENDER_COLOR_FONT;
+    }
+    else
+    {
+        if (!config->time_enabled)
+            return;
+        format_time(time, text, sizeof(text));
+        dynamic_font = RENDER_FONT_TIME;
+        color = RENDER_COLOR_BACKGROUND_FONT;
+    }
+
+    const LayoutFont *measure = font(renderer, dynamic_font);
+    int length = strlen(text);
+    XGlyphInfo extents;
+    measure->extents(measure->context, measure->handle, text, length, &extents);
+
+    int x, y;
+    render_dynamic_origin(type, width, height, &extents, &x, &y);
+    backend->text(backend->data, dynamic_font, color, x, y, text, length);
+}
+
+
+void render_dynamic_origin(ScreenType type, uint width, uint height, const XGlyphInfo *extents, int *x, int *y)
+{
+    // The warning centered on its ink, the countdown on its advance a third down
+    if (type == SCREEN_WARNING)
+    {
+        *x = ((int)width - extents->width) / 2;
+        *y = ((int)height - extents->height) / 2 + extents->y;
+    }
+    else
+    {
+        *x = ((int)width - extents->xOff) / 2;
+        *y = ((int)height - extents->yOff) / 3;
+    }
+}
+
+
+int render_progress_edge(uint width, double progress)
+{
+    if (progress < 0.0) progress = 0.0;
+    if (progress > 1.0) progress = 1.0;
+    return width * progress;
+}
+
+
+void render_text(Renderer *renderer, ScreenType type, uint width, uint height)
+{
+    const Config *config = renderer->config;
+
+    switch (type)
+    {
+        case SCREEN_WARNING:
+            draw_warning(renderer, width, height, config->warning_message_text, config->warning_hint_text);
+            break;
+        case SCREEN_BREAK:
+            draw_message(renderer, type, width, height, config->break_title_text, config->break_message_text, config->break_hint_text);
+            break;
+        case SCREEN_END:
+            draw_message(renderer, type, width, height, config->end_title_text, config->end_message_text, config->end_hint_text);
+            break;
+        default:
+            break;
+    }
+}
+
+
+void render_init(Renderer *renderer, const RenderBackend *backend, const Config *config, double dpi)
+{
+    memset(renderer, 0, sizeof(*renderer));
+    renderer->backend = *backend;
+    renderer->config = config;
+    renderer->dpi = dpi;
+}
+
+
+void render_screen(Renderer *renderer, ScreenType type, uint width, uint height, double progress, uint time)
+{
+    const RenderBackend *backend = &renderer->backend;
+
+    // Background and progress
+
+    int edge = render_progress_edge(width, progress);
+    XRectangle band = { 0, 0, edge, height };
+    XRectangle rest = { edge, 0, width - edge, height };
+    if (band.width > 0)
+        backend->fill(backend->data, band, RENDER_COLOR_PROGRESS);
+    if (rest.width > 0)
+        backend->fill(backend->data, rest, RENDER_COLOR_BACKGROUND);
+
+    // Dynamic text goes under the static text
+
+    draw_dynamic(renderer, type, width, height, time);
+    render_text(renderer, type, width, height);
+}
@@ -0,0 +1,21 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "main.h"
+
+/* Bind a renderer to a backend, layouts are computed on first use */
+void render_init(Renderer *renderer, const RenderBackend *backend, const Config *config, double dpi);
+
+/* Draw a whole screen of the given size through the backend */
+void render_screen(Renderer *renderer, ScreenType type, uint width, uint height, double progress, uint time);
+
+/* Draw the static text of a screen through the backend: title, message and hint, or the warning */
+void render_text(Renderer *renderer, ScreenType type, uint width, uint height);
+
+/* Baseline origin of the dynamic text of a screen, the countdown or the warning, from its extents */
+void render_dynamic_origin(ScreenType type, uint width, uint height, const XGlyphInfo *extents, int *x, int *y);
+
+/* Right edge of the progress band, progress clamped to [0, 1] */
+int render_progress_edge(uint width, double progress);
+
+#endif /* RENDER_H */
@@ -0,0 +1,1211 @@
+#include <X11/Xlib.h>
+#include <X11/Xft/Xft.h>
+#include <X11/extensions/Xrender.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "main.h"
+#include "scene.h"
+#include "loop.h"
+#include "atlas.h"
+#include "render.h"
+#include "present.h"
+#include "background.h"
+#include "fade.h"
+#include "breath.h"
+#include "timer.h"
+
+/*
+    Retained-mode screen compositor.
+
+    Static text (title, message, hint) is laid out by the layout engine and
+    rendered once per screen into A8 coverage layers, one per text color.
+    A frame is then composed only over damaged rectangles: background and
+    progress fills or a pre-scaled background image, the dynamic text, and
+    the static layers composited on top through XRender. Only those
+    rectangles are copied to the window. The breathing ring of the break
+    screen is a precomputed mask composited over the background, so it
+    only damages its own square.
+
+    With an MIT-SHM back buffer the same composition runs client-side on
+    copies of the coverage layers, and damaged rectangles are published with
+    XShmPutImage.
+
+    A window can carry several buffers linked as views, one per output
+    size. Each view lays the screen out once for its size and publishes
+    every frame to all outputs of that size.
+
+    A screen can be prepared on an unmapped window: its layers are rendered
+    and the first frame composed into the back buffer, so showing it later
+    is a single publish of the whole window.
+*/
+
+#define SCENE_MAX_TEXTS (LAYOUT_COUNT * LAYOUT_MAX_LINES)
+
+
+typedef struct
+{
+    XftFont *font;
+    XftColor *color;
+    const char *text;
+    int length;
+    int x; // Baseline origin
+    int y;
+    XRectangle rect; // Ink bounds
+} SceneText;
+
+
+static XRectangle ink_rect(const XGlyphInfo *extents, int x, int y)
+{
+    // Pad by a pixel for antialiasing spill
+    XRectangle rect = {
+        x - extents->x - 1,
+        y - extents->y - 1,
+        extents->width + 2,
+        extents->height + 2
+    };
+    return rect;
+}
+
+
+static bool rect_empty(XRectangle r)
+{
+    return r.width == 0 || r.height == 0;
+}
+
+
+static XRectangle rect_union(XRectangle a, XRectangle b)
+{
+    if (rect_empty(a)) return b;
+    if (rect_empty(b)) return a;
+
+    int x0 = a.x < b.x ? a.x : b.x;
+    int y0 = a.y < b.y ? a.y : b.y;
+    int x1 = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+    int y1 = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+
+    XRectangle r = { x0, y0, x1 - x0, y1 - y0 };
+    return r;
+}
+
+
+static bool rect_intersect(XRectangle a, XRectangle b, XRectangle *out)
+{
+    int x0 = a.x > b.x ? a.x : b.x;
+    int y0 = a.y > b.y ? a.y : b.y;
+    int x1 = a.x + a.width < b.x + b.width ? a.x + a.width : b.x + b.width;
+    int y1 = a.y + a.height < b.y + b.height ? a.y + a.height : b.y + b.height;
+
+    if (x1 <= x0 || y1 <= y0)
+        return false;
+
+    XRectangle r = { x0, y0, x1 - x0, y1 - y0 };
+    *out = r;
+    return true;
+}
+
+
+static XRectangle window_rect(WindowContext *wctx)
+{
+    XRectangle r = { 0, 0, wctx->width, wctx->height };
+    return r;
+}
+
+
+static void xft_extents(void *context, void *handle, const char *text, int length, XGlyphInfo *extents)
+{
+    XftTextExtentsUtf8((Display *)context, (XftFont *)handle, (const XftChar8 *)text, length, extents);
+}
+
+
+/* Render backend collecting the static text of a view, placed by render.c, for its layers */
+typedef struct
+{
+    Display *display;
+    LayoutFont fonts[RENDER_FONT_COUNT];
+    XftColor *colors[RENDER_COLOR_COUNT];
+    SceneText texts[SCENE_MAX_TEXTS];
+    int count;
+} SceneCollector;
+
+
+static const LayoutFont *collect_font(void *data, RenderFont font)
+{
+    SceneCollector *collector = data;
+    return &collector->fonts[font];
+}
+
+
+static void collect_fill(void *data, XRectangle r, RenderColor color)
+{
+    // Backgrounds are composed per damaged region, not collected
+    (void)data;
+    (void)r;
+    (void)color;
+}
+
+
+static void collect_text(void *data, RenderFont font, RenderColor color, int x, int y, const char *text, int length)
+{
+    SceneCollector *collector = data;
+    if (collector->count == SCENE_MAX_TEXTS)
+        return;
+
+    XftFont *xft = collector->fonts[font].handle;
+    XGlyphInfo extents;
+    XftTextExtentsUtf8(collector->display, xft, (const XftChar8 *)text, length, &extents);
+
+    SceneText *t = &collector->texts[collector->count++];
+    t->font = xft;
+    t->color = collector->colors[color];
+    t->text = text;
+    t->length = length;
+    t->x = x;
+    t->y = y;
+    t->rect = ink_rect(&extents, x, y);
+}
+
+
+static void collect_init(GlobalContext *gctx, SceneCollector *collector)
+{
+    XftFont *fonts[RENDER_FONT_COUNT] = {
+        [RENDER_FONT_TITLE] = gctx->title_font,
+        [RENDER_FONT_MESSAGE] = gctx->warning_font,
+        [RENDER_FONT_HINT] = gctx->hint_font,
+        [RENDER_FONT_TIME] = gctx->time_font,
+    };
+
+    collector->display = gctx->display;
+    for (int f = 0; f < RENDER_FONT_COUNT; f++)
+        collector->fonts[f] = (LayoutFont){ fonts[f], gctx->display, fonts[f]->ascent, fonts[f]->height, xft_extents };
+
+    collector->colors[RENDER_COLOR_FONT] = &gctx->font_color;
+    collector->colors[RENDER_COLOR_HINT] = &gctx->hint_font_color;
+    collector->colors[RENDER_COLOR_BACKGROUND_FONT] = &gctx->background_font_color;
+    collector->colors[RENDER_COLOR_BACKGROUND] = NULL;
+    collector->colors[RENDER_COLOR_PROGRESS] = NULL;
+    collector->count = 0;
+}
+
+
+static bool build_layer(GlobalContext *gctx, WindowContext *wctx, SceneLayer *layer, XftColor *color, SceneText *texts, int count)
+{
+    XRectangle rect = {0};
+    for (int i = 0; i < count; i++)
+        if (texts[i].color == color)
+            rect = rect_union(rect, texts[i].rect);
+
+    if (!rect_intersect(rect, window_rect(wctx), &rect))
+        return false;
+
+    layer->rect = rect;
+    layer->color = color->color;
+    layer->coverage = NULL;
+    layer->pixmap = XCreatePixmap(gctx->display, wctx->window, rect.width, rect.height, 8);
+    layer->mask = XRenderCreatePicture(gctx->display, layer->pixmap, XRenderFindStandardFormat(gctx->display, PictStandardA8), 0, NULL);
+    layer->fill = XRenderCreateSolidFill(gctx->display, &color->color);
+
+    XRenderColor transparent = {0};
+    XRenderFillRectangle(gctx->display, PictOpSrc, layer->mask, &transparent, 0, 0, rect.width, rect.height);
+
+    XftDraw *draw = XftDrawCreateAlpha(gctx->display, layer->pixmap, 8);
+    for (int i = 0; i < count; i++)
+    {
+        SceneText *t = &texts[i];
+        if (t->color == color)
+            XftDrawStringUtf8(draw, color, t->font, t->x - rect.x, t->y - rect.y, (XftChar8 *)t->text, t->length);
+    }
+    XftDrawDestroy(draw);
+
+    return true;
+}
+
+
+static void add_damage(Scene *scene, XRectangle rect)
+{
+    if (rect_empty(rect))
+        return;
+
+    // Merge into the last region once the list is full
+    if (scene->damage_count == SCENE_MAX_DAMAGE)
+    {
+        XRectangle *last = &scene->damage[SCENE_MAX_DAMAGE - 1];
+        *last = rect_union(*last, rect);
+        return;
+    }
+
+    scene->damage[scene->damage_count++] = rect;
+}
+
+
+static void format_dynamic(GlobalContext *gctx, Scene *scene, uint time, char *out, size_t out_size)
+{
+    if (scene->type == SCREEN_WARNING)
+        snprintf(out, out_size, gctx->config.warning_message_text, time);
+    else
+        format_time(time, out, out_size);
+}
+
+
+static void layout_dynamic(GlobalContext *gctx, WindowContext *wctx)
+{
+    Scene *scene = &wctx->scene;
+    int length = strlen(scene->dynamic_text);
+
+    XGlyphInfo extents;
+    scene->dynamic_from_atlas = scene->dynamic_atlas && atlas_covers(scene->dynamic_atlas, scene->dynamic_text);
+    if (scene->dynamic_from_atlas)
+        atlas_extents(scene->dynamic_atlas, scene->dynamic_text, &extents);
+    else
+        XftTextExtentsUtf8(gctx->display, scene->dynamic_font, (XftChar8 *)scene->dynamic_text, length, &extents);
+
+    render_dynamic_origin(scene->type, wctx->width, wctx->height, &extents, &scene->dynamic_x, &scene->dynamic_y);
+    scene->dynamic_rect = ink_rect(&extents, scene->dynamic_x, scene->dynamic_y);
+
+    if (!wctx->image)
+        return;
+
+    // Client-side composition needs the coverage in memory
+
+    if (scene->dynamic_image)
+    {
+        XDestroyImage(scene->dynamic_image);
+        scene->dynamic_image = NULL;
+    }
+
+    if (scene->dynamic_from_atlas)
+    {
+        atlas_image(gctx->display, scene->dynamic_atlas);
+    }
+    else if (!rect_empty(scene->dynamic_rect))
+    {
+        XRectangle r = scene->dynamic_rect;
+        Pixmap pixmap = XCreatePixmap(gctx->display, wctx->window, r.width, r.height, 8);
+        Picture picture = XRenderCreatePicture(gctx->display, pixmap, XRenderFindStandardFormat(gctx->display, PictStandardA8), 0, NULL);
+
+        XRenderColor transparent = {0};
+        XRenderFillRectangle(gctx->display, PictOpSrc, picture, &transparent, 0, 0, r.width, r.height);
+
+        XftDraw *draw = XftDrawCreateAlpha(gctx->display, pixmap, 8);
+        XftDrawStringUtf8(draw, scene->dynamic_color, scene->dynamic_font, scene->dynamic_x - r.x, scene->dynamic_y - r.y, (XftChar8 *)scene->dynamic_text, length);
+        XftDrawDestroy(draw);
+
+        scene->dynamic_image = XGetImage(gctx->display, pixmap, 0, 0, r.width, r.height, AllPlanes, ZPixmap);
+
+        XRenderFreePicture(gctx->display, picture);
+        XFreePixmap(gctx->display, pixmap);
+    }
+}
+
+
+static void fill_background(GlobalContext *gctx, WindowContext *wctx, Drawable target, XRectangle r, int ox, int oy)
+{
+    Scene *scene = &wctx->scene;
+    const Background *background = scene->background;
+    GC gc = wctx->graphics_context;
+
+    int edge = scene->progress_width;
+    int right = r.x + r.width;
+
+    if (edge > r.x)
+    {
+        int x1 = edge < right ? edge : right;
+        if (background)
+        {
+            XCopyArea(gctx->display, background->tinted, target, gc, scene->background_x + r.x, scene->background_y + r.y, x1 - r.x, r.height, r.x - ox, r.y - oy);
+        }
+        else
+        {
+            XSetForeground(gctx->display, gc, gctx->progress_color.pixel);
+            XFillRectangle(gctx->display, target, gc, r.x - ox, r.y - oy, x1 - r.x, r.height);
+        }
+    }
+    if (edge < right)
+    {
+        int x0 = edge > r.x ? edge : r.x;
+        if (background)
+        {
+            XCopyArea(gctx->display, background->plain, target, gc, scene->background_x + x0, scene->background_y + r.y, right - x0, r.height, x0 - ox, r.y - oy);
+        }
+        else
+        {
+            XSetForeground(gctx->display, gc, gctx->background_color.pixel);
+            XFillRectangle(gctx->display, target, gc, x0 - ox, r.y - oy, right - x0, r.height);
+        }
+    }
+}
+
+
+/* Compose window region r into a drawable whose origin sits at (ox, oy) on the window */
+static void compose(GlobalContext *gctx, WindowContext *wctx, XRectangle r, Drawable target, XftDraw *draw, int ox, int oy)
+{
+    Scene *scene = &wctx->scene;
+
+    // Background and progress
+
+    fill_background(gctx, wctx, target, r, ox, oy);
+
+    XRectangle clip = { r.x - ox, r.y - oy, r.width, r.height };
+    XftDrawSetClipRectangles(draw, 0, 0, &clip, 1);
+    Picture picture = XftDrawPicture(draw);
+
+    // Breathing ring goes under all text
+
+    XRectangle i;
+    if (scene->breath_level >= 0 && rect_intersect(r, scene->breath_rect, &i))
+    {
+        const BreathRing *ring = &gctx->breath.rings[scene->breath_level];
+        XRenderComposite(gctx->display, PictOpOver, scene->breath_fill, ring->mask, picture, 0, 0, i.x - scene->breath_rect.x, i.y - scene->breath_rect.y, i.x - ox, i.y - oy, i.width, i.height);
+    }
+
+    // Dynamic text goes under the static layers
+
+    if (scene->dynamic_enabled && rect_intersect(r, scene->dynamic_rect, &i))
+    {
+        if (scene->dynamic_from_atlas)
+            atlas_draw(gctx->display, scene->dynamic_atlas, scene->dynamic_fill, picture, scene->dynamic_text, scene->dynamic_x - ox, scene->dynamic_y - oy);
+        else
+            XftDrawStringUtf8(draw, scene->dynamic_color, scene->dynamic_font, scene->dynamic_x - ox, scene->dynamic_y - oy, (XftChar8 *)scene->dynamic_text, strlen(scene->dynamic_text));
+    }
+
+    // Static layers
+
+    for (int l = 0; l < scene->layer_count; l++)
+    {
+        SceneLayer *layer = &scene->layers[l];
+        if (rect_intersect(r, layer->rect, &i))
+            XRenderComposite(gctx->display, PictOpOver, layer->fill, layer->mask, picture, 0, 0, i.x - layer->rect.x, i.y - layer->rect.y, i.x - ox, i.y - oy, i.width, i.height);
+    }
+
+    XftDrawSetClip(draw, NULL);
+}
+
+
+#define DIRECT_BOXES (SCENE_MAX_LAYERS + 2)
+
+
+/* Boxes holding text within r, overlapping ones merged so that no two overlap */
+static int text_boxes(const Scene *scene, XRectangle r, XRectangle *boxes)
+{
+    XRectangle rects[DIRECT_BOXES];
+    int rect_count = 0;
+    if (scene->dynamic_enabled)
+        rects[rect_count++] = scene->dynamic_rect;
+    if (scene->breath_level >= 0)
+        rects[rect_count++] = scene->breath_rect;
+    for (int l = 0; l < scene->layer_count; l++)
+        rects[rect_count++] = scene->layers[l].rect;
+
+    int count = 0;
+    for (int i = 0; i < rect_count; i++)
+    {
+        XRectangle box;
+        if (!rect_intersect(r, rects[i], &box))
+            continue;
+
+        // A merged box may reach boxes already passed, look again from the first
+        for (int b = 0; b < count; )
+        {
+            XRectangle overlap;
+            if (rect_intersect(box, boxes[b], &overlap))
+            {
+                box = rect_union(box, boxes[b]);
+                boxes[b] = boxes[--count];
+                b = 0;
+                continue;
+            }
+            b++;
+        }
+        boxes[count++] = box;
+    }
+    return count;
+}
+
+
+static void fill_window(GlobalContext *gctx, WindowContext *wctx, XRectangle r)
+{
+    for (int o = 0; o < wctx->output_count; o++)
+        fill_background(gctx, wctx, wctx->window, r, -wctx->outputs[o].x, -wctx->outputs[o].y);
+}
+
+
+static void sort_ints(int *values, int count)
+{
+    for (int i = 1; i < count; i++)
+        for (int j = i; j > 0 && values[j - 1] > values[j]; j--)
+        {
+            int t = values[j];
+            values[j] = values[j - 1];
+            values[j - 1] = t;
+        }
+}
+
+
+/* Fill r around disjoint boxes in horizontal bands, each box spans a band whole or not at all */
+static void fill_around(GlobalContext *gctx, WindowContext *wctx, XRectangle r, const XRectangle *boxes, int count)
+{
+    int edges[2 * DIRECT_BOXES + 2];
+    int edge_count = 0;
+    edges[edge_count++] = r.y;
+    edges[edge_count++] = r.y + r.height;
+    for (int b = 0; b < count; b++)
+    {
+        edges[edge_count++] = boxes[b].y;
+        edges[edge_count++] = boxes[b].y + boxes[b].height;
+    }
+    sort_ints(edges, edge_count);
+
+    for (int e = 0; e + 1 < edge_count; e++)
+    {
+        int y0 = edges[e];
+        int y1 = edges[e + 1];
+        if (y0 == y1)
+            continue;
+
+        // Boxes crossing the band, left to right
+        int order[DIRECT_BOXES];
+        int crossing = 0;
+        for (int b = 0; b < count; b++)
+            if (boxes[b].y <= y0 && boxes[b].y + boxes[b].height >= y1)
+                order[crossing++] = b;
+
+        for (int i = 1; i < crossing; i++)
+            for (int j = i; j > 0 && boxes[order[j - 1]].x > boxes[order[j]].x; j--)
+            {
+                int t = order[j];
+                order[j] = order[j - 1];
+                order[j - 1] = t;
+            }
+
+        int x = r.x;
+        for (int i = 0; i < crossing; i++)
+        {
+            const XRectangle *box = &boxes[order[i]];
+            if (box->x > x)
+                fill_window(gctx, wctx, (XRectangle){ x, y0, box->x - x, y1 - y0 });
+            x = box->x + box->width;
+        }
+        if (x < r.x + r.width)
+            fill_window(gctx, wctx, (XRectangle){ x, y0, r.x + r.width - x, y1 - y0 });
+    }
+}
+
+
+/* Have a scratch pixmap for the largest text box, shrunk once it is more than twice the size needed */
+static void size_scratch(GlobalContext *gctx, WindowContext *wctx)
+{
+    XRectangle boxes[DIRECT_BOXES];
+    int count = text_boxes(&wctx->scene, window_rect(wctx), boxes);
+
+    uint width = 1;
+    uint height = 1;
+    for (int b = 0; b < count; b++)
+    {
+        width = boxes[b].width > width ? boxes[b].width : width;
+        height = boxes[b].height > height ? boxes[b].height : height;
+    }
+
+    bool fits = width <= wctx->scratch_width && height <= wctx->scratch_height;
+    bool oversized = (unsigned long)width * height * 2 < (unsigned long)wctx->scratch_width * wctx->scratch_height;
+    if (wctx->scratch && fits && !oversized)
+        return;
+
+    if (wctx->scratch_context)
+        XftDrawDestroy(wctx->scratch_context);
+    if (wctx->scratch)
+        XFreePixmap(gctx->display, wctx->scratch);
+
+    wctx->scratch_width = width;
+    wctx->scratch_height = height;
+    wctx->scratch = XCreatePixmap(gctx->display, wctx->window, width, height, gctx->depth);
+    wctx->scratch_context = XftDrawCreate(gctx->display, wctx->scratch, gctx->visual, gctx->colormap);
+}
+
+
+/*
+    Low-memory composition straight onto the window. Plain background and
+    progress bands are filled on the window, each box of text goes through
+    a scratch pixmap no larger than the largest box. Overlapping boxes are
+    merged first, so every pixel is written once and nothing flickers.
+*/
+static void compose_direct(GlobalContext *gctx, WindowContext *wctx, XRectangle r)
+{
+    XRectangle boxes[DIRECT_BOXES];
+    int count = text_boxes(&wctx->scene, r, boxes);
+
+    fill_around(gctx, wctx, r, boxes, count);
+    if (count == 0)
+        return;
+
+    size_scratch(gctx, wctx);
+
+    // Each box composed once, copied to every output
+    for (int b = 0; b < count; b++)
+    {
+        XRectangle t = boxes[b];
+        compose(gctx, wctx, t, wctx->scratch, wctx->scratch_context, t.x, t.y);
+        for (int o = 0; o < wctx->output_count; o++)
+            XCopyArea(gctx->display, wctx->scratch, wctx->window, wctx->graphics_context, 0, 0, t.width, t.height, wctx->outputs[o].x + t.x, wctx->outputs[o].y + t.y);
+    }
+}
+
+
+static int mask_shift(unsigned long mask)
+{
+    int shift = 0;
+    while (mask && !(mask & 1))
+    {
+        mask >>= 1;
+        shift++;
+    }
+    return shift;
+}
+
+
+static void image_fill(XImage *image, XRectangle r, unsigned long pixel)
+{
+    for (int y = r.y; y < r.y + r.height; y++)
+    {
+        uint32_t *row = (uint32_t *)(image->data + y * image->bytes_per_line);
+        for (int x = r.x; x < r.x + r.width; x++)
+            row[x] = pixel;
+    }
+}
+
+
+/* Copy region r from an image of the same format, (sx, sy) is the source origin of the image */
+static void image_copy(XImage *image, XRectangle r, const XImage *source, int sx, int sy)
+{
+    for (int y = r.y; y < r.y + r.height; y++)
+    {
+        uint32_t *dst = (uint32_t *)(image->data + y * image->bytes_per_line) + r.x;
+        const uint32_t *src = (const uint32_t *)(source->data + (sy + y) * source->bytes_per_line) + sx + r.x;
+        memcpy(dst, src, r.width * sizeof(uint32_t));
+    }
+}
+
+
+/* Blend a solid color through A8 coverage, (cx, cy) is the coverage origin of r */
+static void image_blend(GlobalContext *gctx, XImage *image, XRectangle r, const XImage *coverage, int cx, int cy, const XRenderColor *color)
+{
+    int rs = mask_shift(gctx->visual->red_mask);
+    int gs = mask_shift(gctx->visual->green_mask);
+    int bs = mask_shift(gctx->visual->blue_mask);
+
+    uint32_t cr = color->red >> 8;
+    uint32_t cg = color->green >> 8;
+    uint32_t cb = color->blue >> 8;
+    uint32_t alpha = gctx->alpha_mask;
+    uint32_t solid = (cr << rs) | (cg << gs) | (cb << bs) | alpha;
+
+    for (int y = 0; y < r.height; y++)
+    {
+        uint32_t *dst = (uint32_t *)(image->data + (r.y + y) * image->bytes_per_line) + r.x;
+        const uint8_t *src = (const uint8_t *)coverage->data + (cy + y) * coverage->bytes_per_line + cx;
+
+        for (int x = 0; x < r.width; x++)
+        {
+            uint32_t a = src[x];
+            if (a == 0)
+                continue;
+            if (a == 255)
+            {
+                dst[x] = solid;
+                continue;
+            }
+
+            uint32_t d = dst[x];
+            uint32_t dr = ((d >> rs) & 0xff) * (255 - a) + cr * a;
+            uint32_t dg = ((d >> gs) & 0xff) * (255 - a) + cg * a;
+            uint32_t db = ((d >> bs) & 0xff) * (255 - a) + cb * a;
+            dst[x] = ((dr / 255) << rs) | ((dg / 255) << gs) | ((db / 255) << bs) | alpha;
+        }
+    }
+}
+
+
+static void compose_image(GlobalContext *gctx, WindowContext *wctx, XRectangle r)
+{
+    Scene *scene = &wctx->scene;
+    XImage *image = wctx->image;
+
+    // Background and progress
+
+    int edge = scene->progress_width;
+    int right = r.x + r.width;
+
+    const Background *background = scene->background;
+
+    if (edge > r.x)
+    {
+        XRectangle fill = { r.x, r.y, (edge < right ? edge : right) - r.x, r.height };
+        if (background)
+            image_copy(image, fill, background->tinted_image, scene->background_x, scene->background_y);
+        else
+            image_fill(image, fill, gctx->progress_color.pixel);
+    }
+    if (edge < right)
+    {
+        int x0 = edge > r.x ? edge : r.x;
+        XRectangle fill = { x0, r.y, right - x0, r.height };
+        if (background)
+            image_copy(image, fill, background->plain_image, scene->background_x, scene->background_y);
+        else
+            image_fill(image, fill, gctx->background_color.pixel);
+    }
+
+    // Breathing ring goes under all text
+
+    XRectangle i;
+    if (scene->breath_level >= 0 && rect_intersect(r, scene->breath_rect, &i))
+    {
+        const BreathRing *ring = &gctx->breath.rings[scene->breath_level];
+        image_blend(gctx, image, i, ring->image, i.x - scene->breath_rect.x, i.y - scene->breath_rect.y, &gctx->background_font_color.color);
+    }
+
+    // Dynamic text goes under the static layers
+
+    if (scene->dynamic_enabled && rect_intersect(r, scene->dynamic_rect, &i))
+    {
+        const XRenderColor *color = &scene->dynamic_color->color;
+
+        if (scene->dynamic_from_atlas && scene->dynamic_atlas->image)
+        {
+            const GlyphAtlas *atlas = scene->dynamic_atlas;
+            int pen = scene->dynamic_x;
+
+            for (const unsigned char *c = (const unsigned char *)scene->dynamic_text; *c; c++)
+            {
+                XRectangle cell = { pen - atlas->bearing[*c], scene->dynamic_y - atlas->top, atlas->cell_width[*c], atlas->height };
+                XRectangle g;
+                if (rect_intersect(i, cell, &g))
+                    image_blend(gctx, image, g, atlas->image, atlas->cell_x[*c] + g.x - cell.x, g.y - cell.y, color);
+                pen += atlas->advance[*c];
+            }
+        }
+        else if (scene->dynamic_image)
+        {
+            image_blend(gctx, image, i, scene->dynamic_image, i.x - scene->dynamic_rect.x, i.y - scene->dynamic_rect.y, color);
+        }
+    }
+
+    // Static layers
+
+    for (int l = 0; l < scene->layer_count; l++)
+    {
+        SceneLayer *layer = &scene->layers[l];
+        if (layer->coverage && rect_intersect(r, layer->rect, &i))
+            image_blend(gctx, image, i, layer->coverage, i.x - layer->rect.x, i.y - layer->rect.y, &layer->color);
+    }
+}
+
+
+/* Copy buffer region r to one output area of the window */
+static void publish_output(GlobalContext *gctx, WindowContext *wctx, XRectangle r, XRectangle output)
+{
+    int x = output.x + r.x;
+    int y = output.y + r.y;
+
+    // Translucent windows go through their opacity mask
+    if (fade_publish(gctx, wctx, r, output))
+        return;
+
+    if (wctx->image)
+    {
+        XShmPutImage(gctx->display, wctx->window, wctx->graphics_context, wctx->image, r.x, r.y, x, y, r.width, r.height, True);
+        wctx->shm_pending++;
+    }
+    else
+    {
+        XCopyArea(gctx->display, wctx->draw_buffer, wctx->window, wctx->graphics_context, r.x, r.y, r.width, r.height, x, y);
+    }
+}
+
+
+static void publish(GlobalContext *gctx, WindowContext *wctx, XRectangle r)
+{
+    for (int o = 0; o < wctx->output_count; o++)
+        publish_output(gctx, wctx, r, wctx->outputs[o]);
+}
+
+
+typedef struct
+{
+    int type;
+    ShmSeg segment;
+} ShmWait;
+
+
+static Bool is_shm_completion(Display *display, XEvent *event, XPointer arg)
+{
+    (void)display;
+    ShmWait *wait = (ShmWait *)arg;
+    return event->type == wait->type && ((XShmCompletionEvent *)event)->shmseg == wait->segment;
+}
+
+
+static void wait_shm(GlobalContext *gctx, WindowContext *wctx)
+{
+    ShmWait wait = { gctx->shm_completion, wctx->shm_info.shmseg };
+    XEvent event;
+    while (wctx->shm_pending > 0)
+    {
+        // May already be in the batch the loop is handling
+        loop_claim(gctx, is_shm_completion, (XPointer)&wait, &event);
+        wctx->shm_pending--;
+    }
+}
+
+
+void scene_wait_shm(GlobalContext *gctx, WindowContext *wctx)
+{
+    for (WindowContext *view = wctx; view; view = view->next)
+        wait_shm(gctx, view);
+}
+
+
+static void flush(GlobalContext *gctx, WindowContext *wctx)
+{
+    Scene *scene = &wctx->scene;
+
+    // Nothing to compose onto before the window is mapped
+    if (scene->hidden && gctx->config.low_memory)
+        return;
+
+    // Compose and publish damaged regions
+
+    if (wctx->image)
+        wait_shm(gctx, wctx); // Server may still be reading the image
+
+    XRectangle rects[SCENE_MAX_DAMAGE];
+    int count = 0;
+
+    for (int d = 0; d < scene->damage_count; d++)
+    {
+        XRectangle r;
+        if (!rect_intersect(scene->damage[d], window_rect(wctx), &r))
+            continue;
+
+        if (gctx->config.low_memory)
+        {
+            compose_direct(gctx, wctx, r);
+            continue;
+        }
+
+        if (wctx->image)
+            compose_image(gctx, wctx, r);
+        else
+            compose(gctx, wctx, r, wctx->draw_buffer, wctx->draw_context, 0, 0);
+
+        if (scene->hidden)
+            continue; // Published as a whole by scene_show
+        if (gctx->present.enabled && !wctx->fade.mask)
+            rects[count++] = r;
+        else
+            publish(gctx, wctx, r);
+    }
+    scene->damage_count = 0;
+
+    if (count > 0)
+        present_frame(gctx, wctx, rects, count);
+
+    XFlush(gctx->display);
+}
+
+
+static void free_view(GlobalContext *gctx, WindowContext *wctx);
+
+
+static void build_view(GlobalContext *gctx, WindowContext *wctx, ScreenType type)
+{
+    Scene *scene = &wctx->scene;
+    Config *config = &gctx->config;
+
+    free_view(gctx, wctx);
+    scene->type = type;
+
+    // Dynamic text
+
+    if (type == SCREEN_WARNING)
+    {
+        scene->dynamic_enabled = strchr(config->warning_message_text, '%') != NULL;
+        scene->dynamic_font = gctx->warning_font;
+        scene->dynamic_color = &gctx->font_color;
+        scene->dynamic_atlas = &gctx->warning_atlas;
+    }
+    else
+    {
+        scene->dynamic_enabled = config->time_enabled;
+        scene->dynamic_font = gctx->time_font;
+        scene->dynamic_color = &gctx->background_font_color;
+        scene->dynamic_atlas = &gctx->time_atlas;
+    }
+    scene->dynamic_text[0] = '\0';
+    if (scene->dynamic_enabled)
+        scene->dynamic_fill = XRenderCreateSolidFill(gctx->display, &scene->dynamic_color->color);
+    memset(&scene->dynamic_rect, 0, sizeof(scene->dynamic_rect));
+
+    // Breathing ring, drawn in the color of the countdown
+
+    scene->breath_enabled = type == SCREEN_BREAK && gctx->breath.enabled;
+    scene->breath_level = -1;
+    memset(&scene->breath_rect, 0, sizeof(scene->breath_rect));
+    if (scene->breath_enabled)
+        scene->breath_fill = XRenderCreateSolidFill(gctx->display, &gctx->background_font_color.color);
+
+    // Desktop snapshot under every screen, otherwise the image under the break and end
+
+    scene->background_x = 0;
+    scene->background_y = 0;
+    if (gctx->snapshot.valid)
+    {
+        scene->background = &gctx->snapshot.background;
+        scene->background_x = wctx->root_x + wctx->outputs[0].x;
+        scene->background_y = wctx->root_y + wctx->outputs[0].y;
+    }
+    else
+    {
+        scene->background = type == SCREEN_WARNING ? NULL : background_get(gctx, wctx->width, wctx->height);
+    }
+
+    // Static text, placed by the renderer and collected for the layers
+
+    SceneCollector collector;
+    collect_init(gctx, &collector);
+
+    Renderer *renderer = &gctx->renderer;
+    if (!renderer->config)
+    {
+        RenderBackend backend = { "xrender", NULL, collect_font, collect_fill, collect_text };
+        render_init(renderer, &backend, config, gctx->dpi);
+    }
+    renderer->backend.data = &collector;
+    render_text(renderer, type, wctx->width, wctx->height);
+    renderer->backend.data = NULL;
+
+    SceneText *texts = collector.texts;
+    int count = collector.count;
+
+    XftColor *colors[SCENE_MAX_LAYERS] = { &gctx->font_color, &gctx->hint_font_color };
+    for (int c = 0; c < SCENE_MAX_LAYERS; c++)
+    {
+        SceneLayer *layer = &scene->layers[scene->layer_count];
+        if (!build_layer(gctx, wctx, layer, colors[c], texts, count))
+            continue;
+
+        if (wctx->image)
+            layer->coverage = XGetImage(gctx->display, layer->pixmap, 0, 0, layer->rect.width, layer->rect.height, AllPlanes, ZPixmap);
+        scene->layer_count++;
+    }
+
+    // First frame repaints everything
+
+    scene->progress_width = 0;
+    scene->damage_count = 0;
+    add_damage(scene, window_rect(wctx));
+    scene->valid = true;
+}
+
+
+void scene_build(GlobalContext *gctx, WindowContext *wctx, ScreenType type)
+{
+    for (WindowContext *view = wctx; view; view = view->next)
+        build_view(gctx, view, type);
+}
+
+
+/* Collect the damage of a new frame, true if anything changed */
+static bool update_view(GlobalContext *gctx, WindowContext *wctx, double progress, uint time, bool *breathing)
+{
+    Scene *scene = &wctx->scene;
+    if (!scene->valid)
+        return false;
+
+    // Progress edge
+
+    if (progress < 0.0) progress = 0.0;
+    if (progress > 1.0) progress = 1.0;
+
+    int progress_width = render_progress_edge(wctx->width, progress);
+    if (progress_width != scene->progress_width)
+    {
+        int x0 = progress_width < scene->progress_width ? progress_width : scene->progress_width;
+        int x1 = progress_width > scene->progress_width ? progress_width : scene->progress_width;
+        XRectangle strip = { x0, 0, x1 - x0, wctx->height };
+        add_damage(scene, strip);
+        scene->progress_width = progress_width;
+    }
+
+    // Breathing ring, the break progress gives its time
+
+    if (scene->breath_enabled)
+    {
+        int level = breath_level(gctx, progress * gctx->config.break_duration);
+        if (level != scene->breath_level)
+        {
+            int size = gctx->breath.rings[level].size;
+            XRectangle rect = { ((int)wctx->width - size) / 2, ((int)wctx->height - size) / 2, size, size };
+
+            // Concentric, the larger square covers both rings
+            add_damage(scene, rect_union(scene->breath_rect, rect));
+            scene->breath_rect = rect;
+            scene->breath_level = level;
+            *breathing = true;
+        }
+    }
+
+    // Dynamic text
+
+    if (scene->dynamic_enabled)
+    {
+        char text[sizeof(scene->dynamic_text)];
+        format_dynamic(gctx, scene, time, text, sizeof(text));
+
+        if (strcmp(text, scene->dynamic_text) != 0)
+        {
+            add_damage(scene, scene->dynamic_rect);
+            strcpy(scene->dynamic_text, text);
+            layout_dynamic(gctx, wctx);
+            add_damage(scene, scene->dynamic_rect);
+        }
+    }
+
+    return scene->damage_count > 0;
+}
+
+
+void scene_draw(GlobalContext *gctx, WindowContext *wctx, double progress, uint time)
+{
+    Timer timer = {0};
+    timer_start(&timer);
+
+    bool damaged = false;
+    bool breathing = false;
+    for (WindowContext *view = wctx; view; view = view->next)
+        damaged |= update_view(gctx, view, progress, time, &breathing);
+
+    if (!damaged)
+        return;
+
+    // Previous frame still waits for its vblank, carry the damage over
+    if (gctx->present.in_flight && !wctx->scene.hidden)
+    {
+        gctx->present.dropped++;
+        return;
+    }
+
+    // A view whose buffer the server still reads is flushed by its completion, keys don't wait on it
+    for (WindowContext *view = wctx; view; view = view->next)
+        if (view->scene.damage_count > 0 && (view->scene.hidden || view->shm_pending == 0))
+            flush(gctx, view);
+
+    // No round trip, the server's share is told by a fence
+    if (breathing && !wctx->scene.hidden)
+        breath_frame(gctx, timer_elapsed(&timer));
+}
+
+
+void scene_prepare(GlobalContext *gctx, WindowContext *wctx, ScreenType type, double progress, uint time)
+{
+    scene_build(gctx, wctx, type);
+    for (WindowContext *view = wctx; view; view = view->next)
+        view->scene.hidden = true;
+    scene_draw(gctx, wctx, progress, time);
+}
+
+
+static void show_view(GlobalContext *gctx, WindowContext *wctx)
+{
+    Scene *scene = &wctx->scene;
+    if (!scene->valid || !scene->hidden)
+        return;
+
+    // Low-memory mode composes straight onto the window, only now possible
+    if (gctx->config.low_memory)
+    {
+        scene->hidden = false;
+        flush(gctx, wctx);
+        return;
+    }
+
+    if (scene->damage_count > 0)
+        flush(gctx, wctx);
+    scene->hidden = false;
+
+    XRectangle r = window_rect(wctx);
+    if (gctx->present.enabled && !wctx->fade.mask)
+        present_frame(gctx, wctx, &r, 1);
+    else
+        publish(gctx, wctx, r);
+}
+
+
+void scene_show(GlobalContext *gctx, WindowContext *wctx)
+{
+    for (WindowContext *view = wctx; view; view = view->next)
+        show_view(gctx, view);
+    XFlush(gctx->display);
+}
+
+
+static double next_view_change(GlobalContext *gctx, WindowContext *wctx, double elapsed, double duration)
+{
+    Scene *scene = &wctx->scene;
+
+    // Nudge past boundaries so truncation in the frame sees the new value
+    const double epsilon = 1e-6;
+    double next = duration;
+    double time_left = duration - elapsed;
+
+    // Countdown text changes on whole seconds, the granularity of format_time
+    if (scene->dynamic_enabled)
+    {
+        double tick = duration - floor(time_left);
+        if (tick <= elapsed)
+            tick += 1.0;
+        next = fmin(next, tick + epsilon);
+    }
+
+    // Progress edge moves by whole pixels of the window width
+    if (wctx->width > 0)
+    {
+        double pixel = duration / wctx->width;
+        double edge;
+
+        if (scene->type == SCREEN_WARNING)
+        {
+            // Shrinks with the time left
+            edge = duration - floor(time_left / pixel) * pixel;
+            if (edge <= elapsed)
+                edge += pixel;
+        }
+        else
+        {
+            edge = (floor(elapsed / pixel) + 1.0) * pixel;
+        }
+        next = fmin(next, edge + epsilon);
+    }
+
+    if (scene->breath_enabled)
+        next = fmin(next, breath_next(gctx, elapsed));
+
+    return next;
+}
+
+
+double scene_next_change(GlobalContext *gctx, WindowContext *wctx, double elapsed, double duration)
+{
+    double next = duration;
+    for (WindowContext *view = wctx; view; view = view->next)
+        next = fmin(next, next_view_change(gctx, view, elapsed, duration));
+    return next;
+}
+
+
+static void expose_view(GlobalContext *gctx, WindowContext *wctx, XRectangle exposed)
+{
+    for (int o = 0; o < wctx->output_count; o++)
+    {
+        XRectangle output = wctx->outputs[o];
+        XRectangle r;
+        if (!rect_intersect(exposed, output, &r))
+            continue;
+
+        // To buffer coordinates
+        r.x -= output.x;
+        r.y -= output.y;
+
+        // Without a back buffer the region has to be recomposed
+        if (gctx->config.low_memory)
+            add_damage(&wctx->scene, r);
+        else
+            publish_output(gctx, wctx, r, output); // Republish from the back buffer, nothing to recompose
+    }
+
+    if (gctx->config.low_memory && !gctx->present.in_flight && wctx->scene.damage_count > 0)
+        flush(gctx, wctx);
+}
+
+
+bool scene_event(GlobalContext *gctx, WindowContext *wctx, XEvent *event)
+{
+    if (present_event(gctx, event))
+    {
+        // Publish what was dropped while the last frame was in flight
+        for (WindowContext *view = wctx; view; view = view->next)
+            if (view->scene.valid && !view->scene.hidden && !gctx->present.in_flight && view->scene.damage_count > 0)
+                flush(gctx, view);
+        return true;
+    }
+
+    if (gctx->shm && event->type == gctx->shm_completion)
+    {
+        // Windows are drained before they are released, so others have nothing pending
+        ShmSeg segment = ((XShmCompletionEvent *)event)->shmseg;
+        for (WindowContext *view = wctx; view; view = view->next)
+        {
+            if (view->shm_info.shmseg != segment || view->shm_pending == 0)
+                continue;
+
+            // Publish what was put off while the server read the buffer
+            if (--view->shm_pending == 0 && view->scene.valid && !view->scene.hidden && !gctx->present.in_flight && view->scene.damage_count > 0)
+                flush(gctx, view);
+        }
+        return true;
+    }
+
+    if (event->type == Expose)
+    {
+        XRectangle exposed = { event->xexpose.x, event->xexpose.y, event->xexpose.width, event->xexpose.height };
+        for (WindowContext *view = wctx; view; view = view->next)
+            if (view->scene.valid && !view->scene.hidden)
+                expose_view(gctx, view, exposed);
+
+        XFlush(gctx->display);
+        return true;
+    }
+
+    return false;
+}
+
+
+static void free_view(GlobalContext *gctx, WindowContext *wctx)
+{
+    Scene *scene = &wctx->scene;
+
+    for (int l = 0; l < scene->layer_count; l++)
+    {
+        SceneLayer *layer = &scene->layers[l];
+        if (layer->coverage)
+            XDestroyImage(layer->coverage);
+        XRenderFreePicture(gctx->display, layer->fill);
+        XRenderFreePicture(gctx->display, layer->mask);
+        XFreePixmap(gctx->display, layer->pixmap);
+    }
+
+    if (scene->dynamic_fill)
+        XRenderFreePicture(gctx->display, scene->dynamic_fill);
+    if (scene->breath_fill)
+        XRenderFreePicture(gctx->display, scene->breath_fill);
+    if (scene->dynamic_image)
+        XDestroyImage(scene->dynamic_image);
+
+    scene->dynamic_image = NULL;
+    scene->background = NULL;
+    scene->dynamic_fill = None;
+    scene->breath_fill = None;
+    scene->breath_level = -1;
+    scene->layer_count = 0;
+    scene->damage_count = 0;
+    scene->hidden = false;
+    scene->valid = false;
+}
+
+
+void scene_free(GlobalContext *gctx, WindowContext *wctx)
+{
+    for (WindowContext *view = wctx; view; view = view->next)
+        free_view(gctx, view);
+}
@@ -0,0 +1,30 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "main.h"
+
+/* Render static content of a screen into cached layers */
+void scene_build(GlobalContext *gctx, WindowContext *wctx, ScreenType type);
+
+/* Compose and publish only the regions changed since the last frame */
+void scene_draw(GlobalContext *gctx, WindowContext *wctx, double progress, uint time);
+
+/* Build a screen on an unmapped window and compose its first frame without publishing it */
+void scene_prepare(GlobalContext *gctx, WindowContext *wctx, ScreenType type, double progress, uint time);
+
+/* Publish a prepared frame once the window is mapped */
+void scene_show(GlobalContext *gctx, WindowContext *wctx);
+
+/* Elapsed time at which the frame will next differ from the current one */
+double scene_next_change(GlobalContext *gctx, WindowContext *wctx, double elapsed, double duration);
+
+/* Handle Expose, ShmCompletion and PresentCompleteNotify events, true if the event was consumed */
+bool scene_event(GlobalContext *gctx, WindowContext *wctx, XEvent *event);
+
+/* Block until the server has finished reading the SHM back buffer */
+void scene_wait_shm(GlobalContext *gctx, WindowContext *wctx);
+
+/* Release cached layers */
+void scene_free(GlobalContext *gctx, WindowContext *wctx);
+
+#endif /* SCENE_H */
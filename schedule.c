@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "main.h"
+#include "timer.h"
+#include "config.h"
+#include "schedule.h"
+
+/*
+    Break schedules.
+
+    Each schedule runs its own work period and break. Their deadlines sit
+    in a binary min-heap, so the wait only ever looks at the root and
+    sleeps until it, however many schedules there are.
+
+    Schedules that coincide are merged: when the nearest one comes due,
+    every other deadline falling before its break would end is taken
+    along, and the longest break of them is the one shown. Once a break is
+    over, every schedule with a break no longer than it starts a new work
+    period, so a long break absorbs the micro-breaks it covers. Time away
+    from the computer counts the same way for section schedules; the
+    single schedule of a config without sections starts over after any
+    time away past idle_limit, as it always has.
+*/
+
+
+static double now(const ScheduleContext *ctx)
+{
+    Timer timer = { ctx->epoch };
+    return timer_elapsed(&timer);
+}
+
+
+static bool earlier(const ScheduleContext *ctx, int a, int b)
+{
+    return ctx->due[ctx->heap[a]] < ctx->due[ctx->heap[b]];
+}
+
+
+static void swap(ScheduleContext *ctx, int a, int b)
+{
+    int t = ctx->heap[a];
+    ctx->heap[a] = ctx->heap[b];
+    ctx->heap[b] = t;
+}
+
+
+static void sift_down(ScheduleContext *ctx, int node)
+{
+    while (true)
+    {
+        int first = node;
+        int left = 2 * node + 1;
+        int right = left + 1;
+
+        if (left < ctx->count && earlier(ctx, left, first))
+            first = left;
+        if (right < ctx->count && earlier(ctx, right, first))
+            first = right;
+        if (first == node)
+            return;
+
+        swap(ctx, node, first);
+        node = first;
+    }
+}
+
+
+/* Deadlines change in groups, rebuilding is as cheap as fixing each */
+static void heapify(ScheduleContext *ctx)
+{
+    for (int node = ctx->count / 2 - 1; node >= 0; node--)
+        sift_down(ctx, node);
+}
+
+
+/* Longest break among the schedules due by horizon, a subtree is skipped once its root is later */
+static int longest(const ScheduleContext *ctx, int node, double horizon, int best)
+{
+    if (node >= ctx->count)
+        return best;
+
+    int s = ctx->heap[node];
+    if (ctx->due[s] > horizon)
+        return best;
+
+    if (ctx->schedules[s].break_duration > ctx->schedules[best].break_duration)
+        best = s;
+
+    best = longest(ctx, 2 * node + 1, horizon, best);
+    return longest(ctx, 2 * node + 2, horizon, best);
+}
+
+
+static void apply(const Schedule *schedule, Config *config)
+{
+    config->timer_duration = schedule->timer_duration;
+    config->break_duration = schedule->break_duration;
+    config->warning_duration = schedule->warning_duration;
+    strcpy(config->break_title_text, schedule->break_title_text);
+    strcpy(config->break_message_text, schedule->break_message_text);
+    strcpy(config->break_hint_text, schedule->break_hint_text);
+    strcpy(config->start_sound_path, schedule->start_sound_path);
+    strcpy(config->end_sound_path, schedule->end_sound_path);
+}
+
+
+void schedule_init(GlobalContext *gctx)
+{
+    ScheduleContext *ctx = &gctx->schedule;
+    memset(ctx, 0, sizeof(*ctx));
+
+    // Sections are copied while loading and get debug durations from load_dev
+    if (gctx->config.schedule_count > 0)
+    {
+        ctx->count = gctx->config.schedule_count;
+        memcpy(ctx->schedules, gctx->config.schedules, ctx->count * sizeof(Schedule));
+        ctx->sections = true;
+    }
+    else
+    {
+        // Taken here and not while loading, so debug durations apply too
+        ctx->count = 1;
+        load_schedule(&ctx->schedules[0], &gctx->config, "break");
+    }
+
+    timer_now(&ctx->epoch);
+    for (int s = 0; s < ctx->count; s++)
+    {
+        ctx->due[s] = ctx->schedules[s].timer_duration;
+        ctx->heap[s] = s;
+    }
+    heapify(ctx);
+
+    ctx->active = -1;
+    ctx->prepared = -1;
+
+    if (gctx->debug)
+        for (int s = 0; s < ctx->count; s++)
+            printf("Schedule %s: %lds work, %lds break\n", ctx->schedules[s].name,
+                   (long)ctx->schedules[s].timer_duration, (long)ctx->schedules[s].break_duration);
+}
+
+
+double schedule_left(GlobalContext *gctx)
+{
+    ScheduleContext *ctx = &gctx->schedule;
+    return ctx->due[ctx->heap[0]] - now(ctx);
+}
+
+
+void schedule_pick(GlobalContext *gctx)
+{
+    ScheduleContext *ctx = &gctx->schedule;
+    if (ctx->active >= 0)
+        return;
+
+    int first = ctx->heap[0];
+    double horizon = ctx->due[first] + ctx->schedules[first].break_duration;
+    ctx->active = longest(ctx, 0, horizon, first);
+
+    apply(&ctx->schedules[ctx->active], &gctx->config);
+
+    if (gctx->debug && ctx->active != first)
+        printf("Schedule %s merged into %s\n", ctx->schedules[first].name, ctx->schedules[ctx->active].name);
+}
+
+
+/* Start a new work period for every schedule with a break no longer than rest */
+static void rest(ScheduleContext *ctx, double seconds)
+{
+    double t = now(ctx);
+    for (int s = 0; s < ctx->count; s++)
+        if (ctx->schedules[s].break_duration <= seconds)
+            ctx->due[s] = t + ctx->schedules[s].timer_duration;
+    heapify(ctx);
+
+    ctx->active = -1;
+}
+
+
+void schedule_rest(GlobalContext *gctx, double seconds)
+{
+    ScheduleContext *ctx = &gctx->schedule;
+
+    // Without sections idle_limit alone decides, whatever the break length
+    if (!ctx->sections)
+    {
+        if (seconds >= gctx->config.idle_limit)
+            rest(ctx, ctx->schedules[0].break_duration);
+        return;
+    }
+
+    rest(ctx, seconds);
+}
+
+
+void schedule_spend(GlobalContext *gctx, double seconds)
+{
+    // Every deadline moves alike, the heap keeps its order
+    ScheduleContext *ctx = &gctx->schedule;
+    for (int s = 0; s < ctx->count; s++)
+        ctx->due[s] -= seconds;
+}
+
+
+void schedule_done(GlobalContext *gctx)
+{
+    ScheduleContext *ctx = &gctx->schedule;
+    if (ctx->active >= 0)
+        rest(ctx, ctx->schedules[ctx->active].break_duration);
+}
@@ -0,0 +1,25 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include "main.h"
+
+/* Take the schedules of the config, each first due a work period from now */
+void schedule_init(GlobalContext *gctx);
+
+/* Seconds until the nearest deadline, negative once passed */
+double schedule_left(GlobalContext *gctx);
+
+/* Settle which schedule the coming break belongs to and put its settings in the config */
+void schedule_pick(GlobalContext *gctx);
+
+/* The user was away for seconds. Without sections anything past idle_limit starts a new work period,
+   with them it counts as every break no longer than that */
+void schedule_rest(GlobalContext *gctx, double seconds);
+
+/* Seconds of work on top of the clock, every deadline comes that much sooner */
+void schedule_spend(GlobalContext *gctx, double seconds);
+
+/* The picked break is over or skipped, reschedule every schedule it covered */
+void schedule_done(GlobalContext *gctx);
+
+#endif /* SCHEDULE_H */
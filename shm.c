@@ -0,0 +1,111 @@
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "main.h"
+#include "shm.h"
+
+/*
+    MIT-SHM back buffer.
+
+    The attach is the only way to learn that the segment is unreachable,
+    e.g. on a remote display, so it is checked synchronously once with a
+    temporary error handler.
+*/
+
+static bool attach_failed;
+
+
+static int attach_error_handler(Display *display, XErrorEvent *event)
+{
+    (void)display;
+    (void)event;
+    attach_failed = true;
+    return 0;
+}
+
+
+static int mask_bits(unsigned long mask)
+{
+    int bits = 0;
+    for (; mask; mask >>= 1)
+        bits += mask & 1;
+    return bits;
+}
+
+
+bool shm_supported(Display *display, Visual *visual, int depth)
+{
+    if (!XShmQueryExtension(display))
+        return false;
+
+    // Composition works on 8 bits per channel in 32-bit pixels
+    return (depth == 24 || depth == 32) &&
+           visual->class == TrueColor &&
+           mask_bits(visual->red_mask) == 8 &&
+           mask_bits(visual->green_mask) == 8 &&
+           mask_bits(visual->blue_mask) == 8;
+}
+
+
+bool shm_create(Display *display, Visual *visual, int depth, uint width, uint height, XImage **image, XShmSegmentInfo *info)
+{
+    XImage *img = XShmCreateImage(display, visual, depth, ZPixmap, NULL, info, width, height);
+    if (!img)
+        return false;
+
+    if (img->bits_per_pixel != 32)
+    {
+        XDestroyImage(img);
+        return false;
+    }
+
+    info->shmid = shmget(IPC_PRIVATE, img->bytes_per_line * img->height, IPC_CREAT | 0600);
+    if (info->shmid < 0)
+    {
+        XDestroyImage(img);
+        return false;
+    }
+
+    info->shmaddr = img->data = shmat(info->shmid, NULL, 0);
+    info->readOnly = False;
+
+    if (info->shmaddr == (char *)-1)
+    {
+        shmctl(info->shmid, IPC_RMID, NULL);
+        img->data = NULL;
+        XDestroyImage(img);
+        return false;
+    }
+
+    attach_failed = false;
+    XErrorHandler previous = XSetErrorHandler(attach_error_handler);
+    XShmAttach(display, info);
+    XSync(display, False);
+    XSetErrorHandler(previous);
+
+    // Segment goes away once both sides detach
+    shmctl(info->shmid, IPC_RMID, NULL);
+
+    if (attach_failed)
+    {
+        shmdt(info->shmaddr);
+        img->data = NULL;
+        XDestroyImage(img);
+        return false;
+    }
+
+    *image = img;
+    return true;
+}
+
+
+void shm_destroy(Display *display, XImage *image, XShmSegmentInfo *info)
+{
+    XShmDetach(display, info);
+    shmdt(info->shmaddr);
+    image->data = NULL;
+    XDestroyImage(image);
+}
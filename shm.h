@@ -0,0 +1,14 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include "main.h"
+
+/* True if the server supports MIT-SHM and the visual suits client-side composition */
+bool shm_supported(Display *display, Visual *visual, int depth);
+
+/* Create a shared-memory image attached to the server, false if the server can't attach it */
+bool shm_create(Display *display, Visual *visual, int depth, uint width, uint height, XImage **image, XShmSegmentInfo *info);
+
+void shm_destroy(Display *display, XImage *image, XShmSegmentInfo *info);
+
+#endif /* SHM_H */
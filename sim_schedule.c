@@ -0,0 +1,486 @@
+#include <X11/Xlib.h>
+#include <X11/keysym.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "main.h"
+#include "config.h"
+#include "timer.h"
+#include "schedule.h"
+#include "state.h"
+#include "wait.h"
+
+/*
+    Break schedule simulator.
+
+    Replays the state machine of xrest on a virtual clock against a trace
+    of key presses, idle periods and typing, and prints every transition.
+    Nothing is drawn and nothing waits, so a whole workday takes
+    milliseconds. The dispatch, the transitions, the schedules and the
+    accounting of the wait are the code of the program, fed from the trace
+    instead of the X server; only the screens are left out.
+
+    A trace is a list of lines, times in seconds from the start:
+
+        600 key space       a key pressed, by its X name
+        3000 idle 900       no input for the given seconds
+        4000 typing 300 600 300 keystrokes a minute for 600 seconds
+
+    The log goes to stdout, to diff against a log of a known good build.
+    With -e the comparison is made here and the exit status tells.
+*/
+
+#define SIM_DURATION (8 * 3600.0)
+#define SIM_EVENTS 4096
+
+
+typedef enum
+{
+    SIM_KEY,
+    SIM_IDLE,
+    SIM_TYPING
+} SimKind;
+
+
+typedef struct
+{
+    double time;
+    SimKind kind;
+    double length; // Seconds of the idle or typing period
+    double rate; // Keystrokes per minute while typing
+    KeySym key;
+} SimEvent;
+
+
+typedef struct
+{
+    GlobalContext gctx; // First, handlers get the simulation through it
+    SimEvent events[SIM_EVENTS];
+    int event_count;
+    int next; // First event not yet taken
+
+    double end; // Simulated time to stop at
+    FILE *log;
+    FILE *expected;
+    int line;
+    bool mismatch;
+} Sim;
+
+
+static double now(void)
+{
+    static Timer epoch;
+    static bool started = false;
+    if (!started)
+    {
+        timer_start(&epoch);
+        started = true;
+    }
+    return timer_elapsed(&epoch);
+}
+
+
+static KeySym parse_key(const char *name)
+{
+    if (strcmp(name, "space") == 0)
+        return XK_space;
+    if (strcmp(name, "return") == 0)
+        return XK_Return;
+    if (strcmp(name, "escape") == 0)
+        return XK_Escape;
+    if (strlen(name) == 1 && islower((unsigned char)name[0]))
+        return XK_a + (name[0] - 'a');
+    return NoSymbol;
+}
+
+
+static bool load_trace(Sim *sim, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return false;
+
+    char line[256];
+    int number = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        number++;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+
+        double time;
+        char kind[16], arg[64], length[64];
+        int fields = sscanf(line, "%lf %15s %63s %63s", &time, kind, arg, length);
+        if (fields < 3)
+        {
+            fprintf(stderr, "%s:%d: expected: time key|idle|typing value\n", path, number);
+            continue;
+        }
+
+        if (sim->event_count == SIM_EVENTS)
+        {
+            fprintf(stderr, "%s:%d: more than %d events, the rest ignored\n", path, number, SIM_EVENTS);
+            break;
+        }
+
+        SimEvent *event = &sim->events[sim->event_count];
+        event->time = time;
+        if (strcmp(kind, "idle") == 0)
+        {
+            event->kind = SIM_IDLE;
+            event->length = atof(arg);
+        }
+        else if (strcmp(kind, "typing") == 0)
+        {
+            if (fields < 4)
+            {
+                fprintf(stderr, "%s:%d: expected: time typing keys-per-minute seconds\n", path, number);
+                continue;
+            }
+            event->kind = SIM_TYPING;
+            event->rate = atof(arg);
+            event->length = atof(length);
+        }
+        else if (strcmp(kind, "key") == 0 && (event->key = parse_key(arg)) != NoSymbol)
+        {
+            event->kind = SIM_KEY;
+        }
+        else
+        {
+            fprintf(stderr, "%s:%d: unknown event %s %s\n", path, number, kind, arg);
+            continue;
+        }
+
+        // Traces are written in order, an event out of it would never be reached
+        if (sim->event_count > 0 && time < sim->events[sim->event_count - 1].time)
+        {
+            fprintf(stderr, "%s:%d: out of order, ignored\n", path, number);
+            continue;
+        }
+        sim->event_count++;
+    }
+
+    fclose(f);
+    return true;
+}
+
+
+static void log_line(Sim *sim, const char *text)
+{
+    fprintf(sim->log, "%s\n", text);
+
+    if (!sim->expected || sim->mismatch)
+        return;
+
+    char expected[256];
+    sim->line++;
+    if (!fgets(expected, sizeof(expected), sim->expected))
+        expected[0] = '\0';
+    expected[strcspn(expected, "\n")] = '\0';
+
+    if (strcmp(expected, text) != 0)
+    {
+        fprintf(stderr, "Line %d differs\n  expected: %s\n  got:      %s\n", sim->line, expected, text);
+        sim->mismatch = true;
+    }
+}
+
+
+static void log_transition(Sim *sim, GlobalState from, GlobalState to)
+{
+    char text[256];
+    int length = snprintf(text, sizeof(text), "%10.3f %-8s -> %s", now(), state_name(from), state_name(to));
+
+    // Which schedule a warning or a break belongs to
+    ScheduleContext *schedule = &sim->gctx.schedule;
+    if ((to == STATE_WARNING || to == STATE_BREAK) && schedule->active >= 0)
+        snprintf(text + length, sizeof(text) - length, " [%s]", schedule->schedules[schedule->active].name);
+
+    log_line(sim, text);
+}
+
+
+/* Run a state for up to duration seconds, keys going through it, STATE_TIMEOUT if they don't end it */
+static GlobalState run_keys(Sim *sim, GlobalState state, double duration)
+{
+    double until = fmin(now() + duration, sim->end);
+
+    while (sim->next < sim->event_count && sim->events[sim->next].time < until)
+    {
+        SimEvent *event = &sim->events[sim->next++];
+        if (event->kind != SIM_KEY)
+            continue;
+
+        timer_advance(event->time - now());
+        GlobalState outcome = state_key(&sim->gctx.config, state, event->key);
+        if (outcome != STATE_NONE)
+            return outcome;
+    }
+
+    timer_advance(until - now());
+    return now() >= sim->end ? STATE_EXIT : STATE_TIMEOUT;
+}
+
+
+/* Whether the user is past the idle limit at t, as the IDLETIME alarm tells */
+static bool idle_at(const Sim *sim, double t)
+{
+    double limit = sim->gctx.config.idle_limit;
+    for (int e = 0; e < sim->event_count && sim->events[e].time <= t; e++)
+    {
+        const SimEvent *event = &sim->events[e];
+        if (event->kind == SIM_IDLE && event->time + limit <= t && t < event->time + event->length)
+            return true;
+    }
+    return false;
+}
+
+
+/* First time after t the alarm would fire, either way */
+static double next_idle_change(const Sim *sim, double t)
+{
+    double limit = sim->gctx.config.idle_limit;
+    double next = INFINITY;
+    for (int e = 0; e < sim->event_count && sim->events[e].time < next; e++)
+    {
+        const SimEvent *event = &sim->events[e];
+        if (event->kind != SIM_IDLE || event->length <= limit)
+            continue;
+        if (event->time + limit > t)
+            next = fmin(next, event->time + limit);
+        else if (event->time + event->length > t)
+            next = fmin(next, event->time + event->length);
+    }
+    return next;
+}
+
+
+/* Keystrokes typed by t, as the activity meter would have published them */
+static unsigned long typed(const Sim *sim, double t)
+{
+    double keys = 0.0;
+    for (int e = 0; e < sim->event_count && sim->events[e].time < t; e++)
+    {
+        const SimEvent *event = &sim->events[e];
+        if (event->kind == SIM_TYPING)
+            keys += event->rate / 60.0 * fmin(event->length, t - event->time);
+    }
+    return (unsigned long)keys;
+}
+
+
+/* The wait of the program, observations taken from the trace */
+static GlobalState sim_wait(GlobalContext *gctx)
+{
+    Sim *sim = (Sim *)gctx;
+    bool alarms = gctx->config.detect_idle;
+
+    Timer timer = {0};
+    timer_start(&timer);
+
+    WaitProgress wait;
+    wait_start(gctx, &wait);
+
+    GlobalState state = STATE_NONE;
+    while (state == STATE_NONE)
+    {
+        double elapsed = timer_elapsed(&timer);
+        atomic_store(&gctx->activity.published_keys, typed(sim, now()));
+
+        bool away = wait.idle;
+        state = wait_update(gctx, &wait, elapsed, alarms && idle_at(sim, now()));
+
+        if (away && !wait.idle)
+        {
+            char text[256];
+            snprintf(text, sizeof(text), "%10.3f %-8s back after %.0fs", now(), state_name(STATE_WAIT),
+                     elapsed - wait.idle_since + gctx->config.idle_limit);
+            log_line(sim, text);
+        }
+
+        if (state != STATE_NONE)
+            break;
+
+        // Woken like the program, by its own deadlines or the alarm
+        double next = now() + wait_next(gctx, &wait, elapsed, 0.0) - elapsed;
+        if (alarms)
+            next = fmin(next, next_idle_change(sim, now()));
+
+        if (next >= sim->end)
+        {
+            timer_advance(sim->end - now());
+            state = STATE_EXIT;
+            break;
+        }
+        timer_advance(next - now());
+    }
+
+    // Keys reach no window while waiting
+    while (sim->next < sim->event_count && sim->events[sim->next].time < now())
+        sim->next++;
+
+    if (state == STATE_TIMEOUT)
+        schedule_pick(gctx);
+    return state_exit(&gctx->config, STATE_WAIT, state);
+}
+
+
+static GlobalState sim_warning(GlobalContext *gctx)
+{
+    return state_exit(&gctx->config, STATE_WARNING, run_keys((Sim *)gctx, STATE_WARNING, gctx->config.warning_duration));
+}
+
+
+static GlobalState sim_snooze(GlobalContext *gctx)
+{
+    // Keys reach no window while snoozing
+    return state_exit(&gctx->config, STATE_WAIT, run_keys((Sim *)gctx, STATE_NONE, gctx->config.snooze_duration));
+}
+
+
+static GlobalState sim_break(GlobalContext *gctx)
+{
+    return state_exit(&gctx->config, STATE_BREAK, run_keys((Sim *)gctx, STATE_BREAK, gctx->config.break_duration));
+}
+
+
+static GlobalState sim_end(GlobalContext *gctx)
+{
+    return state_exit(&gctx->config, STATE_END, run_keys((Sim *)gctx, STATE_END, INFINITY));
+}
+
+
+static GlobalState sim_restart(GlobalContext *gctx)
+{
+    schedule_done(gctx);
+    return STATE_WAIT;
+}
+
+
+static void moved(GlobalContext *gctx, GlobalState from, GlobalState to)
+{
+    log_transition((Sim *)gctx, from, to);
+}
+
+
+static void print_usage(const char *prog)
+{
+    printf(
+        "Usage: %s [options] TRACE\n"
+        "\nOptions:\n"
+        "  -c FILE            Config file, the defaults otherwise\n"
+        "  -t SECONDS         Simulated time (default %.0f)\n"
+        "  -e FILE            Compare the log with an expected one, exit 1 if they differ\n"
+        "  -h, --help         Show this help and exit\n",
+        prog, SIM_DURATION
+    );
+}
+
+
+int main(int argc, char **argv)
+{
+    static Sim sim;
+    const char *config_path = NULL;
+    const char *trace_path = NULL;
+    const char *expected_path = NULL;
+    sim.end = SIM_DURATION;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+        {
+            config_path = argv[++i];
+            continue;
+        }
+
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            sim.end = atof(argv[++i]);
+            continue;
+        }
+
+        if (strcmp(argv[i], "-e") == 0 && i + 1 < argc)
+        {
+            expected_path = argv[++i];
+            continue;
+        }
+
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0)
+        {
+            print_usage(argv[0]);
+            return 0;
+        }
+
+        if (argv[i][0] != '-' && !trace_path)
+        {
+            trace_path = argv[i];
+            continue;
+        }
+
+        fprintf(stderr, "Unknown option: %s\n", argv[i]);
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (!trace_path)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (!load_trace(&sim, trace_path))
+    {
+        fprintf(stderr, "Can't read %s\n", trace_path);
+        return 1;
+    }
+
+    GlobalContext *gctx = &sim.gctx;
+    load_defaults(&gctx->config);
+    if (config_path)
+        load_config_file(&gctx->config, config_path);
+
+    sim.log = stdout;
+    if (expected_path && !(sim.expected = fopen(expected_path, "r")))
+    {
+        fprintf(stderr, "Can't read %s\n", expected_path);
+        return 1;
+    }
+
+    clock_t cpu = clock();
+
+    timer_virtual();
+    now();
+    schedule_init(gctx);
+
+    // The meter is fed from the trace
+    gctx->activity.enabled = gctx->config.activity_enabled;
+
+    static const StateHandler handlers[STATE_EXIT] = {
+        [STATE_WAIT] = sim_wait,
+        [STATE_WARNING] = sim_warning,
+        [STATE_SNOOZE] = sim_snooze,
+        [STATE_BREAK] = sim_break,
+        [STATE_END] = sim_end,
+        [STATE_RESTART] = sim_restart,
+    };
+    state_run(gctx, handlers, moved);
+
+    fprintf(stderr, "Simulated %.0f s in %.3f ms\n", now(), (clock() - cpu) * 1000.0 / CLOCKS_PER_SEC);
+
+    if (sim.expected)
+    {
+        // A longer expected log differs too
+        char extra[256];
+        if (!sim.mismatch && fgets(extra, sizeof(extra), sim.expected))
+        {
+            fprintf(stderr, "Line %d missing: %s", sim.line + 1, extra);
+            sim.mismatch = true;
+        }
+        fclose(sim.expected);
+    }
+
+    return sim.mismatch ? 1 : 0;
+}
@@ -0,0 +1,247 @@
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "main.h"
+#include "timer.h"
+#include "shm.h"
+#include "blur.h"
+#include "input.h"
+#include "snapshot.h"
+
+/*
+    Blurred desktop snapshot used as the background.
+
+    The screen is grabbed into a shared-memory image with XShmGetImage and
+    blurred in place with one worker per core, see blur.c. The copy tinted
+    by the progress color lands in the scratch buffer, so both results
+    stay in shared memory, and they are uploaded with XShmPutImage when
+    frames are composed server-side.
+
+    The root keeps the default visual when windows use an ARGB one, so the
+    images have its depth and the results get their alpha set. Pixels are
+    32-bit in both.
+
+    A key for the state on screen stops the blur between passes. The
+    snapshot is then left out of this break rather than holding the key.
+*/
+
+
+static bool give_way(void *arg)
+{
+    return input_pending(arg);
+}
+
+
+static bool blur(GlobalContext *gctx, XImage *image, XImage *scratch)
+{
+    int radius = pt_to_px(gctx->config.desktop_blur, gctx->dpi);
+    return blur_image(image, scratch, radius, gctx->config.desktop_dim, gctx->progress_color.pixel, gctx->alpha_mask, 0, give_way, gctx);
+}
+
+
+static void free_images(GlobalContext *gctx)
+{
+    Snapshot *snapshot = &gctx->snapshot;
+    Background *background = &snapshot->background;
+
+    if (background->plain)
+        XFreePixmap(gctx->display, background->plain);
+    if (background->tinted)
+        XFreePixmap(gctx->display, background->tinted);
+    memset(background, 0, sizeof(*background));
+
+    if (snapshot->shm)
+    {
+        if (snapshot->capture)
+            shm_destroy(gctx->display, snapshot->capture, &snapshot->capture_info);
+        if (snapshot->scratch)
+            shm_destroy(gctx->display, snapshot->scratch, &snapshot->scratch_info);
+    }
+    else
+    {
+        if (snapshot->capture)
+            XDestroyImage(snapshot->capture);
+        if (snapshot->scratch)
+            XDestroyImage(snapshot->scratch);
+    }
+
+    snapshot->capture = NULL;
+    snapshot->scratch = NULL;
+    snapshot->valid = false;
+}
+
+
+static bool create_images(GlobalContext *gctx, uint width, uint height)
+{
+    Snapshot *snapshot = &gctx->snapshot;
+    Visual *visual = DefaultVisual(gctx->display, gctx->screen);
+    int depth = DefaultDepth(gctx->display, gctx->screen);
+
+    if (snapshot->shm)
+    {
+        if (!shm_create(gctx->display, visual, depth, width, height, &snapshot->capture, &snapshot->capture_info))
+            return false;
+        if (!shm_create(gctx->display, visual, depth, width, height, &snapshot->scratch, &snapshot->scratch_info))
+        {
+            shm_destroy(gctx->display, snapshot->capture, &snapshot->capture_info);
+            snapshot->capture = NULL;
+            return false;
+        }
+    }
+    else
+    {
+        // The capture comes from XGetImage, only the scratch is allocated here
+        snapshot->scratch = XCreateImage(gctx->display, visual, depth, ZPixmap, 0, NULL, width, height, 32, 0);
+        if (!snapshot->scratch)
+            return false;
+        snapshot->scratch->data = malloc((size_t)snapshot->scratch->bytes_per_line * height);
+    }
+
+    // Frames composed from the images directly in the SHM path
+    Background *background = &snapshot->background;
+    background->width = width;
+    background->height = height;
+
+    if (!gctx->shm)
+    {
+        background->plain = XCreatePixmap(gctx->display, gctx->root, width, height, gctx->depth);
+        background->tinted = XCreatePixmap(gctx->display, gctx->root, width, height, gctx->depth);
+    }
+    return true;
+}
+
+
+static void upload(GlobalContext *gctx, Pixmap pixmap, XImage *image)
+{
+    // Same pixels, only the depth the server checks differs with an ARGB visual
+    XImage header = *image;
+    header.depth = gctx->depth;
+
+    GC gc = XCreateGC(gctx->display, pixmap, 0, NULL);
+    if (gctx->snapshot.shm)
+        XShmPutImage(gctx->display, pixmap, gc, &header, 0, 0, 0, 0, image->width, image->height, False);
+    else
+        XPutImage(gctx->display, pixmap, gc, &header, 0, 0, 0, 0, image->width, image->height);
+    XFreeGC(gctx->display, gc);
+}
+
+
+void snapshot_init(GlobalContext *gctx)
+{
+    Snapshot *snapshot = &gctx->snapshot;
+    if (!gctx->config.desktop_background)
+        return;
+
+    Visual *visual = DefaultVisual(gctx->display, gctx->screen);
+    int depth = DefaultDepth(gctx->display, gctx->screen);
+    bool bytes = visual->class == TrueColor && (depth == 24 || depth == 32) &&
+                 (visual->red_mask | visual->green_mask | visual->blue_mask) == 0xffffff;
+    if (!bytes)
+    {
+        fprintf(stderr, "Desktop background needs a 24-bit TrueColor visual\n");
+        return;
+    }
+
+    snapshot->shm = shm_supported(gctx->display, visual, depth);
+    snapshot->enabled = true;
+}
+
+
+void snapshot_capture(GlobalContext *gctx)
+{
+    Snapshot *snapshot = &gctx->snapshot;
+    if (!snapshot->enabled)
+        return;
+
+    Timer timer = {0};
+    timer_start(&timer);
+
+    uint width = gctx->screen_width;
+    uint height = gctx->screen_height;
+
+    if (snapshot->background.width != width || snapshot->background.height != height)
+    {
+        free_images(gctx);
+        if (!create_images(gctx, width, height))
+        {
+            free_images(gctx);
+            return;
+        }
+    }
+
+    // Grab
+
+    if (snapshot->shm)
+    {
+        if (!XShmGetImage(gctx->display, gctx->root, snapshot->capture, 0, 0, AllPlanes))
+            return;
+    }
+    else
+    {
+        if (snapshot->capture)
+            XDestroyImage(snapshot->capture);
+        snapshot->capture = XGetImage(gctx->display, gctx->root, 0, 0, width, height, AllPlanes, ZPixmap);
+        if (!snapshot->capture)
+            return;
+        if (snapshot->capture->bits_per_pixel != 32 || snapshot->capture->bytes_per_line != snapshot->scratch->bytes_per_line)
+        {
+            fprintf(stderr, "Desktop background needs 32-bit pixels\n");
+            snapshot->enabled = false;
+            return;
+        }
+    }
+
+    double grabbed = timer_elapsed(&timer);
+
+    if (!blur(gctx, snapshot->capture, snapshot->scratch))
+    {
+        snapshot->valid = false;
+        if (gctx->debug)
+            printf("Desktop snapshot given up after %.1f ms for a key\n", timer_elapsed(&timer) * 1000.0);
+        return;
+    }
+
+    Background *background = &snapshot->background;
+    if (gctx->shm)
+    {
+        background->plain_image = snapshot->capture;
+        background->tinted_image = snapshot->scratch;
+    }
+    else
+    {
+        // Next capture waits for its reply, so the server has read both by then
+        upload(gctx, background->plain, snapshot->capture);
+        upload(gctx, background->tinted, snapshot->scratch);
+        XFlush(gctx->display);
+    }
+
+    snapshot->valid = true;
+
+    if (gctx->debug)
+    {
+        double total = timer_elapsed(&timer);
+        printf("Desktop snapshot %ux%u: grab %.1f ms, blur %.1f ms%s\n", width, height,
+               grabbed * 1000.0, (total - grabbed) * 1000.0,
+               total > SNAPSHOT_BUDGET ? ", over budget" : "");
+    }
+}
+
+
+void snapshot_keep(GlobalContext *gctx)
+{
+    Snapshot *snapshot = &gctx->snapshot;
+    if (snapshot->background.width != gctx->screen_width || snapshot->background.height != gctx->screen_height)
+        snapshot->valid = false;
+}
+
+
+void snapshot_free(GlobalContext *gctx)
+{
+    free_images(gctx);
+    gctx->snapshot.enabled = false;
+}
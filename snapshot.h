@@ -0,0 +1,19 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "main.h"
+
+#define SNAPSHOT_BUDGET 0.030 // Seconds for capture and blur of a 3840x2160 screen on 4 cores
+
+/* Check the visual and pick the capture path */
+void snapshot_init(GlobalContext *gctx);
+
+/* Grab the screen and turn it into a blurred, dimmed background, left invalid when a key stops it */
+void snapshot_capture(GlobalContext *gctx);
+
+/* Keep the last grab instead of a new one, dropped if it no longer fits the screen */
+void snapshot_keep(GlobalContext *gctx);
+
+void snapshot_free(GlobalContext *gctx);
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,416 @@
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include <fontconfig/fontconfig.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "main.h"
+#include "config.h"
+#include "soft.h"
+
+/*
+    Software render backend.
+
+    Draws into a plain RGBA buffer in memory, no display involved. Fonts
+    are matched by fontconfig from the same patterns Xft is given and
+    rasterized by FreeType, with the metrics Xft derives from them, so text
+    wraps and lands where it does on screen. Glyphs below SOFT_GLYPHS are
+    rasterized once per font and kept, the rest every time they are drawn.
+*/
+
+
+static uint32_t utf8_next(const char **s, const char *end)
+{
+    const unsigned char *p = (const unsigned char *)*s;
+    uint32_t c = *p++;
+
+    int extra = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc0 ? 1 : 0;
+    if (extra)
+        c &= 0x3f >> extra;
+    while (extra-- > 0 && (const char *)p < end && (*p & 0xc0) == 0x80)
+        c = c << 6 | (*p++ & 0x3f);
+
+    *s = (const char *)p;
+    return c;
+}
+
+
+static void rasterize(SoftFont *font, uint32_t c, SoftGlyph *glyph)
+{
+    memset(glyph, 0, sizeof(*glyph));
+    glyph->cached = true;
+
+    if (FT_Load_Char(font->face, c, FT_LOAD_RENDER | FT_LOAD_TARGET_LIGHT) != 0)
+        return;
+
+    FT_GlyphSlot slot = font->face->glyph;
+    const FT_Bitmap *bitmap = &slot->bitmap;
+
+    glyph->left = slot->bitmap_left;
+    glyph->top = slot->bitmap_top;
+    glyph->advance = (slot->advance.x + 32) >> 6;
+
+    if (bitmap->width == 0 || bitmap->rows == 0)
+        return;
+
+    glyph->width = bitmap->width;
+    glyph->height = bitmap->rows;
+    glyph->pitch = bitmap->width;
+    glyph->coverage = malloc((size_t)glyph->pitch * glyph->height);
+
+    for (int y = 0; y < glyph->height; y++)
+    {
+        const uint8_t *src = bitmap->buffer + y * bitmap->pitch;
+        uint8_t *dst = glyph->coverage + y * glyph->pitch;
+
+        // Bitmap fonts come in one bit per pixel
+        if (bitmap->pixel_mode == FT_PIXEL_MODE_MONO)
+        {
+            for (int x = 0; x < glyph->width; x++)
+                dst[x] = src[x >> 3] & (0x80 >> (x & 7)) ? 255 : 0;
+        }
+        else
+        {
+            memcpy(dst, src, glyph->width);
+        }
+    }
+}
+
+
+/* Cached glyph, or one rasterized into scratch whose previous coverage is freed */
+static const SoftGlyph *get_glyph(SoftFont *font, uint32_t c, SoftGlyph *scratch)
+{
+    if (c < SOFT_GLYPHS)
+    {
+        SoftGlyph *glyph = &font->glyphs[c];
+        if (!glyph->cached)
+            rasterize(font, c, glyph);
+        return glyph;
+    }
+
+    free(scratch->coverage);
+    rasterize(font, c, scratch);
+    return scratch;
+}
+
+
+static void soft_extents(void *context, void *handle, const char *text, int length, XGlyphInfo *extents)
+{
+    (void)context;
+    SoftFont *font = handle;
+    SoftGlyph scratch = {0};
+
+    int pen = 0;
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+    bool ink = false;
+
+    const char *end = text + length;
+    for (const char *s = text; s < end; )
+    {
+        const SoftGlyph *glyph = get_glyph(font, utf8_next(&s, end), &scratch);
+        if (glyph->coverage)
+        {
+            int gx0 = pen + glyph->left;
+            int gy0 = -glyph->top;
+            int gx1 = gx0 + glyph->width;
+            int gy1 = gy0 + glyph->height;
+
+            if (!ink || gx0 < x0) x0 = gx0;
+            if (!ink || gy0 < y0) y0 = gy0;
+            if (!ink || gx1 > x1) x1 = gx1;
+            if (!ink || gy1 > y1) y1 = gy1;
+            ink = true;
+        }
+        pen += glyph->advance;
+    }
+    free(scratch.coverage);
+
+    // Same meaning as XftTextExtents: ink box relative to the origin, then the advance
+    extents->x = -x0;
+    extents->y = -y0;
+    extents->width = x1 - x0;
+    extents->height = y1 - y0;
+    extents->xOff = pen;
+    extents->yOff = 0;
+}
+
+
+static const LayoutFont *soft_font(void *data, RenderFont font)
+{
+    SoftRenderer *soft = data;
+    return &soft->fonts[font].measure;
+}
+
+
+static bool clip(const SoftRenderer *soft, int x, int y, int width, int height, int *x0, int *y0, int *x1, int *y1)
+{
+    *x0 = x > 0 ? x : 0;
+    *y0 = y > 0 ? y : 0;
+    *x1 = x + width < (int)soft->width ? x + width : (int)soft->width;
+    *y1 = y + height < (int)soft->height ? y + height : (int)soft->height;
+    return *x1 > *x0 && *y1 > *y0;
+}
+
+
+static void soft_fill(void *data, XRectangle r, RenderColor color)
+{
+    SoftRenderer *soft = data;
+    uint32_t pixel = soft->colors[color];
+
+    int x0, y0, x1, y1;
+    if (!clip(soft, r.x, r.y, r.width, r.height, &x0, &y0, &x1, &y1))
+        return;
+
+    for (int y = y0; y < y1; y++)
+    {
+        uint32_t *row = (uint32_t *)(soft->pixels + (size_t)y * soft->stride);
+        for (int x = x0; x < x1; x++)
+            row[x] = pixel;
+    }
+}
+
+
+/* Blend a solid color through the glyph coverage, ink top left at (x, y) */
+static void blend(SoftRenderer *soft, const SoftGlyph *glyph, int x, int y, uint32_t pixel)
+{
+    int x0, y0, x1, y1;
+    if (!clip(soft, x, y, glyph->width, glyph->height, &x0, &y0, &x1, &y1))
+        return;
+
+    uint8_t color[4];
+    memcpy(color, &pixel, sizeof(color));
+
+    for (int gy = y0; gy < y1; gy++)
+    {
+        const uint8_t *src = glyph->coverage + (gy - y) * glyph->pitch + (x0 - x);
+        uint8_t *dst = soft->pixels + (size_t)gy * soft->stride + x0 * 4;
+
+        for (int gx = x0; gx < x1; gx++, src++, dst += 4)
+        {
+            uint32_t a = *src;
+            if (a == 0)
+                continue;
+            if (a == 255)
+            {
+                memcpy(dst, &pixel, sizeof(pixel));
+                continue;
+            }
+
+            for (int c = 0; c < 3; c++)
+                dst[c] = (dst[c] * (255 - a) + color[c] * a) / 255;
+            dst[3] = 255;
+        }
+    }
+}
+
+
+static void soft_text(void *data, RenderFont font, RenderColor color, int x, int y, const char *text, int length)
+{
+    SoftRenderer *soft = data;
+    SoftFont *soft_font = &soft->fonts[font];
+    SoftGlyph scratch = {0};
+
+    const char *end = text + length;
+    for (const char *s = text; s < end; )
+    {
+        const SoftGlyph *glyph = get_glyph(soft_font, utf8_next(&s, end), &scratch);
+        if (glyph->coverage)
+            blend(soft, glyph, x + glyph->left, y - glyph->top, soft->colors[color]);
+        x += glyph->advance;
+    }
+    free(scratch.coverage);
+}
+
+
+static bool load_font(SoftRenderer *soft, SoftFont *font, const Config *config, double dpi, int size, const char *style, int weight, int slant)
+{
+    char *name = get_font_string(config->font_name, size, style, weight, slant);
+    FcPattern *pattern = FcNameParse((const FcChar8 *)name);
+    free(name);
+    if (!pattern)
+        return false;
+
+    // The pixel size follows from the point size at our dpi, as Xft does it
+    FcPatternAddDouble(pattern, FC_DPI, dpi);
+    FcConfigSubstitute(NULL, pattern, FcMatchPattern);
+    FcDefaultSubstitute(pattern);
+
+    FcResult result;
+    FcPattern *match = FcFontMatch(NULL, pattern, &result);
+    FcPatternDestroy(pattern);
+    if (!match)
+        return false;
+
+    FcChar8 *file;
+    int index = 0;
+    double pixel_size;
+    bool ok = FcPatternGetString(match, FC_FILE, 0, &file) == FcResultMatch &&
+              FcPatternGetDouble(match, FC_PIXEL_SIZE, 0, &pixel_size) == FcResultMatch;
+    FcPatternGetInteger(match, FC_INDEX, 0, &index);
+
+    ok = ok && FT_New_Face(soft->library, (const char *)file, index, &font->face) == 0;
+    FcPatternDestroy(match);
+    if (!ok)
+        return false;
+
+    FT_Set_Char_Size(font->face, 0, (FT_F26Dot6)(pixel_size * 64.0 + 0.5), 72, 72);
+
+    const FT_Size_Metrics *metrics = &font->face->size->metrics;
+    font->measure.handle = font;
+    font->measure.context = soft;
+    font->measure.ascent = metrics->ascender >> 6;
+    font->measure.height = metrics->height >> 6;
+    font->measure.extents = soft_extents;
+    return true;
+}
+
+
+bool soft_init(SoftRenderer *soft, const Config *config, double dpi)
+{
+    memset(soft, 0, sizeof(*soft));
+
+    if (FT_Init_FreeType(&soft->library) != 0)
+        return false;
+
+    struct
+    {
+        int size;
+        const char *style;
+        int weight;
+        int slant;
+    } fonts[RENDER_FONT_COUNT] = {
+        [RENDER_FONT_TITLE] = { config->title_font_size, config->title_font_style, config->title_font_weight, config->title_font_slant },
+        [RENDER_FONT_MESSAGE] = { config->message_font_size, config->message_font_style, config->message_font_weight, config->message_font_slant },
+        [RENDER_FONT_HINT] = { config->hint_font_size, config->hint_font_style, config->hint_font_weight, config->hint_font_slant },
+        [RENDER_FONT_TIME] = { config->time_font_size, config->time_font_style, config->time_font_weight, config->time_font_slant },
+    };
+
+    for (int f = 0; f < RENDER_FONT_COUNT; f++)
+    {
+        if (!load_font(soft, &soft->fonts[f], config, dpi, fonts[f].size, fonts[f].style, fonts[f].weight, fonts[f].slant))
+            return false;
+    }
+
+    const char *colors[RENDER_COLOR_COUNT] = {
+        [RENDER_COLOR_FONT] = config->font_color,
+        [RENDER_COLOR_HINT] = config->hint_font_color,
+        [RENDER_COLOR_BACKGROUND_FONT] = config->background_font_color,
+        [RENDER_COLOR_BACKGROUND] = config->background_color,
+        [RENDER_COLOR_PROGRESS] = config->progress_color,
+    };
+
+    for (int c = 0; c < RENDER_COLOR_COUNT; c++)
+    {
+        unsigned int rgb = parse_color(colors[c]);
+        uint8_t bytes[4] = { rgb >> 16, rgb >> 8, rgb, 255 };
+        memcpy(&soft->colors[c], bytes, sizeof(bytes));
+    }
+
+    return true;
+}
+
+
+void soft_resize(SoftRenderer *soft, uint width, uint height)
+{
+    soft->width = width;
+    soft->height = height;
+    soft->stride = width * 4;
+    soft->pixels = realloc(soft->pixels, (size_t)soft->stride * height);
+    memset(soft->pixels, 0, (size_t)soft->stride * height);
+}
+
+
+void soft_backend(SoftRenderer *soft, RenderBackend *backend)
+{
+    backend->name = "software";
+    backend->data = soft;
+    backend->font = soft_font;
+    backend->fill = soft_fill;
+    backend->text = soft_text;
+}
+
+
+bool soft_write(const SoftRenderer *soft, const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f)
+        return false;
+
+    fprintf(f, "P7\nWIDTH %u\nHEIGHT %u\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", soft->width, soft->height);
+    bool ok = fwrite(soft->pixels, soft->stride, soft->height, f) == soft->height;
+    ok &= fclose(f) == 0;
+    return ok;
+}
+
+
+long soft_compare(const SoftRenderer *soft, const char *path, int tolerance)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return -1;
+
+    // Header as soft_write writes it, one field per line up to ENDHDR
+    char line[64];
+    uint width = 0, height = 0, depth = 0;
+    bool header = fgets(line, sizeof(line), f) && strcmp(line, "P7\n") == 0;
+    while (header && fgets(line, sizeof(line), f) && strcmp(line, "ENDHDR\n") != 0)
+    {
+        sscanf(line, "WIDTH %u", &width);
+        sscanf(line, "HEIGHT %u", &height);
+        sscanf(line, "DEPTH %u", &depth);
+    }
+
+    if (!header || width != soft->width || height != soft->height || depth != 4)
+    {
+        fclose(f);
+        return -1;
+    }
+
+    uint8_t *row = malloc(soft->stride);
+    long differing = 0;
+    for (uint y = 0; y < height; y++)
+    {
+        if (fread(row, soft->stride, 1, f) != 1)
+        {
+            differing = -1;
+            break;
+        }
+
+        const uint8_t *pixels = soft->pixels + (size_t)y * soft->stride;
+        for (uint x = 0; x < width; x++)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                if (abs(pixels[x * 4 + c] - row[x * 4 + c]) > tolerance)
+                {
+                    differing++;
+                    break;
+                }
+            }
+        }
+    }
+
+    free(row);
+    fclose(f);
+    return differing;
+}
+
+
+void soft_free(SoftRenderer *soft)
+{
+    for (int f = 0; f < RENDER_FONT_COUNT; f++)
+    {
+        SoftFont *font = &soft->fonts[f];
+        for (int g = 0; g < SOFT_GLYPHS; g++)
+            free(font->glyphs[g].coverage);
+        if (font->face)
+            FT_Done_Face(font->face);
+    }
+
+    if (soft->library)
+        FT_Done_FreeType(soft->library);
+    free(soft->pixels);
+    memset(soft, 0, sizeof(*soft));
+}
@@ -0,0 +1,23 @@
+#ifndef SOFT_H
+#define SOFT_H
+
+#include "main.h"
+
+/* Load the screen fonts through fontconfig and FreeType, false if one is missing */
+bool soft_init(SoftRenderer *soft, const Config *config, double dpi);
+
+/* Make the canvas width x height RGBA pixels */
+void soft_resize(SoftRenderer *soft, uint width, uint height);
+
+/* Render backend drawing into the canvas */
+void soft_backend(SoftRenderer *soft, RenderBackend *backend);
+
+/* Write the canvas as a binary PAM, false if the file can't be written */
+bool soft_write(const SoftRenderer *soft, const char *path);
+
+/* Pixels of the canvas differing from a PAM image by more than tolerance in a channel, -1 if it can't be read or its size differs */
+long soft_compare(const SoftRenderer *soft, const char *path, int tolerance);
+
+void soft_free(SoftRenderer *soft);
+
+#endif /* SOFT_H */
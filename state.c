@@ -0,0 +1,151 @@
+#include <X11/Xlib.h>
+#include <X11/keysym.h>
+
+#include "main.h"
+#include "state.h"
+
+/*
+    Transitions of the break state machine.
+
+    Which state follows which, by key or by running out, depends only on
+    the config. Keeping it apart from the handlers that draw and wait lets
+    the simulator replay the same machine on a virtual clock, dispatched
+    by the same loop with handlers of its own.
+*/
+
+
+GlobalState state_key(const Config *config, GlobalState state, KeySym key)
+{
+    switch (state)
+    {
+        case STATE_WARNING:
+            switch (key)
+            {
+                case XK_space: 
+                    return STATE_BREAK;
+                case XK_w: // Snooze
+                    if (config->snooze_enabled)
+                        return STATE_SNOOZE;
+                    break;
+                case XK_s: // Skip
+                    if (config->skip_enabled)
+                        return STATE_RESTART;
+                    break;
+                case XK_q: // Quit
+                    return STATE_EXIT;
+            }
+            break;
+
+        case STATE_BREAK:
+            switch (key)
+            {
+                case XK_s: // Skip
+                    if (config->stop_enabled)
+                        return STATE_RESTART;
+                    break;
+                case XK_q: // Quit
+                    if (config->stop_enabled)
+                        return STATE_EXIT;
+                    break;
+            }
+            break;
+
+        // Any key
+        case STATE_END:
+            return config->repeat ? STATE_RESTART : STATE_EXIT;
+
+        default:
+            break;
+    }
+    return STATE_NONE;
+}
+
+
+GlobalState state_exit(const Config *config, GlobalState state, GlobalState outcome)
+{
+    switch (state)
+    {
+        // A wait or a snooze only ends by running out
+        case STATE_WAIT:
+        case STATE_SNOOZE:
+            if (outcome != STATE_TIMEOUT)
+                return STATE_EXIT;
+            return config->warning_enabled ? STATE_WARNING : STATE_BREAK;
+
+        case STATE_WARNING:
+            switch (outcome)
+            {
+                case STATE_BREAK: 
+                case STATE_TIMEOUT:
+                    return STATE_BREAK;
+                case STATE_SNOOZE: // Snooze
+                    return outcome;
+                case STATE_RESTART: // Skip
+                    return outcome;
+                default:
+                    break;
+            }
+            return STATE_EXIT;
+
+        case STATE_BREAK:
+            switch (outcome)
+            {
+                case STATE_END:
+                case STATE_TIMEOUT:
+                {
+                    // Break ended, go to End Screen
+                    if (config->end_enabled)
+                        return STATE_END;
+                    // Break ended, restart without End Screen
+                    if (config->repeat)
+                        return STATE_RESTART;
+                    return STATE_EXIT;
+                }
+                // Skip Break and restart
+                case STATE_RESTART:
+                    return outcome;
+                default:
+                    break;
+            }
+            return STATE_EXIT;
+
+        case STATE_END:
+            return outcome;
+
+        default:
+            break;
+    }
+    return STATE_EXIT;
+}
+
+
+void state_run(GlobalContext *gctx, const StateHandler handlers[STATE_EXIT], StateMoved moved)
+{
+    GlobalState state = STATE_WAIT;
+    while (state != STATE_EXIT)
+    {
+        GlobalState next = handlers[state] ? handlers[state](gctx) : STATE_EXIT;
+        if (moved)
+            moved(gctx, state, next);
+        state = next;
+    }
+}
+
+
+const char *state_name(GlobalState state)
+{
+    switch (state)
+    {
+        case STATE_NONE: return "none";
+        case STATE_WAIT: return "wait";
+        case STATE_WARNING: return "warning";
+        case STATE_SNOOZE: return "snooze";
+        case STATE_BREAK: return "break";
+        case STATE_END: return "end";
+        case STATE_RESTART: return "restart";
+        case STATE_EXIT: return "exit";
+        case STATE_TIMEOUT: return "timeout";
+        default: break;
+    }
+    return "?";
+}
@@ -0,0 +1,25 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include "main.h"
+
+/* Where a key pressed in a state leads, STATE_NONE if it does nothing there */
+GlobalState state_key(const Config *config, GlobalState state, KeySym key);
+
+/* Where a state leads once it ends with the given outcome, STATE_TIMEOUT when it ran out */
+GlobalState state_exit(const Config *config, GlobalState state, GlobalState outcome);
+
+/* Runs a state to its end and tells which state follows */
+typedef GlobalState (*StateHandler)(GlobalContext *gctx);
+
+/* Told of every transition */
+typedef void (*StateMoved)(GlobalContext *gctx, GlobalState from, GlobalState to);
+
+/* Run the machine from STATE_WAIT through the handler of each state until one leads to STATE_EXIT.
+   moved may be NULL */
+void state_run(GlobalContext *gctx, const StateHandler handlers[STATE_EXIT], StateMoved moved);
+
+/* Name of a state for logs */
+const char *state_name(GlobalState state);
+
+#endif /* STATE_H */
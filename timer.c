@@ -1,6 +1,27 @@
 #include "timer.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
 #include <unistd.h>
 
+/*
+    Monotonic clock, real or virtual.
+
+    In virtual mode time stands still until timer_advance moves it on, and
+    sleeping advances it instead of blocking, so timed logic runs as fast
+    as it computes and gives the same results on every run.
+
+    Waits are for absolute deadlines, so the time spent between them never
+    adds up into drift, and a pacer that falls behind skips the deadlines
+    it missed instead of running them back to back. How late each wait
+    ended is kept in a histogram.
+*/
+
+static bool virtual_clock = false;
+static struct timespec virtual_now;
+static TimerStats stats;
+
 /* Convert timespec difference to seconds */
 static inline double timespec_diff_sec(struct timespec a,
                                        struct timespec b)
@@ -9,15 +30,45 @@ static inline double timespec_diff_sec(struct timespec a,
            (a.tv_nsec - b.tv_nsec) * 1e-9;
 }
 
+void timer_now(struct timespec *now)
+{
+    if (virtual_clock)
+        *now = virtual_now;
+    else
+        clock_gettime(CLOCK_MONOTONIC, now);
+}
+
+void timer_virtual(void)
+{
+    virtual_clock = true;
+    virtual_now.tv_sec = 0;
+    virtual_now.tv_nsec = 0;
+}
+
+void timer_advance(double seconds)
+{
+    if (!virtual_clock || seconds <= 0.0)
+        return;
+
+    time_t whole = (time_t)seconds;
+    virtual_now.tv_sec += whole;
+    virtual_now.tv_nsec += (long)((seconds - whole) * 1e9);
+    if (virtual_now.tv_nsec >= 1000000000L)
+    {
+        virtual_now.tv_sec++;
+        virtual_now.tv_nsec -= 1000000000L;
+    }
+}
+
 void timer_start(Timer *t)
 {
-    clock_gettime(CLOCK_MONOTONIC, &t->start);
+    timer_now(&t->start);
 }
 
 double timer_elapsed(const Timer *t)
 {
     struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
+    timer_now(&now);
     return timespec_diff_sec(now, t->start);
 }
 
@@ -26,6 +77,12 @@ void timer_sleep(double seconds)
     if (seconds <= 0.0)
         return;
 
+    if (virtual_clock)
+    {
+        timer_advance(seconds);
+        return;
+    }
+
     struct timespec ts;
     ts.tv_sec = (time_t)seconds;
     ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
@@ -33,15 +90,93 @@ void timer_sleep(double seconds)
     nanosleep(&ts, NULL);
 }
 
+/* Time of the clock at seconds after a timer start */
+static struct timespec deadline(const Timer *t, double at)
+{
+    double whole = floor(at);
+    struct timespec ts = t->start;
+    ts.tv_sec += (time_t)whole;
+    ts.tv_nsec += (long)((at - whole) * 1e9);
+    if (ts.tv_nsec >= 1000000000L)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+void timer_sleep_until(const Timer *t, double at)
+{
+    if (virtual_clock)
+    {
+        timer_advance(at - timer_elapsed(t));
+        return;
+    }
+
+    struct timespec ts = deadline(t, at);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+
+    timer_record(timer_elapsed(t) - at);
+}
+
 void timer_sleep_remaining(const struct timespec *frame_start,
                            double frame_duration)
 {
-    struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
+    Timer frame = { *frame_start };
+    timer_sleep_until(&frame, frame_duration);
+}
+
+double timer_pace(double period, double deadline, double now)
+{
+    double next = deadline + period;
+    if (next <= now)
+    {
+        double missed = floor((now - next) / period) + 1.0;
+        stats.skipped += (unsigned long)missed;
+        next += missed * period;
+    }
+    return next;
+}
+
+void timer_record(double lateness)
+{
+    if (lateness < 0.0)
+        lateness = 0.0;
+
+    // Bucket b holds up to 2^b microseconds
+    int bucket = 0;
+    double us = lateness * 1e6;
+    while (bucket < TIMER_BUCKETS - 1 && us >= (double)(1u << bucket))
+        bucket++;
+
+    stats.buckets[bucket]++;
+    stats.wakes++;
+    stats.total += lateness;
+    if (lateness > stats.max)
+        stats.max = lateness;
+}
+
+const TimerStats *timer_stats(void)
+{
+    return &stats;
+}
+
+void timer_report(void)
+{
+    if (stats.wakes == 0)
+        return;
 
-    double elapsed = timespec_diff_sec(now, *frame_start);
-    double remaining = frame_duration - elapsed;
+    printf("Wake-ups %lu, late average %.3f ms, max %.3f ms, %lu deadlines skipped\n",
+           stats.wakes, stats.total * 1000.0 / stats.wakes, stats.max * 1000.0, stats.skipped);
 
-    if (remaining > 0.0)
-        timer_sleep(remaining);
+    for (int b = 0; b < TIMER_BUCKETS; b++)
+    {
+        if (stats.buckets[b] == 0)
+            continue;
+        if (b == TIMER_BUCKETS - 1)
+            printf("  >= %6u us %lu\n", 1u << (b - 1), stats.buckets[b]);
+        else
+            printf("  <  %6u us %lu\n", 1u << b, stats.buckets[b]);
+    }
 }
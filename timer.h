@@ -8,6 +8,26 @@ typedef struct {
     struct timespec start;
 } Timer;
 
+#define TIMER_BUCKETS 16
+
+/* Lateness of waits for deadlines */
+typedef struct {
+    unsigned long wakes;
+    unsigned long skipped; // Pacer deadlines missed entirely
+    unsigned long buckets[TIMER_BUCKETS]; // Bucket b up to 2^b microseconds late, the last one the rest
+    double total; // Seconds
+    double max;
+} TimerStats;
+
+/* Current time of the clock, CLOCK_MONOTONIC unless virtual */
+void timer_now(struct timespec *now);
+
+/* Switch to a virtual clock starting at zero, for simulations */
+void timer_virtual(void);
+
+/* Move the virtual clock on, nothing on the real one */
+void timer_advance(double seconds);
+
 /* Initialize / reset timer */
 void timer_start(Timer *t);
 
@@ -21,4 +41,19 @@ void timer_sleep(double seconds);
 void timer_sleep_remaining(const struct timespec *frame_start,
                            double frame_duration);
 
+/* Sleep until the absolute deadline at seconds after the timer start */
+void timer_sleep_until(const Timer *t, double at);
+
+/* Next deadline of a period after the one at deadline, skipping any already passed at now */
+double timer_pace(double period, double deadline, double now);
+
+/* Count a wait that ended lateness seconds after its deadline */
+void timer_record(double lateness);
+
+/* Lateness histogram so far */
+const TimerStats *timer_stats(void);
+
+/* Print the lateness histogram */
+void timer_report(void);
+
 #endif /* TIMER_H */
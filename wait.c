@@ -0,0 +1,76 @@
+#include <math.h>
+
+#include "main.h"
+#include "schedule.h"
+#include "activity.h"
+#include "wait.h"
+
+/*
+    Accounting of the wait between breaks.
+
+    Time away counts as a break once the user is back, from the moment
+    idleness first reached the limit, and no break comes due while away.
+    Intense work, sampled every ACTIVITY_PERIOD seconds, brings every
+    deadline closer. The observations come from the caller, the X server
+    for the program and a trace on a virtual clock for the simulator, so
+    both account alike.
+*/
+
+#define ACTIVITY_PERIOD 10 // Seconds between activity samples
+
+
+void wait_start(GlobalContext *gctx, WaitProgress *wait)
+{
+    *wait = (WaitProgress){ .next_sample = ACTIVITY_PERIOD };
+
+    // Input during the break is not work
+    activity_sample(gctx);
+}
+
+
+GlobalState wait_update(GlobalContext *gctx, WaitProgress *wait, double elapsed, bool idle)
+{
+    if (gctx->config.detect_idle)
+    {
+        if (idle && !wait->idle)
+            wait->idle_since = elapsed;
+        // Back, away at least since idleness reached the limit
+        if (!idle && wait->idle)
+        {
+            schedule_rest(gctx, elapsed - wait->idle_since + gctx->config.idle_limit);
+            activity_sample(gctx);
+            wait->next_sample = elapsed + ACTIVITY_PERIOD;
+        }
+        wait->idle = idle;
+
+        // No break while away
+        if (idle)
+            return STATE_NONE;
+    }
+
+    if (gctx->activity.enabled && elapsed >= wait->next_sample)
+    {
+        ActivityRate rate = activity_sample(gctx);
+        double extra = activity_extra(gctx, &rate);
+        if (extra > 0.0)
+            schedule_spend(gctx, extra);
+        wait->next_sample = elapsed + ACTIVITY_PERIOD;
+    }
+
+    return schedule_left(gctx) <= 0 ? STATE_TIMEOUT : STATE_NONE;
+}
+
+
+double wait_next(GlobalContext *gctx, const WaitProgress *wait, double elapsed, double lead)
+{
+    // Nothing is due while away, the return is told by the caller
+    if (wait->idle)
+        return INFINITY;
+
+    double end = elapsed + schedule_left(gctx);
+    double next = end - lead > elapsed ? end - lead : end;
+
+    if (gctx->activity.enabled)
+        next = fmin(next, wait->next_sample);
+    return next;
+}
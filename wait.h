@@ -0,0 +1,17 @@
+#ifndef WAIT_H
+#define WAIT_H
+
+#include "main.h"
+
+/* Start a wait, input before it is not counted as work */
+void wait_start(GlobalContext *gctx, WaitProgress *wait);
+
+/* Account for the wait up to elapsed seconds, idle telling whether the user is away now.
+   STATE_TIMEOUT once a break is due */
+GlobalState wait_update(GlobalContext *gctx, WaitProgress *wait, double elapsed, bool idle);
+
+/* Elapsed time the wait must be updated at next, lead seconds before the break is due if there is time for it.
+   INFINITY while the user is away */
+double wait_next(GlobalContext *gctx, const WaitProgress *wait, double elapsed, double lead);
+
+#endif /* WAIT_H */